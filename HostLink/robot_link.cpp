@@ -0,0 +1,123 @@
+/*
+ * robot_link.cpp
+ */
+
+#include "robot_link.hpp"
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+Robot_Link::Robot_Link(void) : fd(-1), seq(0), start(std::chrono::steady_clock::now()), rx_len(0), rx_pos(0) {}
+
+Robot_Link::~Robot_Link(void) {
+	close();
+}
+
+bool Robot_Link::open(const char *device) {
+	close();
+	fd = ::open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if(fd < 0) return false;
+
+	// raw bytes, no echo, no line discipline (the baud rate means nothing to a CDC device)
+	struct termios tio;
+	if(tcgetattr(fd, &tio) != 0) {
+		close();
+		return false;
+	}
+	cfmakeraw(&tio);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	if(tcsetattr(fd, TCSANOW, &tio) != 0) {
+		close();
+		return false;
+	}
+	tcflush(fd, TCIOFLUSH);
+	decoder.reset();
+	rx_len = rx_pos = 0;
+	return true;
+}
+
+void Robot_Link::close(void) {
+	if(fd >= 0) ::close(fd);
+	fd = -1;
+}
+
+bool Robot_Link::send_velocity(float x, float y, float omega) {
+	Protocol::frame f;
+	f.type = Protocol::Velocity;
+	f.velocity.x = x;
+	f.velocity.y = y;
+	f.velocity.omega = omega;
+	return send(f);
+}
+
+bool Robot_Link::send_kick(float power, uint16_t duration_ms) {
+	Protocol::frame f;
+	f.type = Protocol::Kick;
+	f.kick.power = power;
+	f.kick.duration_ms = duration_ms;
+	return send(f);
+}
+
+bool Robot_Link::send_dribble(float speed) {
+	Protocol::frame f;
+	f.type = Protocol::Dribble;
+	f.dribble.speed = speed;
+	return send(f);
+}
+
+bool Robot_Link::send_config(Protocol::config_key key, float value) {
+	Protocol::frame f;
+	f.type = Protocol::Config;
+	f.config.key = key;
+	f.config.value = value;
+	return send(f);
+}
+
+bool Robot_Link::start_telemetry(uint8_t groups, uint32_t decimation) {
+	return send_config(Protocol::Telemetry_Decimation, (float)decimation)
+	    && send_config(Protocol::Telemetry_Groups, (float)groups);
+}
+
+bool Robot_Link::hold_heading(float theta) {
+	return send_config(Protocol::Heading_Hold, theta);
+}
+
+bool Robot_Link::release_heading(void) {
+	return send_config(Protocol::Heading_Release, 0);
+}
+
+bool Robot_Link::reset_heading(float theta) {
+	return send_config(Protocol::Heading_Reset, theta);
+}
+
+bool Robot_Link::send(Protocol::frame& f) {
+	if(fd < 0) return false;
+	f.seq = seq;
+	f.timestamp_us = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+	                     std::chrono::steady_clock::now() - start).count();
+	uint8_t bytes[Protocol_Max_Encoded_Size];
+	size_t len = Protocol::encode(f, bytes, sizeof(bytes));
+	if(len == 0) return false;
+	// one write per frame so it goes out in one USB packet
+	if(::write(fd, bytes, len) != (ssize_t)len) return false;
+	seq++;
+	return true;
+}
+
+Protocol::Decoder::result Robot_Link::poll(Protocol::frame& f) {
+	while(fd >= 0) {
+		if(rx_pos == rx_len) {
+			ssize_t n = ::read(fd, rx_buf, sizeof(rx_buf));
+			if(n <= 0) break;
+			rx_len = (size_t)n;
+			rx_pos = 0;
+		}
+		size_t used;
+		Protocol::Decoder::result r = decoder.feed(&rx_buf[rx_pos], rx_len - rx_pos, f, used);
+		rx_pos += used;
+		if(r == Protocol::Decoder::Frame_Ready) return r;
+	}
+	return Protocol::Decoder::Incomplete;
+}
@@ -0,0 +1,70 @@
+/*
+ * robot_link.hpp
+ *
+ * Host side of the binary command protocol: opens the robot's USB virtual
+ * COM port and sends typed frames, numbered and timestamped. What the robot
+ * sends back (telemetry) comes out of poll(), see telemetry_log.hpp for a CSV
+ * writer.
+ *
+ * The frame format itself is shared with the firmware, build this together with
+ * RoboMaster/UserCode/CommunicationModule/Protocol/robot_protocol.cpp and that
+ * directory on the include path, e.g.
+ *  g++ -std=c++14 -I../RoboMaster/UserCode/CommunicationModule \
+ *      robot_link.cpp ../RoboMaster/UserCode/CommunicationModule/Protocol/robot_protocol.cpp ...
+ *
+ * POSIX only (Linux, macOS). Sending never allocates, a frame is encoded on
+ * the stack and written in one write().
+ */
+
+#ifndef ROBOT_LINK_HPP_
+#define ROBOT_LINK_HPP_
+
+#include "Protocol/robot_protocol.hpp"
+
+#include <chrono>
+
+class Robot_Link {
+public:
+	Robot_Link(void);
+	~Robot_Link(void);
+
+	// e.g. "/dev/ttyACM0", raw mode. false on failure, see errno
+	bool open(const char *device);
+	void close(void);
+	inline bool is_open(void) const {return fd >= 0;}
+
+	// m/s, m/s, rad/s in the robot's body frame
+	bool send_velocity(float x, float y, float omega);
+	// power 0 ~ 1
+	bool send_kick(float power, uint16_t duration_ms);
+	// speed -1 ~ 1
+	bool send_dribble(float speed);
+	bool send_config(Protocol::config_key key, float value);
+	/* Protocol::telemetry_group bits, a frame every decimation control steps
+	 * (e.g. 5 at the 5kHz control rate is 1kHz), groups 0 stops it */
+	bool start_telemetry(uint8_t groups, uint32_t decimation);
+	/* rad, -2Pi ~ 2Pi: the robot turns to and holds this absolute heading (its gyro's, set by
+	 * reset_heading()), the omega of send_velocity() is ignored until release_heading() */
+	bool hold_heading(float theta);
+	bool release_heading(void);
+	bool reset_heading(float theta);
+
+	// fills in the sequence number and timestamp, encodes and writes
+	bool send(Protocol::frame& f);
+
+	// frames from the robot, Frame_Ready with f filled in, Incomplete when nothing (more) is there
+	Protocol::Decoder::result poll(Protocol::frame& f);
+	inline Protocol::Decoder::decoder_stats get_rx_stats(void) const {return decoder.get_stats();}
+
+	inline uint16_t get_next_seq(void) const {return seq;}
+
+private:
+	int fd;
+	uint16_t seq;
+	std::chrono::steady_clock::time_point start;
+	Protocol::Decoder decoder;
+	uint8_t rx_buf[4096]; // a few ms of telemetry per read()
+	size_t rx_len, rx_pos;
+};
+
+#endif /* ROBOT_LINK_HPP_ */
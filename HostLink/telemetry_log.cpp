@@ -0,0 +1,142 @@
+/*
+ * telemetry_log.cpp
+ */
+
+#include "telemetry_log.hpp"
+
+#include <inttypes.h>
+
+using namespace Protocol;
+
+static const char *motor_columns[] = {"angle", "speed_rpm", "current_A", "velocity"};
+static const char *setpoint_columns[] = {"velocity_setpoint", "current_cmd"};
+static const char *pid_columns[] = {"p", "i", "d", "ff"};
+static const char *imu_columns[] = {"accel_x", "accel_y", "accel_z", "gyro_x", "gyro_y", "gyro_z"};
+static const char *timing_columns[] = {"period_us", "exec_us", "jitter_max_us", "overruns"};
+static const char *latency_histograms[] = {"command_age", "can_origin"};
+static const char *latency_columns[] = {"p50_us", "p99_us", "max_us", "count"};
+
+#define Num_Columns(columns) (sizeof(columns) / sizeof(columns[0]))
+
+// n empty cells, for a group the frame doesn't carry
+static void put_empty(FILE *file, size_t n) {
+	for(size_t i = 0; i < n; i++) fputc(',', file);
+}
+
+static void put_float(FILE *file, float v) {
+	fprintf(file, ",%.9g", v);
+}
+
+Telemetry_Log::Telemetry_Log(void) : file(NULL) {}
+
+Telemetry_Log::~Telemetry_Log(void) {
+	close();
+}
+
+bool Telemetry_Log::open(const char *path) {
+	close();
+	file = fopen(path, "w");
+	if(file == NULL) return false;
+	// a frame per ms or faster, write in large chunks
+	setvbuf(file, NULL, _IOFBF, 1 << 16);
+
+	has_frame = false;
+	expected_seq = 0;
+	last_timestamp_us = 0;
+	time_us = 0;
+	stats.rows = 0;
+	stats.lost = 0;
+
+	fputs("seq,time_us,decimation", file);
+	for(int m = 1; m <= 4; m++) {
+		for(size_t c = 0; c < Num_Columns(motor_columns); c++) fprintf(file, ",m%d_%s", m, motor_columns[c]);
+	}
+	for(int m = 1; m <= 4; m++) {
+		for(size_t c = 0; c < Num_Columns(setpoint_columns); c++) fprintf(file, ",m%d_%s", m, setpoint_columns[c]);
+	}
+	for(int m = 1; m <= 4; m++) {
+		for(size_t c = 0; c < Num_Columns(pid_columns); c++) fprintf(file, ",m%d_%s", m, pid_columns[c]);
+	}
+	for(size_t c = 0; c < Num_Columns(imu_columns); c++) fprintf(file, ",%s", imu_columns[c]);
+	for(size_t c = 0; c < Num_Columns(timing_columns); c++) fprintf(file, ",%s", timing_columns[c]);
+	for(size_t h = 0; h < Num_Columns(latency_histograms); h++) {
+		for(size_t c = 0; c < Num_Columns(latency_columns); c++) fprintf(file, ",%s_%s", latency_histograms[h], latency_columns[c]);
+	}
+	fputc('\n', file);
+	return !ferror(file);
+}
+
+void Telemetry_Log::close(void) {
+	if(file != NULL) fclose(file);
+	file = NULL;
+}
+
+bool Telemetry_Log::write(const frame& f) {
+	if(file == NULL || f.type != Telemetry) return false;
+	const telemetry_payload& t = f.telemetry;
+
+	// the robot's us clock wraps every ~71 minutes, frames come far more often than that
+	if(has_frame) {
+		time_us += (uint32_t)(f.timestamp_us - last_timestamp_us);
+		uint16_t gap = (uint16_t)(f.seq - expected_seq);
+		if(gap < 0x8000) stats.lost += gap;
+	}
+	else time_us = f.timestamp_us;
+	last_timestamp_us = f.timestamp_us;
+	expected_seq = (uint16_t)(f.seq + 1);
+	has_frame = true;
+
+	fprintf(file, "%u,%" PRIu64 ",%u", (unsigned)f.seq, time_us, (unsigned)t.decimation);
+	if(t.groups & Telemetry_Motors) {
+		for(int i = 0; i < 4; i++) {
+			fprintf(file, ",%u,%d", (unsigned)t.motor[i].angle, (int)t.motor[i].speed);
+			put_float(file, t.motor[i].current);
+			put_float(file, t.motor[i].velocity);
+		}
+	}
+	else put_empty(file, 4 * Num_Columns(motor_columns));
+	if(t.groups & Telemetry_Setpoints) {
+		for(int i = 0; i < 4; i++) {
+			put_float(file, t.setpoint[i].velocity);
+			put_float(file, t.setpoint[i].current);
+		}
+	}
+	else put_empty(file, 4 * Num_Columns(setpoint_columns));
+	if(t.groups & Telemetry_PID) {
+		for(int i = 0; i < 4; i++) {
+			put_float(file, t.pid[i].p);
+			put_float(file, t.pid[i].i);
+			put_float(file, t.pid[i].d);
+			put_float(file, t.pid[i].ff);
+		}
+	}
+	else put_empty(file, 4 * Num_Columns(pid_columns));
+	if(t.groups & Telemetry_IMU) {
+		for(int i = 0; i < 3; i++) put_float(file, t.imu.accel[i]);
+		for(int i = 0; i < 3; i++) put_float(file, t.imu.gyro[i]);
+	}
+	else put_empty(file, Num_Columns(imu_columns));
+	if(t.groups & Telemetry_Timing) {
+		put_float(file, t.timing.period_us);
+		put_float(file, t.timing.exec_us);
+		put_float(file, t.timing.jitter_max_us);
+		fprintf(file, ",%u", (unsigned)t.timing.overruns);
+	}
+	else put_empty(file, Num_Columns(timing_columns));
+	if(t.groups & Telemetry_Latency) {
+		const latency_summary *summaries[2] = {&t.latency.command_age, &t.latency.can_origin};
+		for(int h = 0; h < 2; h++) {
+			fprintf(file, ",%u,%u,%u,%u", (unsigned)summaries[h]->p50_us, (unsigned)summaries[h]->p99_us,
+			        (unsigned)summaries[h]->max_us, (unsigned)summaries[h]->count);
+		}
+	}
+	else put_empty(file, Num_Columns(latency_histograms) * Num_Columns(latency_columns));
+	fputc('\n', file);
+
+	stats.rows++;
+	return !ferror(file);
+}
+
+void Telemetry_Log::flush(void) {
+	if(file != NULL) fflush(file);
+}
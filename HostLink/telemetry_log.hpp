@@ -0,0 +1,55 @@
+/*
+ * telemetry_log.hpp
+ *
+ * Robot telemetry (Protocol::Telemetry frames, from Robot_Link::poll()) into a
+ * CSV file: one row per frame, one column per signal, whatever the groups of
+ * the frame. Signals of groups a frame doesn't carry are left empty, so the
+ * columns stay the same when the robot's selection changes mid-run.
+ *
+ * Columns: seq, time_us (robot clock, unwrapped), decimation, then per motor
+ * m1_angle ... m4_ff, then the IMU, the control task timing and the command
+ * latency summaries (command_age_p50_us ... can_origin_count), see the header row. Floats are written with 9 significant digits, they read back bit exact.
+ *
+ * Build with robot_link.cpp and the shared protocol, e.g.
+ *  g++ -std=c++14 -I../RoboMaster/UserCode/CommunicationModule \
+ *      telemetry_log.cpp robot_link.cpp ../RoboMaster/UserCode/CommunicationModule/Protocol/robot_protocol.cpp ...
+ */
+
+#ifndef TELEMETRY_LOG_HPP_
+#define TELEMETRY_LOG_HPP_
+
+#include "Protocol/robot_protocol.hpp"
+
+#include <stdio.h>
+
+class Telemetry_Log {
+public:
+	struct log_stats {
+		uint32_t rows;
+		uint32_t lost;    // frames missing according to the sequence numbers
+	};
+
+	Telemetry_Log(void);
+	~Telemetry_Log(void);
+
+	// creates or truncates the file and writes the header row, false on failure, see errno
+	bool open(const char *path);
+	void close(void);
+	inline bool is_open(void) const {return file != NULL;}
+
+	// one row, false if f isn't telemetry or the file isn't open
+	bool write(const Protocol::frame& f);
+	void flush(void);
+
+	inline log_stats get_stats(void) const {return stats;}
+
+private:
+	FILE *file;
+	bool has_frame;
+	uint16_t expected_seq;
+	uint32_t last_timestamp_us;
+	uint64_t time_us;
+	log_stats stats;
+};
+
+#endif /* TELEMETRY_LOG_HPP_ */
@@ -0,0 +1,137 @@
+/*
+ * pid_sim.cpp
+ *
+ * Velocity loop of the M2006 motors on a simulated motor, to compare the
+ * Batch_INC_PID_Controller options (anti-windup, derivative filter,
+ * feed-forward) by overshoot, settling time, output noise and tracking error.
+ *
+ * Model, normalized like the velocity loop: dv/dt = (3u - v) / 0.1s, v in % of
+ * max velocity, u in % of max current. Feedback is sampled at the ESC's 1kHz,
+ * the loop runs at 5kHz with the app's gains (1.5, 10, 0) and +-100% output.
+ * Without anti-windup means the clamp applied after the controller, which
+ * keeps integrating, i.e. what the controller did before.
+ *
+ * Host only, e.g.
+ *  g++ -std=c++14 -O2 -I../RoboMaster/UserCode/ActuatorsModule pid_sim.cpp -o pid_sim && ./pid_sim
+ */
+
+#include "batch_incremental_pid.hpp"
+
+#include <stdio.h>
+#include <math.h>
+#include <random>
+
+static const float ctrl_freq_Hz = 5000.00f;
+static const float dt_s = 1.00f / ctrl_freq_Hz;
+static const int steps_per_feedback = 5;    // 1kHz feedback
+static const float model_gain = 3.00f;      // % of velocity per % of current, steady state
+static const float model_tau_s = 0.10f;
+
+struct sim_result {
+	float overshoot;     // % of the setpoint
+	float settling_s;    // until within 2% of the setpoint for good
+	float output_std;    // % of max current
+};
+
+struct sim_options {
+	bool wall = false;             // stalled from 0.5s to 1.5s
+	float noise = 0;               // feedback noise std, % of max velocity
+	float t_end_s = 3.00f;
+	float t_measure_s = 0;         // results from here on
+};
+
+static Batch_INC_PID_Controller<4> make_controller(float Kp, float Ki, float Kd, bool anti_windup) {
+	Batch_INC_PID_Controller<4> c(Kp, Ki, Kd);
+	c.init(ctrl_freq_Hz);
+	// without anti-windup, the controller itself is unlimited and clamped outside
+	if(anti_windup) c.set_output_limits(-100.00f, 100.00f);
+	return c;
+}
+
+// step 0 -> 50% at t = 0
+static sim_result run_step(Batch_INC_PID_Controller<4>& c, const sim_options& opt) {
+	const float setpoint = 50.00f;
+	std::mt19937 rng(1);
+	std::normal_distribution<float> noise(0, opt.noise > 0 ? opt.noise : 1);
+	float v = 0, measured = 0, peak = 0, last_outside = -1;
+	double sum = 0, sum2 = 0;
+	int n = 0;
+
+	for(int k = 0; k * dt_s < opt.t_end_s; k++) {
+		float t = k * dt_s;
+		if(k % steps_per_feedback == 0) measured = v + (opt.noise > 0 ? noise(rng) : 0);
+		float errors[4] = {setpoint - measured, 0, 0, 0}, outputs[4];
+		c.calculate(errors, outputs);
+		float u = fminf(fmaxf(outputs[0], -100.00f), 100.00f);
+
+		if(opt.wall && t >= 0.50f && t < 1.50f) v = 0;
+		else v += (model_gain * u - v) / model_tau_s * dt_s;
+
+		if(t >= opt.t_measure_s) {
+			if(v > peak) peak = v;
+			if(fabsf(v - setpoint) > 0.02f * setpoint) last_outside = t;
+			sum += u;
+			sum2 += u * u;
+			n++;
+		}
+	}
+	double mean = sum / n;
+	sim_result r;
+	r.overshoot = (peak - setpoint) / setpoint * 100.00f;
+	r.settling_s = (last_outside < 0) ? 0 : last_outside - opt.t_measure_s;
+	r.output_std = (float)sqrt(sum2 / n - mean * mean);
+	return r;
+}
+
+// ramp 0 -> 50% in 0.5s then hold, max |setpoint - velocity|
+static float run_ramp(Batch_INC_PID_Controller<4>& c) {
+	float v = 0, measured = 0, max_error = 0;
+	float errors[4] = {0, 0, 0, 0}, outputs[4], ref_vel[4] = {0, 0, 0, 0}, ref_acc[4] = {0, 0, 0, 0};
+	for(int k = 0; k * dt_s < 2.00f; k++) {
+		float t = k * dt_s;
+		float ref = (t < 0.50f) ? 100.00f * t : 50.00f;
+		if(k % steps_per_feedback == 0) measured = v;
+		errors[0] = ref - measured;
+		ref_vel[0] = ref;
+		ref_acc[0] = (t < 0.50f) ? 100.00f : 0;
+		c.calculate(errors, outputs, ref_vel, ref_acc);
+		v += (model_gain * outputs[0] - v) / model_tau_s * dt_s;
+		if(fabsf(ref - v) > max_error) max_error = fabsf(ref - v);
+	}
+	return max_error;
+}
+
+int main(void) {
+	printf("anti-windup off -> on\n");
+	for(int wall = 0; wall < 2; wall++) {
+		sim_options opt;
+		opt.wall = wall;
+		opt.t_measure_s = wall ? 1.50f : 0;
+		opt.t_end_s = opt.t_measure_s + 3.00f;
+		sim_result r[2];
+		for(int aw = 0; aw < 2; aw++) {
+			Batch_INC_PID_Controller<4> c = make_controller(1.5f, 10, 0, aw);
+			r[aw] = run_step(c, opt);
+		}
+		printf("%-28s overshoot %6.1f%% -> %6.1f%%, settling (2%%) %5.0fms -> %5.0fms\n",
+		       wall ? "stalled 1s, then released:" : "step 0->50%:",
+		       r[0].overshoot, r[1].overshoot, r[0].settling_s * 1000, r[1].settling_s * 1000);
+	}
+
+	sim_options noisy;
+	noisy.noise = 0.30f;
+	noisy.t_measure_s = 1.00f;
+	Batch_INC_PID_Controller<4> unfiltered = make_controller(1.5f, 10, 0.2f, true);
+	Batch_INC_PID_Controller<4> filtered = make_controller(1.5f, 10, 0.2f, true);
+	filtered.set_derivative_filter(50);
+	printf("%-28s output std %.2f%% -> %.2f%% with a 50Hz derivative filter\n", "Kd 0.2, 0.3% noise:",
+	       run_step(unfiltered, noisy).output_std, run_step(filtered, noisy).output_std);
+
+	// Kff_vel: the model's steady state current per velocity, Kff_acc: tau of it
+	Batch_INC_PID_Controller<4> plain = make_controller(1.5f, 10, 0, true);
+	Batch_INC_PID_Controller<4> ff = make_controller(1.5f, 10, 0, true);
+	ff.update_feed_forward_consts(1.00f / model_gain, model_tau_s / model_gain);
+	printf("%-28s max tracking error %.1f%% -> %.1f%% with feed-forward\n", "ramp 0->50% in 0.5s:",
+	       run_ramp(plain), run_ramp(ff));
+	return 0;
+}
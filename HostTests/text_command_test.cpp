@@ -0,0 +1,201 @@
+/*
+ * text_command_test.cpp
+ *
+ * Protocol::parse_text_command() against DjiRM::M2006_Motor::parse_cmd(), the
+ * std::stof() one it replaces: on the "x,y,omega" lines of the firmware
+ * benchmark, then on random edits of them. Both have to give the same 3 floats
+ * or both reject the line (parse_cmd() throws). Needs exceptions, which the
+ * firmware is built without, so this runs on the host only.
+ *
+ * With --table it prints the expected results of the corpus instead, as the
+ * bench_text_commands[] rows of Main/benchmarks.cpp.
+ *
+ * Host only (glibc), e.g.
+ *  g++ -std=c++14 -O2 -I../RoboMaster/UserCode/CommunicationModule/Protocol text_command_test.cpp \
+ *      ../RoboMaster/UserCode/CommunicationModule/Protocol/text_command.cpp -o text_command_test && ./text_command_test
+ */
+
+#include "text_command.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <stdexcept>
+
+static const int num_fuzz_lines = 200000;
+
+/* the lines of benchmarks.cpp: as the host sends them, then separators missing or doubled,
+ * junk after numbers, no number, exponents, hex, inf / nan, out of range, halfway between
+ * 2 floats, long digit strings. Left out: numbers under FLT_MIN and ones a hair off halfway
+ * between 2 floats, where newlib's strtof() (strtod() then a cast) differs from glibc's */
+static const char *const command_lines[] = {
+	"0,0,0",
+	"0.5,-0.25,1.2",
+	"-0.35,0.8,-3.14159",
+	"1.25,0,0.5",
+	"-1.5,1.5,-6",
+	"0.123,-0.456,0.789",
+	"2,-2,0.05",
+	"0.001,0.999,-0.5",
+	// odd ones
+	"1.5",
+	"",
+	",",
+	",,",
+	"1,,2",
+	"1,2,3,4",
+	"abc,1,2",
+	"1,2,x",
+	"1x,2y,3z",
+	" \t1 , 2 ,\r\n3 ",
+	"1;2;3",
+	"1 2 3",
+	"--1,++2,+-3",
+	"1.2.3,4..5,.6.",
+	"+.5,-.5,5.",
+	" 1e-3, 2E+2,\t-0",
+	"1e,1e+,1e-x",
+	".e1,0,0",
+	"0x1.8p1,0x10,-0x.8",
+	"0x,0x.,0xp1",
+	"0x123456789abcdef0123p0,0x.0000001p0,0X1P+3",
+	"nan,inf,-infinity",
+	"NaN(abc),INF,-nan",
+	"nan(,nan(),nan(a_1)",
+	"3.4028235e38,-3.4028235e38,0",
+	"3.40282357e38,0,0",
+	"3.5e38,0,0",
+	"0e999999,-0,00000.000",
+	"1e999999,1e-999999,0",
+	"16777217,16777219,33554434",
+	"12345678,123456789,0.123456789",
+	"0.1000000000000000055511151231257827021181583404541015625,9999999999999999999999,1e11",
+	"1.00000005960464477539062,0.333333343267440796,2.71828182845904523536"
+};
+static const int num_command_lines = sizeof(command_lines) / sizeof(command_lines[0]);
+
+struct Parsed_cmd {
+	float x;
+	float y;
+	float omega;
+};
+
+// DjiRM::M2006_Motor::parse_cmd() as is, its header needs the HAL
+static Parsed_cmd parse_cmd(std::string cmd_str) {
+	Parsed_cmd parsed_cmd;
+	int firstDelim;
+	int sndDelim;
+	int stringlen = cmd_str.length();
+	std::string my_str2;
+
+	parsed_cmd.x = 0;
+	parsed_cmd.y = 0;
+	parsed_cmd.omega = 0;
+
+	firstDelim = cmd_str.find(',');
+	if(firstDelim == stringlen) {
+		return parsed_cmd;
+	}
+	parsed_cmd.x = std::stof(cmd_str.substr(0, firstDelim));
+	my_str2 = cmd_str.substr(firstDelim + 1, std::string::npos);
+	sndDelim = my_str2.find(',');
+	parsed_cmd.y = std::stof(my_str2.substr(0, sndDelim));
+	parsed_cmd.omega = std::stof(my_str2.substr(sndDelim + 1, std::string::npos));
+
+	return parsed_cmd;
+}
+
+static bool same_float(float a, float b) {
+	if(a != a || b != b) return a != a && b != b && signbit(a) == signbit(b); // NaN payloads aren't kept
+	return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+static bool check_line(const std::string& line) {
+	Parsed_cmd expected = {0, 0, 0};
+	bool expected_ok = true;
+	try {
+		expected = parse_cmd(line);
+	}
+	catch(const std::exception&) {
+		expected_ok = false;
+	}
+	Protocol::velocity_payload cmd;
+	bool ok = Protocol::parse_text_command(line.data(), line.length(), cmd);
+	if(ok != expected_ok) return false;
+	return !ok || (same_float(cmd.x, expected.x) && same_float(cmd.y, expected.y) && same_float(cmd.omega, expected.omega));
+}
+
+// as a C++ float literal that reads back bit exact
+static void print_float(float v) {
+	if(v != v) printf("%sNAN", signbit(v) ? "-" : "");
+	else if(isinf(v)) printf("%sINFINITY", v < 0 ? "-" : "");
+	else {
+		char digits[32];
+		snprintf(digits, sizeof(digits), "%.9g", v);
+		printf("%s%sf", digits, strpbrk(digits, ".e") ? "" : ".0");
+	}
+}
+
+// {"line", ok, x, y, omega}, C escapes for the control characters
+static void print_table(void) {
+	for(int i = 0; i < num_command_lines; i++) {
+		Parsed_cmd expected = {0, 0, 0};
+		bool ok = true;
+		try {
+			expected = parse_cmd(command_lines[i]);
+		}
+		catch(const std::exception&) {
+			ok = false;
+		}
+		printf("\t{\"");
+		for(const char *c = command_lines[i]; *c != '\0'; c++) {
+			if(*c == '\t') printf("\\t");
+			else if(*c == '\r') printf("\\r");
+			else if(*c == '\n') printf("\\n");
+			else putchar(*c);
+		}
+		printf("\", %s, ", ok ? "true" : "false");
+		print_float(expected.x);
+		printf(", ");
+		print_float(expected.y);
+		printf(", ");
+		print_float(expected.omega);
+		printf("}%s\n", (i + 1 < num_command_lines) ? "," : "");
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if(argc > 1 && strcmp(argv[1], "--table") == 0) {
+		print_table();
+		return 0;
+	}
+
+	// the corpus, then random edits of it, from characters that mean something to strtof()
+	static const char edit_chars[] = "0123456789.,+-eExXpPaAnNiIfF( )\t";
+	int num_checked = 0, num_mismatches = 0;
+	uint32_t seed = 12345;
+	for(int i = 0; i < num_command_lines + num_fuzz_lines; i++) {
+		std::string line = command_lines[i % num_command_lines];
+		if(i >= num_command_lines) {
+			seed = seed * 1664525 + 1013904223;
+			int num_edits = 1 + (seed >> 28) % 4;
+			for(int e = 0; e < num_edits; e++) {
+				seed = seed * 1664525 + 1013904223;
+				size_t pos = (seed >> 8) % (line.length() + 1);
+				char c = edit_chars[(seed >> 20) % (sizeof(edit_chars) - 1)];
+				switch((seed >> 30) % 3) {
+				case 0:  if(pos < line.length()) line[pos] = c; break;
+				case 1:  line.insert(pos, 1, c); break;
+				default: if(pos < line.length()) line.erase(pos, 1); break;
+				}
+			}
+		}
+		num_checked++;
+		if(!check_line(line)) {
+			if(num_mismatches++ < 10) printf("[mismatch] \"%s\"\n", line.c_str());
+		}
+	}
+	printf("checked %d lines against parse_cmd(), %d mismatches\n", num_checked, num_mismatches);
+	return (num_mismatches == 0) ? 0 : 1;
+}
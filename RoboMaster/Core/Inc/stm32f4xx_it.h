@@ -55,8 +55,10 @@ void UsageFault_Handler(void);
 void DebugMon_Handler(void);
 void CAN1_TX_IRQHandler(void);
 void CAN1_RX0_IRQHandler(void);
+void CAN1_SCE_IRQHandler(void);
 void USART2_IRQHandler(void);
 void TIM8_UP_TIM13_IRQHandler(void);
+void TIM7_IRQHandler(void);
 void OTG_FS_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 
@@ -51,6 +51,7 @@ SPI_HandleTypeDef hspi4;
 SPI_HandleTypeDef hspi5;
 
 TIM_HandleTypeDef htim2;
+TIM_HandleTypeDef htim7;
 
 UART_HandleTypeDef huart2;
 
@@ -83,7 +84,7 @@ const osThreadAttr_t UpdatePIDTask_attributes = {
   .cb_size = sizeof(myTask03ControlBlock),
   .stack_mem = &myTask03Buffer[0],
   .stack_size = sizeof(myTask03Buffer),
-  .priority = (osPriority_t) osPriorityAboveNormal,
+  .priority = (osPriority_t) osPriorityHigh,
 };
 /* Definitions for PrintInfo */
 osThreadId_t PrintInfoHandle;
@@ -146,6 +147,7 @@ static void MX_SPI4_Init(void);
 static void MX_SPI5_Init(void);
 static void MX_I2C2_Init(void);
 static void MX_TIM2_Init(void);
+static void MX_TIM7_Init(void);
 void StartDefaultTask(void *argument);
 void StartBlinkLEDTask(void *argument);
 void StartUpdatePIDTask(void *argument);
@@ -155,7 +157,8 @@ void StartSensorsTask(void *argument);
 void StartUpdateIMUTask(void *argument);
 
 /* USER CODE BEGIN PFP */
-
+// defined in stm32-thalamus (stf_timer.cpp), dispatches to stf::Timer instances
+extern void call_this_inside_HAL_TIM_PeriodElaspedCallback(TIM_HandleTypeDef *htimx);
 /* USER CODE END PFP */
 extern void setup();
 extern void defaultLoop();
@@ -206,6 +209,7 @@ int main(void)
   MX_SPI5_Init();
   MX_I2C2_Init();
   MX_TIM2_Init();
+  MX_TIM7_Init();
   /* USER CODE BEGIN 2 */
 
   /* USER CODE END 2 */
@@ -535,6 +539,44 @@ static void MX_TIM2_Init(void)
 
 }
 
+/**
+  * @brief TIM7 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM7_Init(void)
+{
+
+  /* USER CODE BEGIN TIM7_Init 0 */
+
+  /* USER CODE END TIM7_Init 0 */
+
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+  /* USER CODE BEGIN TIM7_Init 1 */
+
+  /* USER CODE END TIM7_Init 1 */
+  htim7.Instance = TIM7;
+  htim7.Init.Prescaler = 83;
+  htim7.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim7.Init.Period = 199;
+  htim7.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+  if (HAL_TIM_Base_Init(&htim7) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim7, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM7_Init 2 */
+
+  /* USER CODE END TIM7_Init 2 */
+
+}
+
 /**
   * @brief USART2 Initialization Function
   * @param None
@@ -786,7 +828,7 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
     HAL_IncTick();
   }
   /* USER CODE BEGIN Callback 1 */
-
+  call_this_inside_HAL_TIM_PeriodElaspedCallback(htim);
   /* USER CODE END Callback 1 */
 }
 
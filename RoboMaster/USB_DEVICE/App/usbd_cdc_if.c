@@ -139,6 +139,13 @@ __weak void CDC_Received_FS_Callback(char* buf, uint32_t len) {
 	UNUSED(buf);
 	UNUSED(len);
 }
+__weak void CDC_Transmitted_FS_Callback(uint8_t* buf, uint32_t len) {
+	UNUSED(buf);
+	UNUSED(len);
+}
+// the class was (re)started or stopped: bus reset, (re)enumeration or unplug
+__weak void CDC_Reset_FS_Callback(void) {
+}
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
 /**
@@ -165,6 +172,7 @@ static int8_t CDC_Init_FS(void)
   /* Set Application Buffers */
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  CDC_Reset_FS_Callback();
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -176,6 +184,7 @@ static int8_t CDC_Init_FS(void)
 static int8_t CDC_DeInit_FS(void)
 {
   /* USER CODE BEGIN 4 */
+  CDC_Reset_FS_Callback();
   return (USBD_OK);
   /* USER CODE END 4 */
 }
@@ -310,6 +319,9 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
   USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  if (hcdc == NULL){
+    return USBD_FAIL; // not configured by a host (yet)
+  }
   if (hcdc->TxState != 0){
     return USBD_BUSY;
   }
@@ -335,9 +347,8 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
 {
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 13 */
-  UNUSED(Buf);
-  UNUSED(Len);
   UNUSED(epnum);
+  CDC_Transmitted_FS_Callback(Buf, *Len);
   /* USER CODE END 13 */
   return result;
 }
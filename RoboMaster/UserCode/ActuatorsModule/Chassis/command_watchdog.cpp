@@ -0,0 +1,55 @@
+/*
+ * command_watchdog.cpp
+ */
+
+#include "command_watchdog.hpp"
+
+void Command_Watchdog::submit(float x, float y, float omega, uint32_t arrival_cycles) {
+	command_slot& slot = command.write_begin();
+	slot.id = ++command_id;
+	slot.cmd.x = x;
+	slot.cmd.y = y;
+	slot.cmd.omega = omega;
+	slot.cmd.arrival_cycles = arrival_cycles;
+	command.write_end();
+}
+
+Command_Watchdog::watchdog_event Command_Watchdog::poll(chassis_command& cmd) {
+	uint32_t now = stf::cycles();
+	watchdog_event event = No_Event;
+	bool changed = false;
+
+	command_slot slot;
+	// the commanding task can't finish a write while we spin here, pick it up next time
+	if(command.try_read(slot) && slot.id != applied_command_id) {
+		applied_command_id = slot.id;
+		uint32_t age_cycles = now - slot.cmd.arrival_cycles;
+		age.record_cycles(age_cycles);
+		if(stf::cycles_to_us(age_cycles) > deadline_us) {
+			// held up on the way, e.g. behind a stalled parser: as good as missing
+			published.num_stale++;
+			changed = true;
+		}
+		else {
+			cmd = slot.cmd;
+			applied_arrival_cycles = slot.cmd.arrival_cycles;
+			has_command = true;
+			expired = false;
+			published.num_commands++;
+			event = New_Command;
+		}
+	}
+
+	if(event == No_Event && has_command && !expired
+			&& stf::cycles_to_us(now - applied_arrival_cycles) > deadline_us) {
+		expired = true;
+		published.num_deadline_missed++;
+		event = Deadline_Missed;
+	}
+
+	if(event != No_Event || changed) {
+		published.expired = expired;
+		stats.write(published);
+	}
+	return event;
+}
@@ -0,0 +1,81 @@
+/*
+ * command_watchdog.hpp
+ *
+ * Deadline on host chassis commands: every command carries the stf::cycles()
+ * it arrived at (stamped in the USB / SPI / UART receive ISR), and once the
+ * latest one is older than the deadline the control task is told to bring
+ * the chassis to a stop, instead of driving on with it until the host comes back.
+ *
+ * submit() is called by the one task parsing the commands. poll() belongs to
+ * the control task: it hands over each new command once, and reports a
+ * missed deadline once per command. How old commands are when the control
+ * task picks them up goes into a latency histogram (arrival -> applied);
+ * the rest of the way, up to the CAN frame carrying the resulting current,
+ * is measured by the CAN Tx queue, see M2006_Motor::tag_next_command().
+ */
+
+#ifndef COMMAND_WATCHDOG_HPP_
+#define COMMAND_WATCHDOG_HPP_
+
+#include "stf.h"
+#include "seqlock.hpp"
+#include "latency_histogram.hpp"
+
+class Command_Watchdog {
+public:
+	// body velocity, as given to Velocity_Profile::set_target()
+	struct chassis_command {
+		float x;
+		float y;
+		float omega;
+		uint32_t arrival_cycles; // stf::cycles() in the receive ISR
+	};
+	enum watchdog_event : int {
+		No_Event,
+		New_Command,
+		Deadline_Missed
+	};
+	struct watchdog_stats {
+		uint32_t num_commands;   // taken by poll()
+		uint32_t num_deadline_missed;
+		uint32_t num_stale;      // already past the deadline when taken, dropped
+		bool expired;            // the latest command is past its deadline
+	};
+
+	Command_Watchdog(void) {}
+
+	// from arrival, default 100ms (6 frames of 60Hz vision)
+	inline void set_deadline_ms(float deadline_ms) {deadline_us = deadline_ms * 1000.00f;}
+
+	// the commanding task, one only
+	void submit(float x, float y, float omega, uint32_t arrival_cycles);
+
+	/* control task, every step. New_Command: cmd is the new command, to be applied now.
+	 * Deadline_Missed: stop, nothing more comes until the next New_Command */
+	watchdog_event poll(chassis_command& cmd);
+
+	// arrival -> taken by poll()
+	inline Latency_Histogram::histogram get_age_histogram(void) {return age.get();}
+	watchdog_stats get_stats(void) {return stats.read();}
+
+private:
+	struct command_slot {
+		uint32_t id; // bumped by every command
+		chassis_command cmd;
+	};
+
+	Seqlock<command_slot> command;
+	uint32_t command_id = 0;         // writer side
+	float deadline_us = 100000.00f;
+
+	/* poll() only */
+	uint32_t applied_command_id = 0;
+	uint32_t applied_arrival_cycles = 0;
+	bool has_command = false;
+	bool expired = false;
+	Latency_Histogram age;
+	Seqlock<watchdog_stats> stats;
+	watchdog_stats published = {};
+};
+
+#endif /* COMMAND_WATCHDOG_HPP_ */
@@ -0,0 +1,152 @@
+/*
+ * heading_control.cpp
+ */
+
+#include "heading_control.hpp"
+
+#include <math.h>
+
+static const float max_gap_s = 0.05f;     // longer between two samples: lost, don't integrate over it
+static const float stale_us = 20000.00f;  // gyro older than this: back to open loop
+
+static inline float wrap_angle(float angle) {
+	return remainderf(angle, 2.00f * (float)Pi);
+}
+
+void Heading_Control::set_rate_gains(float Kp, float Ki) {
+	this->Kp_rate = Kp;
+	this->Ki_rate = Ki;
+}
+
+void Heading_Control::set_heading_gain(float Kp) {
+	this->Kp_heading = Kp;
+}
+
+void Heading_Control::set_limits(float max_rate, float max_acc) {
+	this->max_rate = (max_rate > 0) ? max_rate : -max_rate;
+	this->max_acc = (max_acc > 0) ? max_acc : -max_acc;
+}
+
+void Heading_Control::set_max_acc(float max_acc) {
+	this->max_acc = (max_acc > 0) ? max_acc : -max_acc;
+}
+
+void Heading_Control::set_rate(float omega) {
+	heading_command& cmd = command.write_begin();
+	cmd.id = ++command_id;
+	cmd.mode = Rate_Mode;
+	cmd.value = omega;
+	command.write_end();
+}
+
+void Heading_Control::set_heading(float theta) {
+	heading_command& cmd = command.write_begin();
+	cmd.id = ++command_id;
+	cmd.mode = Heading_Mode;
+	cmd.value = theta;
+	command.write_end();
+}
+
+void Heading_Control::disable(void) {
+	heading_command& cmd = command.write_begin();
+	cmd.id = ++command_id;
+	cmd.mode = Heading_Off;
+	cmd.value = 0;
+	command.write_end();
+}
+
+void Heading_Control::reset_heading(float theta) {
+	heading_reset& req = reset_request.write_begin();
+	req.id = ++reset_id;
+	req.heading = theta;
+	reset_request.write_end();
+}
+
+void Heading_Control::update(float gz, uint32_t timestamp) {
+	float dt_s = 0;
+	if(has_prev) dt_s = stf::cycles_to_us(timestamp - prev_timestamp) * 0.000001f;
+	if(dt_s > max_gap_s) dt_s = 0;
+	prev_timestamp = timestamp;
+	has_prev = true;
+
+	apply_requests(gz);
+
+	// integrated gyro, kept within -Pi ~ Pi so the float keeps its resolution
+	heading += gz * dt_s;
+	if(heading > (float)Pi) heading -= 2.00f * (float)Pi;
+	else if(heading < -(float)Pi) heading += 2.00f * (float)Pi;
+
+	float omega = 0;
+	if(mode != Heading_Off) {
+		float desired;
+		if(mode == Rate_Mode) desired = rate_target;
+		else {
+			// the short way round, no faster than it can still brake from before the target
+			float error = wrap_angle(heading_target - heading);
+			desired = Kp_heading * error;
+			float limit = sqrtf(2.00f * max_acc * fabsf(error));
+			if(limit > max_rate) limit = max_rate;
+			if(desired > limit) desired = limit;
+			if(desired < -limit) desired = -limit;
+		}
+
+		float slew = max_acc * dt_s;
+		if(desired > rate_setpoint + slew) rate_setpoint += slew;
+		else if(desired < rate_setpoint - slew) rate_setpoint -= slew;
+		else rate_setpoint = desired;
+
+		float e = rate_setpoint - gz;
+		float integral_step = e * dt_s;
+		omega = rate_setpoint + Kp_rate * e + Ki_rate * (integral + integral_step);
+		// anti-windup by clamping: a step that ends up clamped doesn't integrate
+		float limit = 2.00f * max_rate;
+		if(omega > limit) omega = limit;
+		else if(omega < -limit) omega = -limit;
+		else integral += integral_step;
+	}
+
+	heading_status& s = status.write_begin();
+	s.mode = mode;
+	s.heading = heading;
+	s.heading_setpoint = heading_target;
+	s.rate_setpoint = rate_setpoint;
+	s.rate = gz;
+	s.omega = omega;
+	s.timestamp = timestamp;
+	status.write_end();
+}
+
+void Heading_Control::apply_requests(float gz) {
+	// the writers can't finish while we spin here, so don't: pick them up next time
+	heading_reset req;
+	if(reset_request.try_read(req) && req.id != applied_reset_id) {
+		applied_reset_id = req.id;
+		heading = wrap_angle(req.heading);
+	}
+
+	heading_command cmd;
+	if(!command.try_read(cmd) || cmd.id == applied_command_id) return;
+	applied_command_id = cmd.id;
+	if(mode == Heading_Off && cmd.mode != Heading_Off) {
+		// start from the rate it is turning at
+		rate_setpoint = gz;
+		integral = 0;
+	}
+	mode = cmd.mode;
+	if(cmd.mode == Rate_Mode) {
+		rate_target = cmd.value;
+		if(rate_target > max_rate) rate_target = max_rate;
+		if(rate_target < -max_rate) rate_target = -max_rate;
+	}
+	else if(cmd.mode == Heading_Mode) heading_target = wrap_angle(cmd.value);
+}
+
+bool Heading_Control::get_omega_command(float& omega) {
+	heading_status s;
+	// the IMU task can't finish a write while we spin here, keep the previous one then
+	if(status.try_read(s)) latest = s;
+	if(latest.mode == Heading_Off) return false;
+	if(stf::cycles_to_us(stf::cycles() - latest.timestamp) > stale_us) return false;
+	omega = latest.omega;
+	return true;
+}
@@ -0,0 +1,119 @@
+/*
+ * heading_control.hpp
+ *
+ * Closed loop yaw for the chassis: the host's omega goes to the wheels open
+ * loop, so any slip or wheel mismatch turns the robot a little between two
+ * vision frames. This loop closes it on the MPU6500 gyro z rate, at IMU rate.
+ *
+ *  Rate_Mode    : tracks a yaw rate setpoint
+ *  Heading_Mode : holds / turns to an absolute heading, the heading estimate
+ *                 being the integrated gyro rate (reset_heading() sets it)
+ *
+ * In Heading_Mode the heading error gives the rate setpoint (Kp_heading,
+ * limited to max_rate and to the rate it can still brake from at max_acc).
+ * In both modes the rate setpoint is slewed at max_acc, and the omega command is
+ *  omega = rate_setpoint + Kp_rate * e + Ki_rate * integral(e),  e = rate_setpoint - gz
+ * limited to +-2 * max_rate, a clamped step doesn't integrate. The rate
+ * setpoint is fed forward since the wheel velocity loops already track omega
+ * well, the PI part only takes out what they don't.
+ *
+ * In Rate_Mode the rate given is usually ramped already (the omega of the
+ * chassis velocity profile, every control step), keep max_acc at or above the
+ * profile's so the slewing only smooths mode switches and doesn't limit twice.
+ *
+ * set_rate(), set_heading(), disable() and reset_heading() can be called
+ * from any one task. update() belongs to the IMU task. get_omega_command()
+ * belongs to the control task, the omega command replaces the omega of the
+ * chassis velocity profile while a mode is on and the gyro is fresh.
+ */
+
+#ifndef HEADING_CONTROL_HPP_
+#define HEADING_CONTROL_HPP_
+
+#include "stf.h"
+#include "seqlock.hpp"
+
+class Heading_Control {
+public:
+	enum heading_mode : int {
+		Heading_Off,
+		Rate_Mode,
+		Heading_Mode
+	};
+	struct heading_status {
+		heading_mode mode;
+		float heading;          // rad, -Pi ~ Pi, integrated gyro
+		float heading_setpoint; // rad, Heading_Mode only
+		float rate_setpoint;    // rad/s, after slewing
+		float rate;             // rad/s, gyro
+		float omega;            // rad/s, command
+		uint32_t timestamp;     // stf::cycles() of the IMU sample
+	};
+
+	Heading_Control(void) {}
+
+	// rate loop: rad/s of omega per rad/s of rate error (default 0.3, 5.0)
+	void set_rate_gains(float Kp, float Ki);
+	// heading loop: rad/s of rate setpoint per rad of heading error (default 5)
+	void set_heading_gain(float Kp);
+	// rad/s, rad/s^2 (default 6, 12)
+	void set_limits(float max_rate, float max_acc);
+	// rad/s^2 only, e.g. along with the chassis profile's omega limit (a float store, any task)
+	void set_max_acc(float max_acc);
+
+	/* requests, any one task, taken by the next update(). Switching between the
+	 * modes keeps the rate setpoint going, leaving Heading_Off starts it from the gyro */
+	void set_rate(float omega);
+	void set_heading(float theta);
+	void disable(void);
+	// heading estimate to theta (e.g. from odometry or vision)
+	void reset_heading(float theta = 0);
+
+	// IMU task, every gyro sample: z rate in rad/s and the stf::cycles() it was read at
+	void update(float gz, uint32_t timestamp);
+
+	/* control task: the omega command, false (omega untouched) while off or
+	 * when the IMU task stopped updating */
+	bool get_omega_command(float& omega);
+
+	heading_status get_status(void) {return status.read();}
+
+private:
+	struct heading_command {
+		uint32_t id;   // bumped by every command
+		heading_mode mode;
+		float value;   // rad/s or rad
+	};
+	struct heading_reset {
+		uint32_t id;
+		float heading;
+	};
+
+	Seqlock<heading_command> command;
+	Seqlock<heading_reset> reset_request;
+	Seqlock<heading_status> status;
+	uint32_t command_id = 0, reset_id = 0;                 // writer side
+	uint32_t applied_command_id = 0, applied_reset_id = 0; // update() side
+
+	/* configuration */
+	float Kp_rate = 0.30f, Ki_rate = 5.00f;
+	float Kp_heading = 5.00f;
+	float max_rate = 6.00f, max_acc = 12.00f;
+
+	/* update() only */
+	heading_mode mode = Heading_Off;
+	float rate_target = 0;      // Rate_Mode
+	float heading_target = 0;   // Heading_Mode
+	float heading = 0;
+	float rate_setpoint = 0;
+	float integral = 0;
+	uint32_t prev_timestamp = 0;
+	bool has_prev = false;
+
+	/* get_omega_command() only */
+	heading_status latest = {};
+
+	void apply_requests(float gz);
+};
+
+#endif /* HEADING_CONTROL_HPP_ */
@@ -0,0 +1,174 @@
+/*
+ * odometry.cpp
+ */
+
+#include "odometry.hpp"
+
+#include <math.h>
+
+static const float history_period_us = 1000.00f;
+static const float small_angle = 0.10f; // rad per update, below it sin/cos go by their series
+
+/* Kahan summation: thousands of tiny steps a second onto a float that keeps growing
+ * would otherwise lose their low bits, e.g. ~1e-3 rad per turn at 5kHz */
+static inline void add_compensated(float& sum, float& compensation, float value) {
+	float y = value - compensation;
+	float t = sum + y;
+	compensation = (t - sum) - y;
+	sum = t;
+}
+
+void Odometry::update(const Wheel_speeds& wheels, float dt_s) {
+	uint32_t now = stf::cycles();
+
+	odometry_request req;
+	// a task writing a request can't finish while we spin here, so don't: pick it up next time
+	if(request.try_read(req) && req.id != applied_request_id) {
+		apply_request(req, now);
+		applied_request_id = req.id;
+	}
+
+	Body_velocity twist = kinematics.wheel_to_body(wheels);
+
+	/* Exact integration of a constant twist over dt: the body turns by d = omega * dt
+	 * and moves along the arc, in the body frame at the start of the step by
+	 *  dx = (vx * S - vy * C) * dt,  dy = (vx * C + vy * S) * dt
+	 * with S = sin(d) / d, C = (1 - cos(d)) / d (S -> 1, C -> 0 when going straight) */
+	float d = twist.omega * dt_s;
+	float S, C, sin_d, cos_d;
+	if(d < small_angle && d > -small_angle) {
+		float d2 = d * d;
+		S = 1.00f - d2 / 6.00f * (1.00f - d2 / 20.00f);
+		C = d / 2.00f * (1.00f - d2 / 12.00f * (1.00f - d2 / 30.00f));
+		sin_d = d * S;
+		cos_d = 1.00f - d * C;
+	}
+	else {
+		sin_d = sinf(d);
+		cos_d = cosf(d);
+		S = sin_d / d;
+		C = (1.00f - cos_d) / d;
+	}
+	float dx = (twist.x * S - twist.y * C) * dt_s;
+	float dy = (twist.x * C + twist.y * S) * dt_s;
+
+	add_compensated(current.x, compensation.x, cos_theta * dx - sin_theta * dy);
+	add_compensated(current.y, compensation.y, sin_theta * dx + cos_theta * dy);
+	add_compensated(current.theta, compensation.theta, d);
+	// rotate the heading's cos/sin along instead of calling cosf/sinf, renormalized to stop drift
+	float c = cos_theta * cos_d - sin_theta * sin_d;
+	float s = sin_theta * cos_d + cos_theta * sin_d;
+	float norm = 1.50f - 0.50f * (c * c + s * s);
+	cos_theta = c * norm;
+	sin_theta = s * norm;
+
+	// one history entry per millisec for correct()
+	if(history_count == 0 || stf::cycles_to_us(now - last_history_time) >= history_period_us) {
+		history[history_head] = current;
+		history_time[history_head] = now;
+		history_head = (history_head + 1) % Odometry_History_Size;
+		if(history_count < Odometry_History_Size) history_count++;
+		last_history_time = now;
+	}
+
+	Pose& p = pose.write_begin();
+	p.x = current.x;
+	p.y = current.y;
+	p.theta = current.theta;
+	p.vx = twist.x;
+	p.vy = twist.y;
+	p.omega = twist.omega;
+	p.timestamp = now;
+	pose.write_end();
+}
+
+void Odometry::reset(float x, float y, float theta) {
+	odometry_request& req = request.write_begin();
+	req.id = ++request_id;
+	req.type = Reset;
+	req.x = x;
+	req.y = y;
+	req.theta = theta;
+	req.age_ms = 0;
+	req.gain = 1.00f;
+	request.write_end();
+}
+
+void Odometry::correct(float x, float y, float theta, float age_ms, float gain) {
+	if(gain < 0) gain = 0;
+	if(gain > 1.00f) gain = 1.00f;
+	odometry_request& req = request.write_begin();
+	req.id = ++request_id;
+	req.type = Correct;
+	req.x = x;
+	req.y = y;
+	req.theta = theta;
+	req.age_ms = age_ms;
+	req.gain = gain;
+	request.write_end();
+}
+
+void Odometry::apply_request(const odometry_request& req, uint32_t now) {
+	if(req.type == Correct) {
+		apply_correction(req, now);
+		return;
+	}
+	current.x = req.x;
+	current.y = req.y;
+	current.theta = req.theta;
+	cos_theta = cosf(req.theta);
+	sin_theta = sinf(req.theta);
+	compensation = {0, 0, 0};
+	// the old history is in another frame now
+	history_count = 0;
+	history_head = 0;
+}
+
+void Odometry::apply_correction(const odometry_request& req, uint32_t now) {
+	// dead-reckoned pose when the measurement was captured: the newest entry at least age_ms old
+	uint32_t age_cycles = stf::us_to_cycles(req.age_ms * 1000.00f);
+	pose_2d then = current;
+	bool found = (req.age_ms <= 0);
+	for(uint32_t k = 1; k <= history_count && !found; k++) {
+		uint32_t i = (history_head + Odometry_History_Size - k) % Odometry_History_Size;
+		if(now - history_time[i] >= age_cycles) {
+			then = history[i];
+			found = true;
+		}
+	}
+	if(!found) {
+		num_corrections_dropped++;
+		return;
+	}
+
+	// where it should have been then, the heading error taken the short way round
+	float heading_error = remainderf(req.theta - then.theta, 2.00f * (float)Pi);
+	pose_2d corrected;
+	corrected.x = then.x + req.gain * (req.x - then.x);
+	corrected.y = then.y + req.gain * (req.y - then.y);
+	corrected.theta = then.theta + req.gain * heading_error;
+
+	/* the rigid motion taking then to corrected, applied to everything dead-reckoned
+	 * since, keeps the motion since the capture as it was */
+	float rotation = corrected.theta - then.theta;
+	float cr = cosf(rotation), sr = sinf(rotation);
+	float tx = corrected.x - (cr * then.x - sr * then.y);
+	float ty = corrected.y - (sr * then.x + cr * then.y);
+	transform_all(tx, ty, rotation);
+	num_corrections++;
+}
+
+// p = rotate(p, rotation) + t, for the current pose and the history
+void Odometry::transform_all(float tx, float ty, float rotation) {
+	float cr = cosf(rotation), sr = sinf(rotation);
+	for(uint32_t k = 0; k <= history_count; k++) {
+		pose_2d& p = (k < history_count) ? history[k] : current;
+		float x = p.x;
+		p.x = cr * x - sr * p.y + tx;
+		p.y = sr * x + cr * p.y + ty;
+		p.theta += rotation;
+	}
+	cos_theta = cosf(current.theta);
+	sin_theta = sinf(current.theta);
+	compensation = {0, 0, 0};
+}
@@ -0,0 +1,109 @@
+/*
+ * odometry.hpp
+ *
+ * Wheel odometry: dead-reckons the chassis pose from the 4 wheel velocities
+ * at control rate, and takes absolute corrections (e.g. 60Hz vision frames
+ * from the host) in between.
+ *
+ * Each update() turns the wheel speeds into the body twist (vx, vy, omega)
+ * through the least squares wheel -> body matrix of Omni_Kinematics, and
+ * integrates it exactly along the arc the twist describes over dt (constant
+ * twist assumption), rather than as a straight step, so driving and turning
+ * at the same time doesn't drift sideways. Heading is not wrapped, it keeps
+ * counting turns.
+ *
+ * update() belongs to one task (the control task). get_pose() can be called
+ * from any task, it is a lock-free copy of the latest pose (Seqlock).
+ * reset() and correct() are requests from other tasks, applied by the next
+ * update().
+ *
+ * correct() takes a measured pose and how long ago it was captured: the
+ * pose dead-reckoned at that time is looked up in a short history
+ * (Odometry_History_Size entries, one per millisec), moved towards the
+ * measurement by gain, and the motion since then is replayed on top of it,
+ * so a vision frame arriving late doesn't pull the robot back to where it was.
+ */
+
+#ifndef ODOMETRY_HPP_
+#define ODOMETRY_HPP_
+
+#include "stf.h"
+#include "seqlock.hpp"
+#include "omni_kinematics.hpp"
+
+#define Odometry_History_Size 128 // ms
+
+// world frame: m, m, rad, body twist: m/s, m/s, rad/s
+struct Pose_t {
+	float x;
+	float y;
+	float theta;
+	float vx;
+	float vy;
+	float omega;
+	uint32_t timestamp; // stf::cycles() of the update
+};
+typedef struct Pose_t Pose;
+
+class Odometry {
+public:
+	Odometry(const Omni_Kinematics& kinematics) : kinematics(kinematics) {}
+
+	/* control task: wheel speeds in the unit of the kinematics' wheel speed scale,
+	 * dt_s since the previous call */
+	void update(const Wheel_speeds& wheels, float dt_s);
+
+	// latest pose, any task
+	Pose get_pose(void) {return pose.read();}
+
+	/* requests, taken by the next update(), the latest one wins if several
+	 * come in between two updates */
+	void reset(float x = 0, float y = 0, float theta = 0);
+	/* measured pose captured age_ms ago, gain 0 ~ 1: how far to move towards it
+	 * (1 trusts the measurement fully). Dropped if older than the history */
+	void correct(float x, float y, float theta, float age_ms, float gain = 1.00f);
+
+	inline uint32_t get_num_corrections(void) {return num_corrections;}
+	inline uint32_t get_num_corrections_dropped(void) {return num_corrections_dropped;}
+
+private:
+	enum request_type : int {
+		Reset,
+		Correct
+	};
+	struct odometry_request {
+		uint32_t id; // bumped by every request
+		request_type type;
+		float x, y, theta;
+		float age_ms;
+		float gain;
+	};
+
+	struct pose_2d {
+		float x, y, theta;
+	};
+
+	const Omni_Kinematics& kinematics;
+	Seqlock<Pose> pose;
+	Seqlock<odometry_request> request; // written by a task, read by update()
+	uint32_t request_id = 0;           // writer side
+	uint32_t applied_request_id = 0;   // update() side
+
+	/* update() only */
+	pose_2d current = {0, 0, 0};
+	pose_2d compensation = {0, 0, 0}; // low bits lost by the sums in current
+	float cos_theta = 1.00f, sin_theta = 0;
+	pose_2d history[Odometry_History_Size];
+	uint32_t history_time[Odometry_History_Size]; // stf::cycles()
+	uint32_t history_head = 0;  // next slot
+	uint32_t history_count = 0;
+	uint32_t last_history_time = 0;
+	volatile uint32_t num_corrections = 0;
+	volatile uint32_t num_corrections_dropped = 0;
+
+	void apply_request(const odometry_request& req, uint32_t now);
+	void apply_correction(const odometry_request& req, uint32_t now);
+	void transform_all(float tx, float ty, float rotation);
+};
+
+#endif /* ODOMETRY_HPP_ */
@@ -0,0 +1,84 @@
+/*
+ * omni_kinematics.cpp
+ */
+
+#include "omni_kinematics.hpp"
+
+#include <math.h>
+
+Omni_Kinematics::Omni_Kinematics(const float wheel_angles_rad[4], float wheel_radius_m, float center_distance_m,
+                                 float wheel_speed_scale) {
+	// A
+	float k = wheel_speed_scale / wheel_radius_m;
+	for(int i = 0; i < 4; i++) {
+		body_to_wheel_mat[i][0] = -sinf(wheel_angles_rad[i]) * k;
+		body_to_wheel_mat[i][1] = cosf(wheel_angles_rad[i]) * k;
+		body_to_wheel_mat[i][2] = center_distance_m * k;
+	}
+
+	// A^T A, 3x3 symmetric
+	float m[3][3];
+	for(int r = 0; r < 3; r++) {
+		for(int c = 0; c < 3; c++) {
+			m[r][c] = 0;
+			for(int i = 0; i < 4; i++) m[r][c] += body_to_wheel_mat[i][r] * body_to_wheel_mat[i][c];
+		}
+	}
+
+	// (A^T A)^-1 by cofactors
+	float inv[3][3];
+	inv[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+	inv[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+	inv[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+	inv[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+	inv[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+	inv[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+	inv[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+	inv[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+	inv[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+	float det = m[0][0] * inv[0][0] + m[0][1] * inv[1][0] + m[0][2] * inv[2][0];
+	if(fabsf(det) < 1e-12f) {
+		// e.g. all wheels parallel, the body velocity can't be recovered
+		stf::exception("Omni_Kinematics: wheel layout is singular");
+		for(int r = 0; r < 3; r++) {
+			for(int c = 0; c < 4; c++) wheel_to_body_mat[r][c] = 0;
+		}
+		return;
+	}
+
+	// A+ = (A^T A)^-1 A^T
+	for(int r = 0; r < 3; r++) {
+		for(int c = 0; c < 4; c++) {
+			float sum = 0;
+			for(int j = 0; j < 3; j++) sum += inv[r][j] * body_to_wheel_mat[c][j];
+			wheel_to_body_mat[r][c] = sum / det;
+		}
+	}
+}
+
+Wheel_speeds Omni_Kinematics::body_to_wheel(float x, float y, float omega) const {
+	float w[4];
+	for(int i = 0; i < 4; i++) {
+		w[i] = body_to_wheel_mat[i][0] * x + body_to_wheel_mat[i][1] * y + body_to_wheel_mat[i][2] * omega;
+	}
+	Wheel_speeds wheels;
+	wheels.RF = w[0];
+	wheels.RB = w[1];
+	wheels.LB = w[2];
+	wheels.LF = w[3];
+	return wheels;
+}
+
+Body_velocity Omni_Kinematics::wheel_to_body(const Wheel_speeds& wheels) const {
+	const float w[4] = {wheels.RF, wheels.RB, wheels.LB, wheels.LF};
+	float b[3];
+	for(int r = 0; r < 3; r++) {
+		b[r] = wheel_to_body_mat[r][0] * w[0] + wheel_to_body_mat[r][1] * w[1]
+		     + wheel_to_body_mat[r][2] * w[2] + wheel_to_body_mat[r][3] * w[3];
+	}
+	Body_velocity body;
+	body.x = b[0];
+	body.y = b[1];
+	body.omega = b[2];
+	return body;
+}
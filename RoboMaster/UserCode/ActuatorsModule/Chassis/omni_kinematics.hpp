@@ -0,0 +1,60 @@
+/*
+ * omni_kinematics.hpp
+ *
+ * Body <-> wheel velocity conversion of a 4 omni wheel chassis.
+ *
+ * Body frame: x forward, y left, omega counter-clockwise (seen from above).
+ * Wheel i sits at angle theta_i around the center (from +x, counter-clockwise),
+ * at distance D from it, and drives tangentially, positive counter-clockwise:
+ *
+ *  wheel_i = (-sin(theta_i) * x + cos(theta_i) * y + D * omega) / r * scale
+ *
+ * i.e. wheels = A * [x, y, omega]^T with A 4x3, and for the way back the
+ * least squares fit body = A+ * wheels with A+ = (A^T A)^-1 A^T, 3x4. With 4
+ * wheels for 3 unknowns A+ averages out wheel slip / measurement noise, and
+ * A+ * A = I, so body -> wheel -> body round trips exactly.
+ *
+ * Both matrices are computed once in the constructor, a conversion is a plain
+ * 4x3 (or 3x4) matrix-vector product.
+ *
+ * Wheel order everywhere: RF, RB, LB, LF (the members of Wheel_speeds), so an
+ * X layout has theta = -45, -135, 135, 45 deg.
+ */
+
+#ifndef OMNI_KINEMATICS_HPP_
+#define OMNI_KINEMATICS_HPP_
+
+#include "stf.h"
+#include "Motor/dji_m2006_motor.hpp" // Wheel_speeds
+
+// m/s, m/s, rad/s
+struct Body_velocity_t {
+	float x;
+	float y;
+	float omega;
+};
+typedef struct Body_velocity_t Body_velocity;
+
+class Omni_Kinematics {
+public:
+	/* wheel_angles_rad: theta of RF, RB, LB, LF
+	 * wheel_speed_scale: unit of the wheel speeds per wheel rad/s, e.g. to get % of max motor
+	 * velocity directly: gear ratio * 60 / (2 * Pi) / max rotor rpm * 100 */
+	Omni_Kinematics(const float wheel_angles_rad[4], float wheel_radius_m, float center_distance_m,
+	                float wheel_speed_scale = 1.00f);
+
+	Wheel_speeds body_to_wheel(float x, float y, float omega) const;
+	inline Wheel_speeds body_to_wheel(const Body_velocity& body) const {return body_to_wheel(body.x, body.y, body.omega);}
+	// least squares body velocity from 4 measured wheel speeds
+	Body_velocity wheel_to_body(const Wheel_speeds& wheels) const;
+
+	// row major, A: 4x3, A+: 3x4
+	inline const float* get_body_to_wheel_matrix(void) const {return &body_to_wheel_mat[0][0];}
+	inline const float* get_wheel_to_body_matrix(void) const {return &wheel_to_body_mat[0][0];}
+
+private:
+	float body_to_wheel_mat[4][3];
+	float wheel_to_body_mat[3][4];
+};
+
+#endif /* OMNI_KINEMATICS_HPP_ */
@@ -0,0 +1,147 @@
+/*
+ * traction_control.cpp
+ */
+
+#include "traction_control.hpp"
+
+#include <math.h>
+
+static const float imu_timeout_us = 10000.00f;
+
+Traction_Control::Traction_Control(const Omni_Kinematics& kinematics) : kinematics(kinematics) {
+	for(int i = 0; i < 4; i++) {
+		prev_wheel[i] = 0;
+		wheel_acc_1[i] = 0;
+		wheel_acc_2[i] = 0;
+		predicted_acc[i] = 0;
+		above[i] = 0;
+		below[i] = 0;
+		slipping[i] = false;
+		current_limit[i] = 100.00f;
+	}
+	published = {};
+	for(int i = 0; i < 4; i++) published.current_limit[i] = 100.00f;
+	last_imu = {};
+	set_thresholds(3.00f, 1.00f);
+	set_timing(10, 250, 20.00f, 1.00f / 5000.00f);
+	set_limiting(0.70f, 20.00f, 100.00f);
+}
+
+void Traction_Control::set_thresholds(float acc_threshold, float yaw_threshold) {
+	/* a body acceleration of 1 m/s^2 along wheel i's drive direction is the norm
+	 * of the x, y part of row i of the body -> wheel matrix, in wheel units/s */
+	const float *A = kinematics.get_body_to_wheel_matrix();
+	for(int i = 0; i < 4; i++) {
+		wheel_threshold[i] = acc_threshold * sqrtf(A[i * 3] * A[i * 3] + A[i * 3 + 1] * A[i * 3 + 1]);
+	}
+	this->yaw_threshold = yaw_threshold;
+}
+
+void Traction_Control::set_limiting(float reduction, float min_limit, float recovery_per_s) {
+	this->reduction = reduction;
+	this->min_limit = min_limit;
+	this->recovery_per_s = recovery_per_s;
+}
+
+void Traction_Control::set_timing(uint32_t debounce_steps, uint32_t clear_steps, float filter_cutoff_Hz, float dt_s) {
+	this->debounce_steps = debounce_steps;
+	this->clear_steps = clear_steps;
+	this->dt_s = dt_s;
+	this->inv_dt = 1.00f / dt_s;
+	float rc = 1.00f / (2.00f * (float)Pi * filter_cutoff_Hz);
+	this->alpha = dt_s / (rc + dt_s);
+}
+
+void Traction_Control::update(const Wheel_speeds& wheels, const float commands[4]) {
+	const float w[4] = {wheels.RF, wheels.RB, wheels.LB, wheels.LF};
+	uint32_t now = stf::cycles();
+
+	if(!has_prev) {
+		// here rather than in the constructor, static objects are built before the clock is set up
+		imu_timeout_cycles = stf::us_to_cycles(imu_timeout_us);
+	}
+
+	Imu_sample sample;
+	// the IMU task can't finish a write while we spin here, keep the previous sample then
+	if(imu.try_read(sample) && sample.timestamp != 0) {
+		last_imu = sample;
+		has_imu = true;
+	}
+	bool imu_ok = has_imu && (now - last_imu.timestamp) < imu_timeout_cycles;
+
+	if(!has_prev) {
+		for(int i = 0; i < 4; i++) prev_wheel[i] = w[i];
+		prev_gz = last_imu.gz;
+		has_prev = true;
+	}
+
+	// wheel side: differentiate, 2 low pass stages
+	for(int i = 0; i < 4; i++) {
+		float acc = (w[i] - prev_wheel[i]) * inv_dt;
+		prev_wheel[i] = w[i];
+		wheel_acc_1[i] += (acc - wheel_acc_1[i]) * alpha;
+		wheel_acc_2[i] += (wheel_acc_1[i] - wheel_acc_2[i]) * alpha;
+	}
+
+	// IMU side: body acceleration without the rotation of the frame, 1 low pass stage
+	Body_velocity twist = kinematics.wheel_to_body(wheels);
+	float yaw_rate_error = twist.omega - last_imu.gz;
+	body_alpha += ((last_imu.gz - prev_gz) * inv_dt - body_alpha) * alpha;
+	prev_gz = last_imu.gz;
+	Wheel_speeds predicted = kinematics.body_to_wheel(last_imu.ax + last_imu.gz * twist.y,
+	                                                  last_imu.ay - last_imu.gz * twist.x,
+	                                                  body_alpha);
+	const float p[4] = {predicted.RF, predicted.RB, predicted.LB, predicted.LF};
+
+	float acc_error[4];
+	for(int i = 0; i < 4; i++) {
+		predicted_acc[i] += (p[i] - predicted_acc[i]) * alpha;
+		acc_error[i] = fabsf(wheel_acc_2[i] - predicted_acc[i]);
+		if(!imu_ok) {
+			above[i] = 0;
+			slipping[i] = false;
+		}
+		else if(acc_error[i] > wheel_threshold[i]) {
+			below[i] = 0;
+			if(++above[i] >= debounce_steps) {
+				// (still) slipping: cut the current further, from what it is commanded now
+				above[i] = 0;
+				if(!slipping[i]) published.slip_events[i]++;
+				slipping[i] = true;
+				float limit = fabsf(commands[i]) * reduction;
+				if(limit > current_limit[i]) limit = current_limit[i] * reduction;
+				current_limit[i] = (limit < min_limit) ? min_limit : limit;
+			}
+		}
+		else {
+			above[i] = 0;
+			// grips again once well below the threshold for a while
+			if(slipping[i] && acc_error[i] < wheel_threshold[i] * 0.50f && ++below[i] >= clear_steps) {
+				slipping[i] = false;
+				below[i] = 0;
+			}
+		}
+
+		if(slipping[i]) published.slip_steps[i]++;
+		else if(current_limit[i] < 100.00f) {
+			current_limit[i] += recovery_per_s * dt_s;
+			if(current_limit[i] > 100.00f) current_limit[i] = 100.00f;
+		}
+	}
+
+	bool yaw_mismatch = imu_ok && (yaw_rate_error > yaw_threshold || yaw_rate_error < -yaw_threshold);
+	if(yaw_mismatch) published.yaw_mismatch_steps++;
+
+	traction_status& s = status.write_begin();
+	s = published;
+	s.slipping = 0;
+	for(int i = 0; i < 4; i++) {
+		if(slipping[i]) s.slipping |= (1 << i);
+		s.current_limit[i] = current_limit[i];
+		s.acc_error[i] = acc_error[i];
+	}
+	s.yaw_mismatch = yaw_mismatch;
+	s.imu_ok = imu_ok;
+	s.yaw_rate_error = yaw_rate_error;
+	status.write_end();
+}
@@ -0,0 +1,115 @@
+/*
+ * traction_control.hpp
+ *
+ * Wheel slip detection against the IMU, and current limiting of the
+ * slipping wheels.
+ *
+ * A wheel that grips accelerates the way the body does, so per wheel the
+ * measured wheel acceleration is compared with the one the IMU says it
+ * should have, both in wheel speed units per second:
+ *  body:  dv/dt = a_imu - omega x v, d(omega)/dt from the gyro
+ *  wheel: predicted_i = A_i * [dvx/dt, dvy/dt, d(omega)/dt] (A: body -> wheel matrix)
+ * A wheel spinning up (or locking) under too much current leaves its
+ * prediction behind. Above the threshold for debounce_steps control steps
+ * the wheel is flagged and its current limit drops to reduction * its
+ * latest command (and again each further debounce_steps it keeps slipping,
+ * not below min_limit). Once the wheel agrees with the IMU again for
+ * clear_steps the flag clears and the limit ramps back up.
+ * The yaw rate from the wheels is cross-checked with the gyro as well,
+ * a disagreement is published (and counted) but can't tell the wheels apart.
+ *
+ * The MPU6500 accelerometer runs through its 92Hz DLPF (7.8ms delay), so
+ * the wheel accelerations get one more first order low pass than the IMU
+ * side to line the two up. IMU axes are taken as the body's (x forward,
+ * y left, z up). Without an IMU sample for imu_timeout_us the detection
+ * pauses and the limits recover.
+ *
+ * update() belongs to the control task, about 1us per call (2 small matrix
+ * products and a few filters, no trig or division). set_imu_sample() is
+ * called by the IMU task, get_status() by anyone (both Seqlock).
+ */
+
+#ifndef TRACTION_CONTROL_HPP_
+#define TRACTION_CONTROL_HPP_
+
+#include "stf.h"
+#include "seqlock.hpp"
+#include "omni_kinematics.hpp"
+
+// body frame, SI units
+struct Imu_sample_t {
+	float ax;         // m/s^2
+	float ay;         // m/s^2
+	float gz;         // rad/s
+	uint32_t timestamp; // stf::cycles() when read
+};
+typedef struct Imu_sample_t Imu_sample;
+
+class Traction_Control {
+public:
+	struct traction_status {
+		uint8_t slipping;           // bit i: wheel i (RF, RB, LB, LF) is slipping
+		bool yaw_mismatch;          // wheel yaw rate and gyro disagree
+		bool imu_ok;                // detection running
+		uint32_t slip_events[4];    // times each wheel started slipping
+		uint32_t slip_steps[4];     // control steps each wheel spent slipping
+		uint32_t yaw_mismatch_steps;
+		float current_limit[4];     // % of max current
+		float acc_error[4];         // |wheel - predicted| acceleration, wheel units/s
+		float yaw_rate_error;       // rad/s
+	};
+
+	Traction_Control(const Omni_Kinematics& kinematics);
+
+	/* acc_threshold: m/s^2 of disagreement along a wheel's drive direction,
+	 * yaw_threshold: rad/s. Set them up before running */
+	void set_thresholds(float acc_threshold, float yaw_threshold);
+	// reduction: factor on the command at each detection, min_limit and recovery in %, %/s
+	void set_limiting(float reduction, float min_limit, float recovery_per_s);
+	void set_timing(uint32_t debounce_steps, uint32_t clear_steps, float filter_cutoff_Hz, float dt_s);
+
+	// IMU task
+	inline void set_imu_sample(const Imu_sample& sample) {imu.write(sample);}
+
+	/* control task, once per control period: wheel speeds in the kinematics' unit,
+	 * commands: current command of each wheel of the latest step, % */
+	void update(const Wheel_speeds& wheels, const float commands[4]);
+	// control task, current limit to hand to the motor driver
+	inline float get_current_limit(int wheel) {return current_limit[wheel];}
+
+	traction_status get_status(void) {return status.read();}
+
+private:
+	const Omni_Kinematics& kinematics;
+	Seqlock<Imu_sample> imu;
+	Seqlock<traction_status> status;
+
+	/* configuration */
+	float wheel_threshold[4];   // wheel units/s
+	float yaw_threshold = 1.00f;
+	float reduction = 0.70f;
+	float min_limit = 20.00f;
+	float recovery_per_s = 100.00f;
+	float dt_s = 0.0002f;
+	float inv_dt = 5000.00f;
+	float alpha = 1.00f;        // low pass coefficient
+	uint32_t debounce_steps = 10;
+	uint32_t clear_steps = 250;
+	uint32_t imu_timeout_cycles = 0;
+
+	/* update() only */
+	Imu_sample last_imu;
+	bool has_imu = false;
+	bool has_prev = false;
+	float prev_wheel[4];
+	float prev_gz = 0;
+	float wheel_acc_1[4], wheel_acc_2[4]; // 2 low pass stages
+	float predicted_acc[4];
+	float body_alpha = 0;                 // filtered d(omega)/dt
+	uint32_t above[4], below[4];
+	bool slipping[4];
+	float current_limit[4];
+	traction_status published;
+};
+
+#endif /* TRACTION_CONTROL_HPP_ */
@@ -0,0 +1,107 @@
+/*
+ * velocity_profile.cpp
+ */
+
+#include "velocity_profile.hpp"
+
+Velocity_Profile::Velocity_Profile(void) {
+	set_limits(X_Axis, 3.00f, 30.00f);
+	set_limits(Y_Axis, 3.00f, 30.00f);
+	set_limits(Omega_Axis, 12.00f, 120.00f);
+}
+
+void Velocity_Profile::set_limits(axis a, float max_acc, float max_jerk, shape s) {
+	this->max_acc[a] = (max_acc > 0) ? max_acc : -max_acc;
+	this->max_jerk[a] = (max_jerk > 0) ? max_jerk : -max_jerk;
+	this->shapes[a] = s;
+}
+
+void Velocity_Profile::set_target(float x, float y, float omega) {
+	profile_command& cmd = command.write_begin();
+	cmd.id = ++command_id;
+	cmd.active = true;
+	cmd.target[X_Axis] = x;
+	cmd.target[Y_Axis] = y;
+	cmd.target[Omega_Axis] = omega;
+	command.write_end();
+}
+
+void Velocity_Profile::reset(void) {
+	profile_command& cmd = command.write_begin();
+	cmd.id = ++command_id;
+	cmd.active = false;
+	for(int i = 0; i < 3; i++) cmd.target[i] = 0;
+	command.write_end();
+}
+
+bool Velocity_Profile::step(float dt_s, Body_velocity& out) {
+	profile_command cmd;
+	// a task writing a command can't finish while we spin here, so don't: pick it up next time
+	if(command.try_read(cmd) && cmd.id != applied_command_id) {
+		applied_command_id = cmd.id;
+		active = cmd.active;
+		for(int i = 0; i < 3; i++) {
+			target[i] = cmd.target[i];
+			if(!active) {
+				vel[i] = 0;
+				acc[i] = 0;
+			}
+		}
+	}
+	if(!active) return false;
+
+	for(int i = 0; i < 3; i++) step_axis(i, dt_s);
+	out.x = vel[X_Axis];
+	out.y = vel[Y_Axis];
+	out.omega = vel[Omega_Axis];
+	return true;
+}
+
+void Velocity_Profile::step_axis(int i, float dt_s) {
+	float error = target[i] - vel[i];
+	float A = max_acc[i];
+
+	if(shapes[i] == Trapezoidal || max_jerk[i] <= 0) {
+		// the acceleration that would close the gap this step, limited
+		float a = error / dt_s;
+		if(a > A) a = A;
+		if(a < -A) a = -A;
+		acc[i] = a;
+		vel[i] += a * dt_s;
+		return;
+	}
+
+	/* S-curve: easing the acceleration a back to 0 at max jerk J takes the velocity
+	 * a further a * |a| / (2 * J) - a * dt / 2 (in steps of dt). Each step takes the
+	 * largest of (a + J*dt, a, a - J*dt) towards the target that still leaves room to
+	 * ease off before it, so the target is met with a = 0 and no overshoot */
+	float J = max_jerk[i];
+	float jerk_step = J * dt_s;
+	float a = acc[i];
+	float remaining = error - a * (a > 0 ? a : -a) / (2.00f * J) + a * dt_s / 2.00f;
+	float dir = (remaining >= 0) ? 1.00f : -1.00f;
+	// in the frame where the target lies ahead
+	float e = dir * error;
+	float x = dir * a;
+	float candidates[2] = {x + jerk_step, x};
+	float next = x - jerk_step;
+	for(int c = 0; c < 2; c++) {
+		float xc = (candidates[c] > A) ? A : candidates[c];
+		if(xc <= 0 || (e - xc * dt_s) - (xc * xc / (2.00f * J) - xc * dt_s / 2.00f) >= 0) {
+			next = xc;
+			break;
+		}
+	}
+	if(next < -A) next = -A;
+	a = dir * next;
+
+	float v = vel[i] + a * dt_s;
+	// landing within a step of it: snap, rather than dither around the target
+	bool crossed = (error > 0) ? (v >= target[i]) : (v <= target[i]);
+	if(crossed || (error < jerk_step * dt_s && error > -jerk_step * dt_s && a < jerk_step && a > -jerk_step)) {
+		v = target[i];
+		a = 0;
+	}
+	vel[i] = v;
+	acc[i] = a;
+}
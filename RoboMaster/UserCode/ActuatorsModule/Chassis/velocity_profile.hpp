@@ -0,0 +1,83 @@
+/*
+ * velocity_profile.hpp
+ *
+ * Acceleration / jerk limited ramp from the current chassis velocity setpoint
+ * to the latest commanded one, per body axis (x, y, omega).
+ *
+ * Host commands come in at vision rate (~60Hz), as steps. step() runs at
+ * control rate and moves the setpoint towards the target with
+ *  Trapezoidal : |acceleration| <= max_acc, acceleration itself may jump
+ *  S_Curve     : |acceleration| <= max_acc and |jerk| <= max_jerk, the
+ *                acceleration ramps up and back down to 0 so the target is
+ *                reached without overshoot
+ * so every new command becomes a smooth change of the wheel setpoints
+ * instead of a current spike. A new target mid-ramp simply redirects the
+ * ramp from where it is.
+ *
+ * set_target() and reset() can be called from any one task, they are
+ * taken by the next step(), which belongs to the control task.
+ */
+
+#ifndef VELOCITY_PROFILE_HPP_
+#define VELOCITY_PROFILE_HPP_
+
+#include "stf.h"
+#include "seqlock.hpp"
+#include "omni_kinematics.hpp" // Body_velocity
+
+class Velocity_Profile {
+public:
+	enum axis : int {
+		X_Axis = 0,
+		Y_Axis = 1,
+		Omega_Axis = 2
+	};
+	enum shape : int {
+		Trapezoidal,
+		S_Curve
+	};
+
+	Velocity_Profile(void);
+
+	/* per axis, m/s^2 and m/s^3 (rad/s^2 and rad/s^3 for omega),
+	 * max_jerk is unused by Trapezoidal. Set them up before running */
+	void set_limits(axis a, float max_acc, float max_jerk, shape s = S_Curve);
+
+	// any task: new velocity to ramp to, the first call activates the profile
+	void set_target(float x, float y, float omega);
+	// any task: setpoint back to 0 at once, inactive until the next set_target()
+	void reset(void);
+
+	/* control task, once per control period: the next setpoint.
+	 * Returns false (and leaves out untouched) while inactive */
+	bool step(float dt_s, Body_velocity& out);
+
+	// latest setpoint and acceleration, control task only
+	inline Body_velocity get_setpoint(void) {Body_velocity v = {vel[0], vel[1], vel[2]}; return v;}
+	inline Body_velocity get_acceleration(void) {Body_velocity a = {acc[0], acc[1], acc[2]}; return a;}
+
+private:
+	struct profile_command {
+		uint32_t id; // bumped by every command
+		bool active;
+		float target[3];
+	};
+
+	Seqlock<profile_command> command;
+	uint32_t command_id = 0;         // writer side
+	uint32_t applied_command_id = 0; // step() side
+
+	/* step() only */
+	bool active = false;
+	float target[3] = {0, 0, 0};
+	float vel[3] = {0, 0, 0};
+	float acc[3] = {0, 0, 0};
+
+	float max_acc[3];
+	float max_jerk[3];
+	shape shapes[3];
+
+	void step_axis(int i, float dt_s);
+};
+
+#endif /* VELOCITY_PROFILE_HPP_ */
@@ -7,57 +7,122 @@
 using namespace DjiRM;
 
 static const int16_t max_current = 9999; // 9.999A
+static const int16_t max_raw_speed = 19100; // rpm
+static const float max_current_A = 10.00f; // C610: current command +-10000 <-> +-10A
+
+// control loop scalings, constant folded
+static constexpr stf::LinearMap rpm_to_percent(from_range((float)-max_raw_speed, (float)max_raw_speed),
+                                               to_range(-100.00f, 100.00f));
+static constexpr stf::LinearMap percent_to_current(from_range(-100.00f, 100.00f),
+                                                   to_range((float)-max_current, (float)max_current));
+static constexpr stf::LinearMap amps_to_percent(from_range(-max_current_A, max_current_A),
+                                                to_range(-100.00f, 100.00f));
+
+
+/* The Rx interrupt callback is a plain C function shared by all instances,
+ * so each bus keeps a dispatch table indexed by (StdId - 0x201):
+ * slot 0~3 -> instance of group ESC1_to_4, slot 4~7 -> instance of group ESC5_to_8.
+ * Old-school fixed arrays instead of containers since it's accessed from an ISR
+ */
+#define Max_Num_CAN_Buses 2
+#define Num_ESC_IDs 8
+static const uint32_t feedback_base_can_id = 0x201;
+static const uint32_t group_cmd_can_id[2] = {0x200, 0x1FF}; // ESC1_to_4, ESC5_to_8
+static const float frame_gap_threshold_us = 3000.00f; // ESCs report at 1kHz
+static const int32_t angle_counts_per_turn = 8192;
+static const float counts_per_sec_to_rpm = 60.00f / angle_counts_per_turn;
+static const float rpm_to_rad_s = 2.00f * (float)Pi / 60.00f;
+
+struct m2006_can_bus {
+    CAN_HandleTypeDef *hcanx;
+    M2006_Motor *dispatch[Num_ESC_IDs];
+    CAN_Health *health;
+    bool is_started;
+};
+static uint32_t num_can_buses = 0;
+static m2006_can_bus can_buses[Max_Num_CAN_Buses];
+
+static m2006_can_bus* find_can_bus(CAN_HandleTypeDef *hcanx) {
+    for(uint32_t i = 0; i < num_can_buses; i++) {
+        if(can_buses[i].hcanx == hcanx) return &can_buses[i];
+    }
+    return NULL;
+}
 
-
-/* These should be declared as member variables in OOP design,
- * but since interrupt is involved, there is a small complication to it,
- * i'm just being lazy and do this in C language's convention. 
- * There should be only one motor class instance anyways!
- */ 
-static CAN_HandleTypeDef* __hcanx;
-static const uint32_t motor1_can_id = 0x201;
-static const uint32_t motor2_can_id = 0x202;
-static const uint32_t motor3_can_id = 0x203;
-static const uint32_t motor4_can_id = 0x204;
-static volatile uint8_t motor_idx;
-static volatile uint16_t angle_data[4];
-static volatile int16_t speed_data[4];
-static volatile float current_data[4];
+static m2006_can_bus* register_can_bus(CAN_HandleTypeDef *hcanx) {
+    m2006_can_bus *bus = find_can_bus(hcanx);
+    if(bus != NULL) return bus;
+    if(num_can_buses >= Max_Num_CAN_Buses) return NULL;
+    bus = &can_buses[num_can_buses];
+    bus->hcanx = hcanx;
+    for(int i = 0; i < Num_ESC_IDs; i++) bus->dispatch[i] = NULL;
+    bus->health = NULL;
+    bus->is_started = false;
+    num_can_buses++;
+    return bus;
+}
 
 void M2006_Motor::init(void) {
-    __hcanx = hcanx;
-
-    //Overwrite automatic settings
-    hcanx->Init.Prescaler = 3;
-    hcanx->Init.TimeSeg2 = CAN_BS2_4TQ; //Assign special, longer 4
-    //Apply settings
-    if (HAL_CAN_Init(hcanx) != HAL_OK)
-	{
-    	Error_Handler();
-	}
-    // Configure CAN filter
-    filter_config.FilterBank = 0;
-    filter_config.FilterMode = CAN_FILTERMODE_IDMASK;
-    filter_config.FilterScale = CAN_FILTERSCALE_32BIT;
-    filter_config.FilterIdHigh = 0x0000;
-    filter_config.FilterIdLow = 0x0000;
-    filter_config.FilterMaskIdHigh = 0x0000;
-    filter_config.FilterMaskIdLow = 0x0000;
-    filter_config.FilterFIFOAssignment = CAN_FilterFIFO0;
-    filter_config.FilterActivation = ENABLE;
-    filter_config.SlaveStartFilterBank = 14;   
-    HAL_CAN_ConfigFilter(hcanx, &filter_config);
-
-    // Start
-    HAL_CAN_Start(hcanx);
-
-    // Activate CAN receive interrupt for encoder data
-    HAL_CAN_ActivateNotification(hcanx, CAN_IT_RX_FIFO0_MSG_PENDING);
-
-	m1_ctrl.init(pid_ctrl_freq_Hz);
-	m2_ctrl.init(pid_ctrl_freq_Hz);
-	m3_ctrl.init(pid_ctrl_freq_Hz);
-	m4_ctrl.init(pid_ctrl_freq_Hz);
+    stf::enable_cycle_counter(); // for feedback timestamps
+    m2006_can_bus *bus = register_can_bus(hcanx);
+    if(bus == NULL) {
+        stf::exception("M2006_Motor: too many CAN buses");
+        return;
+    }
+    uint32_t first_slot = group * 4;
+    for(uint32_t i = first_slot; i < first_slot + 4; i++) {
+        if(bus->dispatch[i] != NULL && bus->dispatch[i] != this) {
+            stf::exception("M2006_Motor: ESC group already taken on this bus");
+            return;
+        }
+    }
+
+    // the bus is shared by up to 2 instances, only bring it up once
+    if(!bus->is_started) {
+        //Overwrite automatic settings
+        hcanx->Init.Prescaler = 3;
+        hcanx->Init.TimeSeg2 = CAN_BS2_4TQ; //Assign special, longer 4
+        hcanx->Init.AutoBusOff = ENABLE; // rejoin by itself after bus-off, see CAN_Health
+        //Apply settings
+        if (HAL_CAN_Init(hcanx) != HAL_OK)
+        {
+            Error_Handler();
+        }
+        // Start
+        HAL_CAN_Start(hcanx);
+
+        // Activate CAN receive interrupt for encoder data
+        HAL_CAN_ActivateNotification(hcanx, CAN_IT_RX_FIFO0_MSG_PENDING);
+
+        // current commands go through the Tx queue, refilled by the Tx mailbox empty interrupt
+        CAN_TxQueue::of(hcanx)->init();
+        // error counters, bus-off and per ESC frame rates
+        bus->health = CAN_Health::of(hcanx);
+        bus->health->init();
+        bus->is_started = true;
+    }
+    tx_queue = CAN_TxQueue::of(hcanx);
+
+    // only the feedback of this group's 4 ESCs raises an Rx interrupt, other nodes on the bus are filtered out
+    CAN_Filter *filter = CAN_Filter::of(hcanx);
+    filter->add_range(feedback_base_can_id + first_slot, feedback_base_can_id + first_slot + 3, CAN_Filter::FIFO0);
+    filter->apply();
+
+    for(uint32_t i = first_slot; i < first_slot + 4; i++) {
+        bus->dispatch[i] = this;
+    }
+
+	// the position loop runs on every pos_loop_divider-th control step
+	pos_loop_divider = (uint32_t)(pid_ctrl_freq_Hz / pos_loop_freq_Hz + 0.5f);
+	if(pos_loop_divider < 1) pos_loop_divider = 1;
+	pos_loop_tick = 0;
+	pos_ctrl.init(pid_ctrl_freq_Hz / pos_loop_divider);
+	pos_ctrl.set_output_limits(-100.00f, 100.00f); // % of max velocity
+	vel_ctrl.init(pid_ctrl_freq_Hz);
+	vel_ctrl.set_output_limits(-100.00f, 100.00f); // % of max current
+	cur_ctrl.init(pid_ctrl_freq_Hz);
+	cur_ctrl.set_output_limits(-100.00f, 100.00f);
+	power_limiter.init(pid_ctrl_freq_Hz, max_current_A / 100.00f);
 }
 
 void M2006_Motor::set_current(int16_t ESC1_Curr, int16_t ESC2_Curr, int16_t ESC3_Curr, int16_t ESC4_Curr) {
@@ -73,11 +138,6 @@ void M2006_Motor::set_current(int16_t ESC1_Curr, int16_t ESC2_Curr, int16_t ESC3
     if(ESC4_Curr > max_current) ESC4_Curr = max_current;
     if(ESC4_Curr < -max_current) ESC4_Curr = -max_current;
         
-    tx_header.StdId = 0x200;
-    tx_header.RTR = CAN_RTR_DATA;
-    tx_header.IDE = CAN_ID_STD;
-    tx_header.DLC = 0x08;
-    tx_header.TransmitGlobalTime = DISABLE;
     tx_data[0] = (ESC1_Curr >> 8);
     tx_data[1] = ESC1_Curr;
 
@@ -89,7 +149,9 @@ void M2006_Motor::set_current(int16_t ESC1_Curr, int16_t ESC2_Curr, int16_t ESC3
 
     tx_data[6] = (ESC4_Curr >> 8);
     tx_data[7] = ESC4_Curr;
-    HAL_CAN_AddTxMessage(hcanx, &tx_header, tx_data, &tx_mailbox);
+    // never blocks, a command still waiting for a mailbox is replaced by this newer one
+    if(tx_queue != NULL) tx_queue->send(group_cmd_can_id[group], tx_data, 8, next_origin_cycles);
+    next_origin_cycles = 0;
 }
 
 
@@ -97,57 +159,134 @@ void M2006_Motor::set_current(int16_t ESC1_Curr, int16_t ESC2_Curr, int16_t ESC3
  * everytime a new message arrived through CAN
  */
 void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan) {
+    uint8_t rx_data[8];
+    CAN_RxHeaderTypeDef rx_header;
+
+    // always pop the message, or the interrupt keeps firing on an unknown frame
+    if(HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &rx_header, rx_data) != HAL_OK) return;
+
+    m2006_can_bus *bus = find_can_bus(hcan);
+    if(bus == NULL) return;
+    if(bus->health != NULL) bus->health->interrupt_task_rx(rx_header.StdId);
+
+    // unsigned wrap-around makes IDs below 0x201 fall out of range as well
+    uint32_t esc_idx = rx_header.StdId - feedback_base_can_id;
+    if(esc_idx >= Num_ESC_IDs) return;
+
+    M2006_Motor *instance = bus->dispatch[esc_idx];
+    if(instance != NULL) {
+        instance->rx_interrupt_task((motor_id)(esc_idx & 0x03), rx_data);
+    }
+}
+
+void M2006_Motor::rx_interrupt_task(motor_id m_id, uint8_t rx_data[8]) {
+    uint32_t now = stf::cycles();
+    uint16_t angle = (uint16_t)(rx_data[0]<<8 | rx_data[1]);
+    motor_feedback &fb = feedback.write_begin().motor[m_id];
 
-    if(hcan == __hcanx) {
-        uint8_t rx_data[8];
-        CAN_RxHeaderTypeDef rx_header;
-        HAL_CAN_GetRxMessage(__hcanx, CAN_RX_FIFO0, &rx_header, rx_data);
+    if(fb.seq == 0) {
+        fb.position = angle;
+        fb.velocity_diff = 0;
+        fb.velocity_ab = 0;
+    }
+    else {
+        float dt_us = stf::cycles_to_us(now - fb.timestamp);
+        if(dt_us > frame_gap_threshold_us) fb.gaps++;
+
+        /* unwrap: assume the rotor moved less than half a turn between frames,
+         * max speed 19100rpm at 1kHz frames is ~2600 counts < 4096 */
+        int32_t delta = (int32_t)angle - (int32_t)fb.angle;
+        if(delta > angle_counts_per_turn / 2) delta -= angle_counts_per_turn;
+        if(delta < -angle_counts_per_turn / 2) delta += angle_counts_per_turn;
+        fb.position += delta;
+
+        estimate_velocity(fb, delta, dt_us / 1000000.00f, m_id);
+    }
 
-        if(rx_header.StdId == motor1_can_id) motor_idx = 0;
-        if(rx_header.StdId == motor2_can_id) motor_idx = 1;
-        if(rx_header.StdId == motor3_can_id) motor_idx = 2;
-        if(rx_header.StdId == motor4_can_id) motor_idx = 3;
+    fb.angle = angle;
+    fb.speed = (int16_t)(rx_data[2]<<8 | rx_data[3]); // originally rpm
+    fb.current = (int16_t)(rx_data[4]<<8 | rx_data[5])*5.f/16384.f;
+    fb.timestamp = now;
+    fb.seq++;
+    feedback.write_end();
+}
 
-        angle_data[motor_idx] = (uint16_t)(rx_data[0]<<8 | rx_data[1]);
-        speed_data[motor_idx] = (int16_t)(rx_data[2]<<8 | rx_data[3]); // originally rpm
-        current_data[motor_idx] = (rx_data[4]<<8 | rx_data[5])*5.f/16384.f;
+// ISR context, called once per feedback frame
+void M2006_Motor::estimate_velocity(motor_feedback& fb, int32_t delta_angle, float dt_s, motor_id m_id) {
+    /* frames queued in the FIFO get (nearly) the same timestamp, dt says nothing then.
+     * The tracker's error is relative to the latest measured position, which moved by
+     * delta_angle: keep its counts, they show up in the next prediction */
+    if(dt_s < 0.0002f) {
+        ab_pos_err[m_id] -= (float)delta_angle;
+        return;
     }
+
+    float vel_diff = (float)delta_angle / dt_s;
+    fb.velocity_diff = vel_diff * counts_per_sec_to_rpm;
+
+    // after a gap the tracker state is meaningless, restart it from the difference
+    if(dt_s > frame_gap_threshold_us / 1000000.00f) {
+        ab_pos_err[m_id] = 0;
+        ab_vel[m_id] = vel_diff;
+    }
+    else {
+        // predict, relative to the new measured position so floats keep their precision
+        float predicted_err = ab_pos_err[m_id] + ab_vel[m_id] * dt_s - (float)delta_angle;
+        float residual = -predicted_err;
+        ab_pos_err[m_id] = predicted_err + ab_alpha * residual;
+        ab_vel[m_id] += ab_beta * residual / dt_s;
+    }
+    fb.velocity_ab = ab_vel[m_id] * counts_per_sec_to_rpm;
 }
 
 
 uint16_t M2006_Motor::get_raw_angle(motor_id m_id) {
-    return angle_data[m_id];
+    return feedback.read().motor[m_id].angle;
 }
 int16_t M2006_Motor::get_raw_speed(motor_id m_id) {
-    return speed_data[m_id];
+    return feedback.read().motor[m_id].speed;
 }
 float M2006_Motor::get_raw_current(motor_id m_id) {
-    return current_data[m_id];
+    return feedback.read().motor[m_id].current;
+}
+
+float M2006_Motor::get_feedback_age_us(const feedback_snapshot& snapshot, motor_id m_id) {
+    return stf::cycles_to_us(stf::cycles() - snapshot.motor[m_id].timestamp);
+}
+
+bool M2006_Motor::is_feedback_stale(const feedback_snapshot& snapshot, motor_id m_id) {
+    if(snapshot.motor[m_id].seq == 0) return true;
+    return get_feedback_age_us(snapshot, m_id) > (float)feedback_timeout_us;
 }
 
 // make velocity unit-less (%)
 float M2006_Motor::get_velocity(motor_id m_id) {
-	float raw_speed = get_raw_speed(m_id);
+	return get_velocity(feedback.read(), m_id);
+}
 
-	if (raw_speed > max_raw_speed) {
-		raw_speed = max_raw_speed;
-	}
-	if (raw_speed < -max_raw_speed) {
-		raw_speed = -max_raw_speed;
-	}
-	return stf::map(raw_speed,
-					   from_range((float)-max_raw_speed, (float)max_raw_speed),
-					   to_range((float)-100.00, (float)100.00));
+float M2006_Motor::get_raw_velocity(const feedback_snapshot& snapshot, motor_id m_id) {
+	if(vel_source == Angle_Difference) return snapshot.motor[m_id].velocity_diff;
+	if(vel_source == Alpha_Beta) return snapshot.motor[m_id].velocity_ab;
+	return snapshot.motor[m_id].speed;
+}
 
+float M2006_Motor::get_velocity(const feedback_snapshot& snapshot, motor_id m_id) {
+	// saturates at max speed
+	return rpm_to_percent.clamped(get_raw_velocity(snapshot, m_id));
 }
 
 
 
 void M2006_Motor::update_pid_consts(float Kp, float Ki, float Kd) {
-	m1_ctrl.update_pid_consts(Kp, Ki, Kd);
-	m2_ctrl.update_pid_consts(Kp, Ki, Kd);
-	m3_ctrl.update_pid_consts(Kp, Ki, Kd);
-	m4_ctrl.update_pid_consts(Kp, Ki, Kd);
+	vel_ctrl.update_pid_consts(Kp, Ki, Kd);
+}
+
+void M2006_Motor::update_pid_consts(motor_id m_id, float Kp, float Ki, float Kd) {
+	vel_ctrl.update_pid_consts(m_id, Kp, Ki, Kd);
+}
+
+void M2006_Motor::update_feed_forward_consts(float Kff_vel, float Kff_acc) {
+	vel_ctrl.update_feed_forward_consts(Kff_vel, Kff_acc);
 }
 
 // Calculate period from frequency
@@ -156,47 +295,162 @@ uint32_t M2006_Motor::get_ctrl_period_ms(void) {
 }
 
 void M2006_Motor::pid_update_motor_currents(void) {
-	float new_curr1, new_curr2, new_curr3, new_curr4;
-	// Argument == error
-	// set_velocity() sets m1-m4_vel
-	new_curr1 = m1_ctrl.calculate(m1_vel - get_velocity(Motor1));
-	new_curr2 = m2_ctrl.calculate(m2_vel - get_velocity(Motor2));
-	new_curr3 = m3_ctrl.calculate(m3_vel - get_velocity(Motor3));
-	new_curr4 = m4_ctrl.calculate(m4_vel - get_velocity(Motor4));
-
-	if (new_curr1 > 100.00 ) new_curr1 = 100.00;
-	if (new_curr1 < -100.00 ) new_curr1 = -100.00;
-	if (new_curr2 > 100.00 ) new_curr2 = 100.00;
-	if (new_curr2 < -100.00 ) new_curr2 = -100.00;
-	if (new_curr3 > 100.00 ) new_curr3 = 100.00;
-	if (new_curr3 < -100.00 ) new_curr3 = -100.00;
-	if (new_curr4 > 100.00 ) new_curr4= 100.00;
-	if (new_curr4 < -100.00 ) new_curr4 = -100.00;
-
-
-
-	// map from percentage to amperes
-	new_curr1 = stf::map(new_curr1, from_range((float)-100.00, (float)100.00),
-									to_range((float)-max_current, (float)max_current));
-	new_curr2 = stf::map(new_curr2, from_range((float)-100.00, (float)100.00),
-									to_range((float)-max_current, (float)max_current));
-	new_curr3 = stf::map(new_curr3, from_range((float)-100.00, (float)100.00),
-									to_range((float)-max_current, (float)max_current));
-	new_curr4 = stf::map(new_curr4, from_range((float)-100.00, (float)100.00),
-									to_range((float)-max_current, (float)max_current));
-
-	set_current((int16_t)new_curr1, (int16_t)new_curr2, (int16_t)new_curr3, (int16_t)new_curr4);
+	float errors[4], outputs[4];
+	int16_t currents[4];
+	// one read for all 4 motors, so a frame arriving mid-step can't mix samples
+	feedback_snapshot snapshot = feedback.read();
+
+	apply_mode_requests(snapshot);
+
+	// position loop, at its own (lower) rate, holds its velocity reference in between
+	if(pos_loop_tick == 0) {
+		uint32_t position_mask = 0;
+		for(int i = 0; i < 4; i++) {
+			errors[i] = (float)(pos_target[i] - get_position(snapshot, (motor_id)i)) / angle_counts_per_turn;
+			if(mode[i] == Position_Control) position_mask |= 1UL << i;
+		}
+		// only the motors in Position_Control, the others' would integrate a target they don't follow
+		pos_ctrl.calculate(errors, outputs, position_mask);
+		for(int i = 0; i < 4; i++) {
+			if(mode[i] == Position_Control) vel_ref[i] = outputs[i];
+		}
+	}
+	if(++pos_loop_tick >= pos_loop_divider) pos_loop_tick = 0;
+
+	// velocity loop, set_velocity() sets vel_target
+	float ref_acc[4];
+	for(int i = 0; i < 4; i++) {
+		if(mode[i] == Velocity_Control) vel_ref[i] = vel_target[i];
+		errors[i] = vel_ref[i] - get_velocity(snapshot, (motor_id)i);
+		ref_acc[i] = (vel_ref[i] - vel_ref_prev[i]) * pid_ctrl_freq_Hz; // %/s
+		vel_ref_prev[i] = vel_ref[i];
+	}
+	// all 4 channels in one pass, feed-forward of the setpoint, clamped to -100% ~ 100%
+	vel_ctrl.calculate(errors, outputs, vel_ref, ref_acc);
+
+	// a running step test takes over the output of its motor, within the same envelope as the loops
+	int tune_m = -1;
+	autotune_state state = tune_state;
+	if(state == Autotune_Settling || state == Autotune_Recording) {
+		tune_m = tune_motor;
+		outputs[tune_m] = autotune_update(snapshot);
+	}
+
+	// thermal and power envelope, the velocity loop continues from what was kept
+	float measured_A[4], rotor_speed[4];
+	for(int i = 0; i < 4; i++) {
+		measured_A[i] = snapshot.motor[i].current;
+		rotor_speed[i] = get_raw_velocity(snapshot, (motor_id)i) * rpm_to_rad_s;
+	}
+	uint8_t limited = power_limiter.apply(outputs, measured_A, rotor_speed);
+	for(int i = 0; i < 4; i++) {
+		if((limited & (1 << i)) && i != tune_m) vel_ctrl.track_output(i, outputs[i]);
+		vel_out[i] = outputs[i];
+	}
+	// the identification assumes the full step, a cut one fails the test at the next step
+	if(tune_m >= 0 && (limited & (1 << tune_m))) tune_step_limited = true;
+
+	// current loop, the velocity loop output becomes its setpoint
+	if(current_loop_enabled) {
+		for(int i = 0; i < 4; i++) {
+			errors[i] = vel_out[i] - amps_to_percent(snapshot.motor[i].current);
+		}
+		cur_ctrl.calculate(errors, outputs);
+	}
+
+	for(int i = 0; i < 4; i++) {
+		/* Without fresh feedback the loop is open, cut the current of that motor
+		 * and restart its controllers so they don't wind up meanwhile */
+		if(is_feedback_stale(snapshot, (motor_id)i)) {
+			currents[i] = 0;
+			cmd_percent[i] = 0;
+			stale_cnt[i]++;
+			pos_ctrl.reset(i);
+			vel_ctrl.reset(i);
+			cur_ctrl.reset(i);
+			continue;
+		}
+		// map from percentage to current command, a step test is open loop (no current loop either)
+		cmd_percent[i] = (i == tune_m) ? vel_out[i] : outputs[i];
+		currents[i] = (int16_t)percent_to_current(cmd_percent[i]);
+	}
+
+	set_current(currents[Motor1], currents[Motor2], currents[Motor3], currents[Motor4]);
+}
+
+/* control task, start of a step: a stage joining the cascade is preset so that
+ * its first output equals what the stage before it was producing */
+void M2006_Motor::apply_mode_requests(const feedback_snapshot& snapshot) {
+	for(int i = 0; i < 4; i++) {
+		control_mode requested = requested_mode[i];
+		if(requested == mode[i]) continue;
+		if(requested == Position_Control) {
+			// position loop takes over the velocity reference in use
+			float pos_error = (float)(pos_target[i] - get_position(snapshot, (motor_id)i)) / angle_counts_per_turn;
+			pos_ctrl.preload(i, vel_ref[i], pos_error);
+		}
+		// leaving Position_Control: set_control_mode() already set vel_target to vel_ref
+		mode[i] = requested;
+	}
+
+	bool requested = current_loop_requested;
+	if(requested == current_loop_enabled) return;
+	for(int i = 0; i < 4; i++) {
+		if(requested) {
+			// current loop starts from the command sent last, the velocity loop output becomes its setpoint
+			cur_ctrl.preload(i, cmd_percent[i], vel_out[i] - amps_to_percent(snapshot.motor[i].current));
+		}
+		else {
+			// velocity loop output becomes the command again, start it from the command sent last
+			vel_ctrl.preload(i, cmd_percent[i], vel_ref[i] - get_velocity(snapshot, (motor_id)i));
+		}
+	}
+	current_loop_enabled = requested;
 }
 
 // vel range: -100.00 ~ 100.00, where 100.00 means 100% of max possible velocity
 void M2006_Motor::set_velocity(float m1_vel, float m2_vel, float m3_vel, float m4_vel) {
-	this->m1_vel = m1_vel;
-	this->m2_vel = m2_vel;
-	this->m3_vel = m3_vel;
-	this->m4_vel = m4_vel;
+	vel_target[Motor1] = m1_vel;
+	vel_target[Motor2] = m2_vel;
+	vel_target[Motor3] = m3_vel;
+	vel_target[Motor4] = m4_vel;
+}
+
+void M2006_Motor::set_control_mode(motor_id m_id, control_mode mode) {
+	if(mode == requested_mode[m_id]) return;
+	if(mode == Position_Control) {
+		// hold where it is until set_position()
+		pos_target[m_id] = (int32_t)get_position(m_id);
+	}
+	else {
+		// keep the velocity the position loop was commanding until set_velocity()
+		vel_target[m_id] = vel_ref[m_id];
+	}
+	requested_mode[m_id] = mode;
+}
+
+void M2006_Motor::update_position_pid_consts(float Kp, float Ki, float Kd) {
+	pos_ctrl.update_pid_consts(Kp, Ki, Kd);
+}
+
+void M2006_Motor::set_position_velocity_limit(float percent) {
+	pos_ctrl.set_output_limits(-percent, percent);
+}
+
+void M2006_Motor::update_current_pid_consts(float Kp, float Ki, float Kd) {
+	cur_ctrl.update_pid_consts(Kp, Ki, Kd);
+}
+
+void M2006_Motor::set_current_limit(motor_id m_id, float percent) {
+	if(percent < 0) percent = 0;
+	if(percent > 100.00f) percent = 100.00f;
+	vel_ctrl.set_output_limits(m_id, -percent, percent);
+	cur_ctrl.set_output_limits(m_id, -percent, percent);
 }
 
 void M2006_Motor::stop(void){
+	// a motor holding a position stops too
+	for(int i = 0; i < 4; i++) set_control_mode((motor_id)i, Velocity_Control);
 	set_velocity(0.00, 0.00, 0.00, 0.00);
 }
 
@@ -280,3 +534,153 @@ void M2006_Motor::motor_test(motor_id m_id) {
 	}
 }
 
+
+/* Autotune */
+
+static const float autotune_settle_s = 0.30f;
+static const float autotune_rest_percent = 2.00f;     // max velocity at rest, %
+static const float autotune_saturation_percent = 95.00f;
+static const float autotune_zeta = 0.70f;             // damping of the tuned loop, ~5% overshoot
+
+bool M2006_Motor::start_autotune(motor_id m_id, float step_percent, float duration_s) {
+	autotune_state state = tune_state;
+	if(state == Autotune_Settling || state == Autotune_Recording) return false;
+	if(step_percent > 100.00f) step_percent = 100.00f;
+	if(step_percent < -100.00f) step_percent = -100.00f;
+
+	tune_motor = m_id;
+	tune_step_percent = step_percent;
+	tune_settle_ticks = (uint32_t)(autotune_settle_s * pid_ctrl_freq_Hz);
+	// spread the samples over the step, at most one per control step
+	tune_decimation = (uint32_t)(duration_s * pid_ctrl_freq_Hz / Autotune_Max_Samples + 0.5f);
+	if(tune_decimation < 1) tune_decimation = 1;
+	tune_max_samples = (uint32_t)(duration_s * pid_ctrl_freq_Hz / tune_decimation);
+	if(tune_max_samples > Autotune_Max_Samples) tune_max_samples = Autotune_Max_Samples;
+	tune_num_samples = 0;
+	tune_tick = 0;
+	tune_baseline = 0;
+	tune_result.m_id = m_id;
+	tune_result.failure = NULL;
+	tune_abort_requested = false;
+	tune_step_limited = false;
+	tune_state = Autotune_Settling; // hands the test over to the control task
+	return true;
+}
+
+void M2006_Motor::abort_autotune(void) {
+	autotune_state state = tune_state;
+	if(state != Autotune_Settling && state != Autotune_Recording) return;
+	// the control task ends it, so the controllers get restarted from there
+	tune_abort_requested = true;
+}
+
+/* control task, before the power limiter: the output (% of max current) of the motor
+ * under test this step, instead of its velocity loop's */
+float M2006_Motor::autotune_update(const feedback_snapshot& snapshot) {
+	int m = tune_motor;
+	float velocity = get_velocity(snapshot, tune_motor);
+	float percent = 0;
+	const char *failure = NULL;
+
+	if(tune_abort_requested) failure = "aborted";
+	else if(is_feedback_stale(snapshot, tune_motor)) failure = "feedback lost";
+	else if(tune_step_limited) failure = "step cut by the power limiter, use a smaller step or a larger budget";
+	else if(tune_state == Autotune_Settling) {
+		// at rest by the end of the settling time, the mean of its last 1/4 is the baseline
+		if(tune_tick >= tune_settle_ticks * 3 / 4) tune_baseline += velocity;
+		if(++tune_tick >= tune_settle_ticks) {
+			tune_baseline /= (float)(tune_settle_ticks - tune_settle_ticks * 3 / 4);
+			if(tune_baseline > autotune_rest_percent || tune_baseline < -autotune_rest_percent) failure = "motor not at rest";
+			else {
+				tune_tick = 0;
+				tune_state = Autotune_Recording;
+			}
+		}
+	}
+	else {
+		percent = tune_step_percent;
+		if(velocity > autotune_saturation_percent || velocity < -autotune_saturation_percent) {
+			failure = "velocity saturated, use a smaller step";
+		}
+		else if(tune_tick++ % tune_decimation == 0) {
+			tune_samples[tune_num_samples++] = velocity;
+			if(tune_num_samples >= tune_max_samples) {
+				failure = autotune_identify();
+				if(failure == NULL) tune_state = Autotune_Done;
+			}
+		}
+	}
+
+	if(failure != NULL) {
+		tune_result.failure = failure;
+		tune_state = Autotune_Failed;
+	}
+	if(tune_state == Autotune_Done || tune_state == Autotune_Failed) {
+		// back to the cascade, starting over: they ran against the overridden output meanwhile
+		percent = 0;
+		pos_ctrl.reset(m);
+		vel_ctrl.reset(m);
+		cur_ctrl.reset(m);
+	}
+	return percent;
+}
+
+/* Two point method on the recorded step: with t28, t63 the times the response
+ * crosses 28.3% and 63.2% of its final change, a first order plus dead time model has
+ * time_constant = 1.5 * (t63 - t28), dead_time = t63 - time_constant.
+ * Gains for the velocity loop's incremental law, which is integral dominated: the closed loop
+ * of Ki on gain / (time_constant*s + 1) is second order with damping 1 / (2 * sqrt(gain * Ki * time_constant)),
+ * the dead time is lumped into the time constant */
+const char* M2006_Motor::autotune_identify(void) {
+	uint32_t n = tune_num_samples;
+	uint32_t tail = n / 10;
+	if(tail < 1) return "too few samples";
+
+	// final value: mean of the last 10%, settled if the 10% before it agrees
+	float final_value = 0, before_final = 0;
+	for(uint32_t i = n - tail; i < n; i++) final_value += tune_samples[i];
+	for(uint32_t i = n - 2 * tail; i < n - tail; i++) before_final += tune_samples[i];
+	final_value /= tail;
+	before_final /= tail;
+	float change = final_value - tune_baseline;
+	float step = tune_step_percent;
+	if(change * step <= 0 || (change < autotune_rest_percent && change > -autotune_rest_percent)) {
+		return "no response, use a larger step";
+	}
+	float drift = final_value - before_final;
+	if(drift > 0.02f * change || drift < -0.02f * change) return "not settled, use a longer duration";
+
+	// first crossings of 28.3% and 63.2%, interpolated between samples, in sample periods
+	float t28 = -1, t63 = -1;
+	float prev_rel = 0;
+	for(uint32_t i = 0; i < n; i++) {
+		float rel = (tune_samples[i] - tune_baseline) / change; // 0 ~ 1 along the step, for either direction
+		if(t28 < 0 && rel >= 0.283f) t28 = (i == 0) ? 0 : (i - 1) + (0.283f - prev_rel) / (rel - prev_rel);
+		if(t63 < 0 && rel >= 0.632f) {
+			t63 = (i == 0) ? 0 : (i - 1) + (0.632f - prev_rel) / (rel - prev_rel);
+			break;
+		}
+		prev_rel = rel;
+	}
+	if(t28 < 0 || t63 <= t28) return "response too fast for the sample rate";
+
+	float sample_period_s = tune_decimation / pid_ctrl_freq_Hz;
+	float time_constant = 1.50f * (t63 - t28) * sample_period_s;
+	float dead_time = t63 * sample_period_s - time_constant;
+	if(dead_time < 0) dead_time = 0;
+	float gain = change / step;
+
+	int m = tune_motor;
+	float Kp = vel_ctrl.Kp[m];
+	float Ki = 1.00f / (4.00f * autotune_zeta * autotune_zeta * gain * (time_constant + dead_time));
+	float Kd = 0;
+	vel_ctrl.update_pid_consts(m, Kp, Ki, Kd);
+
+	tune_result.gain = gain;
+	tune_result.time_constant_s = time_constant;
+	tune_result.dead_time_s = dead_time;
+	tune_result.Kp = Kp;
+	tune_result.Ki = Ki;
+	tune_result.Kd = Kd;
+	return NULL;
+}
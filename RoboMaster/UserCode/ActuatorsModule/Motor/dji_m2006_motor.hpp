@@ -3,10 +3,18 @@
 
 #include "stf.h"
 //#include "pid.hpp"
-#include "incremental_pid.hpp"
+#include "batch_incremental_pid.hpp"
+#include "batch_pid.hpp"
+#include "seqlock.hpp"
+#include "power_limiter.hpp"
+#include "CAN/can_tx_queue.hpp"
+#include "CAN/can_health.hpp"
+#include "CAN/can_filter.hpp"
 
 #include <string>
 
+#define Autotune_Max_Samples 500
+
 
 namespace DjiRM {
     enum motor_id : int {
@@ -15,6 +23,71 @@ namespace DjiRM {
         Motor3 = 2,
         Motor4 = 3
     };
+
+    /* Each C610 ESC has an ID of 1~8 (set by its button), feedback of ESC #i
+     * comes in with StdId 0x200 + i, while current commands are sent 4 ESCs
+     * per frame: StdId 0x200 carries ESC 1~4, StdId 0x1FF carries ESC 5~8 */
+    enum esc_group : int {
+        ESC1_to_4 = 0,
+        ESC5_to_8 = 1
+    };
+
+    /* which signal the velocity loop runs on:
+     * ESC_Speed        : rpm field reported by the ESC, coarse at low speed
+     * Angle_Difference : unwrapped angle differenced over frame arrival times
+     * Alpha_Beta       : alpha-beta tracker on the unwrapped angle, smoother than
+     *                    plain differencing with little lag (default) */
+    enum velocity_source : int {
+        ESC_Speed,
+        Angle_Difference,
+        Alpha_Beta
+    };
+
+    /* what the outermost loop of a motor controls:
+     * Velocity_Control : set_velocity() -> velocity loop -> current
+     * Position_Control : set_position() -> position loop -> velocity loop -> current
+     * either way optionally followed by the current loop, see enable_current_loop() */
+    enum control_mode : int {
+        Velocity_Control,
+        Position_Control
+    };
+
+    enum autotune_state : int {
+        Autotune_Idle,
+        Autotune_Settling,  // zero current, waiting for the motor to be at rest
+        Autotune_Recording, // current step applied, recording the velocity
+        Autotune_Done,      // gains identified and applied
+        Autotune_Failed
+    };
+
+    /* outcome of a step test, model: velocity(s) / current(s) = gain * e^(-dead_time*s) / (time_constant*s + 1)
+     * in the units of the velocity loop, % of max velocity per % of max current */
+    struct autotune_result {
+        motor_id m_id;
+        const char *failure; // reason of Autotune_Failed, NULL otherwise
+        float gain;
+        float time_constant_s;
+        float dead_time_s;
+        float Kp, Ki, Kd;    // applied to the motor's velocity loop
+    };
+
+    // latest feedback frame of one ESC, stamped on arrival
+    struct motor_feedback {
+        uint16_t angle;     // rotor angle, 0 ~ 8191 per rotor turn
+        int16_t speed;      // rotor rpm
+        float current;      // ampere
+        uint32_t timestamp; // stf::cycles() when the frame arrived
+        uint32_t seq;       // frames received so far, 0 means never heard from this ESC
+        uint32_t gaps;      // times the interval between 2 frames exceeded the expected 1ms by far
+        int64_t position;   // multi-turn rotor angle, 8192 per rotor turn, starts at the first angle received
+        float velocity_diff; // rotor rpm, from angle differencing
+        float velocity_ab;   // rotor rpm, from the alpha-beta tracker
+    };
+
+    // all 4 motors of an instance, read in one go so they are never mixed across frames
+    struct feedback_snapshot {
+        motor_feedback motor[4];
+    };
 }
 
 struct Wheel_speeds_t{
@@ -34,24 +107,32 @@ typedef struct Parsed_cmd_t Parsed_cmd;
 
 
 namespace DjiRM {
-    /* Only utilizing the OOP conventions, in fact for simplicity,
-       only one instantiation is allowed due to complications 
-       in sharing object fields with the CAN interrupt callback functions,
-       (only new this object once, or bug would occur for receiving
-        encoder data. To make it support multiple instance, i.e. 
-        multiple CAN buses and more than 4 motors, please modify the
-        source code of this class. Our current application only
-        needs 4 motors in total, thus being too lazy to generalize it)*/
+    /* One instance drives one group of 4 ESCs (ESC1~4 or ESC5~8) on one CAN bus,
+     * so a bus carries up to 2 instances (8 ESCs), e.g. chassis on CAN1 ESC1~4,
+     * dribbler on CAN2 ESC5~8. Motor1~Motor4 are local to the instance, i.e.
+     * Motor1 of an ESC5_to_8 instance is ESC #5.
+     * The CAN Rx interrupt callback is a C function, it finds the instance
+     * through a per-bus dispatch table indexed by (StdId - 0x201), see the .cpp */
     class M2006_Motor {
     private:
         CAN_HandleTypeDef *hcanx;
-        CAN_TxHeaderTypeDef tx_header;
-        CAN_FilterTypeDef  filter_config;
+        esc_group group;
+        CAN_TxQueue *tx_queue = NULL;
         uint8_t tx_data[8];
-        uint32_t tx_mailbox;
-        /* All variables for rx are defined as static variable in the .cpp file,        
-         * This is due to Rx interrupt callback is defined as a C function, which
-         * can not reside or share variable within a class */
+        uint32_t next_origin_cycles = 0; // of the next current command frame, see tag_next_command()
+
+        /* written by the CAN Rx interrupt, read by tasks */
+        Seqlock<feedback_snapshot> feedback;
+        uint32_t feedback_timeout_us = 10000; // ESC is considered lost after 10ms of silence
+        uint32_t stale_cnt[4] = {0, 0, 0, 0};
+
+        /* velocity estimation, state only touched by the CAN Rx interrupt */
+        velocity_source vel_source = Alpha_Beta;
+        float ab_alpha = 0.50f, ab_beta = 0.10f;
+        float ab_pos_err[4] = {0, 0, 0, 0}; // tracker position - measured position, in angle counts
+        float ab_vel[4] = {0, 0, 0, 0};     // angle counts per second
+        int64_t position_offset[4] = {0, 0, 0, 0}; // set by reset_position(), task side only
+        void estimate_velocity(motor_feedback& fb, int32_t delta_angle, float dt_s, motor_id m_id);
 
         float pid_ctrl_freq_Hz = 5000.00; // default 5000Hz
 //        PID_Controller<float> m1_ctrl;
@@ -59,31 +140,73 @@ namespace DjiRM {
 //		PID_Controller<float> m3_ctrl;
 //		PID_Controller<float> m4_ctrl;
 
-        INC_PID_Controller<float> m1_ctrl;
-		INC_PID_Controller<float> m2_ctrl;
-		INC_PID_Controller<float> m3_ctrl;
-		INC_PID_Controller<float> m4_ctrl;
+        /* cascade of Motor1~4, each stage computed in one pass for all 4:
+         * position loop (every pos_loop_divider control steps): rotor turns of error -> % of max velocity
+         * velocity loop (every step): % of max velocity -> % of max current
+         * current loop (every step, optional): % of max current on the ESC current feedback -> % of max current */
+        Batch_PID_Controller<4> pos_ctrl;
+        Batch_INC_PID_Controller<4> vel_ctrl;
+        Batch_INC_PID_Controller<4> cur_ctrl;
+        float pos_loop_freq_Hz = 1000.00f;
+        uint32_t pos_loop_divider = 5;
+        uint32_t pos_loop_tick = 0;
 
-		int16_t max_raw_speed = 19100;
+        /* set by tasks, picked up at the next control step */
+        float vel_target[4] = {0, 0, 0, 0};          // %
+        volatile int32_t pos_target[4] = {0, 0, 0, 0}; // rotor counts, from the reset_position() origin
+        volatile control_mode requested_mode[4] = {Velocity_Control, Velocity_Control, Velocity_Control, Velocity_Control};
+        volatile bool current_loop_requested = false;
 
-		float m1_vel, m2_vel, m3_vel, m4_vel;
+        /* control task only */
+        control_mode mode[4] = {Velocity_Control, Velocity_Control, Velocity_Control, Velocity_Control};
+        bool current_loop_enabled = false;
+        float vel_ref[4] = {0, 0, 0, 0};     // velocity loop setpoint of the latest step, %
+        float vel_ref_prev[4] = {0, 0, 0, 0};
+        float vel_out[4] = {0, 0, 0, 0};     // velocity loop output of the latest step, %
+        float cmd_percent[4] = {0, 0, 0, 0}; // current command of the latest step, %
+        Power_Limiter power_limiter;         // thermal and power envelope on the velocity loop output
+        void apply_mode_requests(const feedback_snapshot& snapshot);
+
+        /* autotune, parameters set by start_autotune() before the state leaves Idle,
+         * everything else belongs to the control task while it runs */
+        volatile autotune_state tune_state = Autotune_Idle;
+        volatile bool tune_abort_requested = false; // abort_autotune(), picked up at the next control step
+        motor_id tune_motor = Motor1;
+        bool tune_step_limited = false;   // the power limiter cut the step
+        float tune_step_percent = 0;
+        uint32_t tune_tick = 0;
+        uint32_t tune_settle_ticks = 0;
+        uint32_t tune_decimation = 1;     // control steps per sample
+        uint32_t tune_num_samples = 0;    // recorded so far
+        uint32_t tune_max_samples = 0;    // of this test
+        float tune_baseline = 0;          // velocity at rest, %
+        float tune_samples[Autotune_Max_Samples]; // velocity during the step, %, preallocated so a test never allocates
+        autotune_result tune_result;
+        float autotune_update(const feedback_snapshot& snapshot);
+        const char* autotune_identify(void);
 
     public:
 
         M2006_Motor(CAN_HandleTypeDef *hcanx, float Kp, float Ki, float Kd) :
-    										    m1_ctrl(Kp, Ki, Kd),
-												m2_ctrl(Kp, Ki, Kd),
-												m3_ctrl(Kp, Ki, Kd),
-												m4_ctrl(Kp, Ki, Kd) {
+                                                M2006_Motor(hcanx, ESC1_to_4, Kp, Ki, Kd) {}
+
+        M2006_Motor(CAN_HandleTypeDef *hcanx, float Kp, float Ki, float Kd, float ctrl_freq_Hz) :
+                                                M2006_Motor(hcanx, ESC1_to_4, Kp, Ki, Kd, ctrl_freq_Hz) {}
+
+        M2006_Motor(CAN_HandleTypeDef *hcanx, esc_group group, float Kp, float Ki, float Kd) :
+    										    pos_ctrl(20.00f, 2.00f, 0),
+												vel_ctrl(Kp, Ki, Kd),
+												cur_ctrl(0, 200.00f, 0) {
             this->hcanx = hcanx;
+            this->group = group;
         }
 
-        M2006_Motor(CAN_HandleTypeDef *hcanx, float Kp, float Ki, float Kd, float ctrl_freq_Hz) :
-    										    m1_ctrl(Kp, Ki, Kd),
-												m2_ctrl(Kp, Ki, Kd),
-												m3_ctrl(Kp, Ki, Kd),
-												m4_ctrl(Kp, Ki, Kd) {
+        M2006_Motor(CAN_HandleTypeDef *hcanx, esc_group group, float Kp, float Ki, float Kd, float ctrl_freq_Hz) :
+    										    pos_ctrl(20.00f, 2.00f, 0),
+												vel_ctrl(Kp, Ki, Kd),
+												cur_ctrl(0, 200.00f, 0) {
             this->hcanx = hcanx;
+            this->group = group;
             this->pid_ctrl_freq_Hz = ctrl_freq_Hz;
         }
 
@@ -96,6 +219,8 @@ namespace DjiRM {
 
         void stop(void);
 
+        // "x,y,omega" text commands, superseded by the binary frames of Protocol/robot_protocol.hpp
+        // (Protocol::parse_text_command() gives the same results without a heap allocation)
         static Parsed_cmd parse_cmd(std::string cmd_str){
     		Parsed_cmd parsed_cmd;
     		int firstDelim;
@@ -125,17 +250,142 @@ namespace DjiRM {
         float get_raw_current(motor_id m_id);
         
         float get_velocity(motor_id m_id);
+        float get_velocity(const feedback_snapshot& snapshot, motor_id m_id);
+        // rotor rpm from the selected velocity source
+        float get_raw_velocity(const feedback_snapshot& snapshot, motor_id m_id);
+
+        // multi-turn rotor angle in encoder counts (8192 per rotor turn, 36 rotor turns per output turn)
+        int64_t get_position(motor_id m_id) {return get_position(feedback.read(), m_id);}
+        int64_t get_position(const feedback_snapshot& snapshot, motor_id m_id) {
+            return snapshot.motor[m_id].position - position_offset[m_id];
+        }
+        // makes the current position read as 0
+        void reset_position(motor_id m_id) {position_offset[m_id] = feedback.read().motor[m_id].position;}
+
+        inline void set_velocity_source(velocity_source source) {vel_source = source;}
+        inline velocity_source get_velocity_source(void) {return vel_source;}
+        /* alpha, beta in (0, 1]: larger alpha trusts each new angle more,
+         * larger beta lets the velocity estimate react faster (and noisier),
+         * keep beta < alpha^2 / (2 - alpha) for a well damped response */
+        inline void set_alpha_beta_gains(float alpha, float beta) {ab_alpha = alpha; ab_beta = beta;}
+
+        /* consistent copy of the latest feedback of all 4 motors (lock-free, ISR never waits) */
+        feedback_snapshot get_feedback_snapshot(void) {return feedback.read();}
+        // microseconds since the latest frame of this motor in the snapshot
+        float get_feedback_age_us(const feedback_snapshot& snapshot, motor_id m_id);
+        // true if no frame within the feedback timeout or never received one
+        bool is_feedback_stale(const feedback_snapshot& snapshot, motor_id m_id);
+        inline void set_feedback_timeout_us(uint32_t timeout_us) {feedback_timeout_us = timeout_us;}
+        // number of control steps skipped for this motor due to stale feedback
+        inline uint32_t get_stale_count(motor_id m_id) {return stale_cnt[m_id];}
 
         void update_pid_consts(float Kp, float Ki, float Kd);
+        // velocity loop of one motor only
+        void update_pid_consts(motor_id m_id, float Kp, float Ki, float Kd);
+        /* velocity loop feed-forward: Kff_vel in % of max current per % of velocity setpoint,
+         * Kff_acc in % of max current per %/s of setpoint change (default 0, 0) */
+        void update_feed_forward_consts(float Kff_vel, float Kff_acc);
+        // low pass on the velocity loop's derivative term, 0 is off (default)
+        inline void set_derivative_filter(float cutoff_Hz) {vel_ctrl.set_derivative_filter(cutoff_Hz);}
 		uint32_t get_ctrl_period_ms(void);
+		inline float get_ctrl_freq_Hz(void) {return pid_ctrl_freq_Hz;}
 		void pid_update_motor_currents(void);
 
 		// vel range: -100.00 ~ 100.00, where 100.00 means 100% of max possible velocity
 		void set_velocity(float m1_vel, float m2_vel, float m3_vel, float m4_vel);
 
+		/* Cascaded control. Mode changes are taken at the next control step and are
+		 * bumpless: the stage that takes over is preset to continue from the output
+		 * of the one it replaces, so switching under load gives no current step.
+		 * Entering Position_Control holds the current position until set_position(),
+		 * leaving it holds the velocity it was commanding until set_velocity(). */
+		void set_control_mode(motor_id m_id, control_mode mode);
+		inline control_mode get_control_mode(motor_id m_id) {return requested_mode[m_id];}
+		// target in rotor counts (8192 per rotor turn) from the reset_position() origin, Position_Control only
+		inline void set_position(motor_id m_id, int32_t counts) {pos_target[m_id] = counts;}
+		/* position loop: Kp in % of max velocity per rotor turn of error, keep Ki > 0 for a bumpless
+		 * switch into Position_Control (default 20, 2, 0) */
+		void update_position_pid_consts(float Kp, float Ki, float Kd);
+		// max velocity the position loop commands, % (default 100)
+		void set_position_velocity_limit(float percent);
+		// position loop rate, the velocity and current loops always run at the control rate, call before init()
+		inline void set_position_loop_freq_Hz(float freq_Hz) {pos_loop_freq_Hz = freq_Hz;}
+
+		/* inner current loop on the ESC current feedback, all 4 motors (default off, gains 0, 200, 0),
+		 * takes effect at the next control step, bumpless both ways */
+		inline void enable_current_loop(bool enable) {current_loop_requested = enable;}
+		void update_current_pid_consts(float Kp, float Ki, float Kd);
+
+		/* current limit of one motor, 0 ~ 100 % of max current (default 100), on the velocity
+		 * loop output and the current loop output alike, anti-windup included. Control task
+		 * only, between two control steps (e.g. traction control) */
+		void set_current_limit(motor_id m_id, float percent);
+		// current command of the latest control step, %
+		inline float get_current_command(motor_id m_id) {return cmd_percent[m_id];}
+		// velocity loop setpoint of the latest control step, %, control task only
+		inline float get_velocity_setpoint(motor_id m_id) {return vel_ref[m_id];}
+		// P, I, D and feed-forward terms of the latest velocity loop step, % of max current, control task only
+		inline Batch_INC_PID_Controller<4>::terms get_velocity_loop_terms(motor_id m_id) {return vel_ctrl.get_terms(m_id);}
+
+		/* Thermal and power envelope, see power_limiter.hpp. The velocity loop outputs are
+		 * limited per motor by an I2t model of its winding, then scaled together to stay
+		 * within the power budget; the velocity loop follows what was kept, no windup.
+		 * The current loop, when on, tracks the limited setpoints.
+		 * Per motor: continuous and peak current, A, winding time constant, s (default 3, 10, 60) */
+		inline void set_thermal_model(float continuous_A, float peak_A, float time_constant_s) {
+			power_limiter.set_thermal_model(continuous_A, peak_A, time_constant_s);
+		}
+		// winding resistance, rotor torque constant in Nm/A (default 0.5, 0.005)
+		inline void set_motor_constants(float resistance_ohm, float torque_constant_Nm_A) {
+			power_limiter.set_motor_constants(resistance_ohm, torque_constant_Nm_A);
+		}
+		// electrical power of all 4 motors, W, 0 is unlimited (default)
+		inline void set_power_budget(float budget_W) {power_limiter.set_power_budget(budget_W);}
+		inline Power_Limiter::power_status get_power_status(void) {return power_limiter.get_status();}
+
+
+		/* Autotune of the velocity loop of one motor, the other 3 keep running as they are.
+		 * The motor gets zero current until at rest, then an open loop current step of
+		 * step_percent (% of max current) for duration_s while its velocity is recorded.
+		 * From the response, gain, time constant and dead time are identified and
+		 * Ki = 1 / (4 * zeta^2 * gain * (time_constant + dead_time)), zeta = 0.7, is
+		 * applied to that motor (Kd = 0, Kp kept: in the incremental law it acts on the
+		 * change of error only). The wheel spins freely in one direction during the
+		 * test, so the result holds for the load it spins against (floor, carpet).
+		 * The step goes through the thermal and power limits like the loop outputs do.
+		 * Fails if the feedback goes stale, the motor doesn't come to rest, the limits
+		 * cut the step, or the velocity saturates or hasn't settled by the end.
+		 * false if a test is running */
+		bool start_autotune(motor_id m_id, float step_percent = 20.00f, float duration_s = 1.00f);
+		// ends a running test at the next control step, the motor goes back to its (restarted) velocity loop
+		void abort_autotune(void);
+		inline autotune_state get_autotune_state(void) {return tune_state;}
+		// valid once the state is Autotune_Done or Autotune_Failed
+		inline autotune_result get_autotune_result(void) {return tune_result;}
+		// recorded step response, velocity in %, one sample per sample_period_s
+		inline const float* get_autotune_samples(uint32_t& num_samples, float& sample_period_s) {
+			num_samples = tune_num_samples;
+			sample_period_s = tune_decimation / pid_ctrl_freq_Hz;
+			return tune_samples;
+		}
 
         void motor_test(void);
         void motor_test(motor_id m_id);
+
+        inline CAN_HandleTypeDef *get_hcanx(void) {return hcanx;}
+        // drop / latency statistics of the current commands, shared by all instances on the bus
+        inline CAN_TxQueue::tx_stats get_tx_stats(void) {return tx_queue->get_stats();}
+        inline esc_group get_esc_group(void) {return group;}
+        /* the next current command frame results from something that happened at origin_cycles
+         * (stf::cycles(), e.g. the arrival of a host command), call from the task sending the currents */
+        inline void tag_next_command(uint32_t origin_cycles) {next_origin_cycles = origin_cycles;}
+        // tagged origin -> current command frame acknowledged on the bus, shared by all instances on the bus
+        inline Latency_Histogram::histogram get_command_latency(void) {return tx_queue->get_origin_latency();}
+        // error state of the bus and frame rate / last seen age per ESC, shared by all instances on the bus
+        inline CAN_Health* get_can_health(void) {return CAN_Health::of(hcanx);}
+
+        // invoked by the CAN Rx interrupt, do not call it elsewhere
+        void rx_interrupt_task(motor_id m_id, uint8_t rx_data[8]);
     };
 }
 
@@ -0,0 +1,117 @@
+/*
+ * power_limiter.cpp
+ */
+
+#include "power_limiter.hpp"
+
+#include <math.h>
+
+static const float thermal_update_Hz = 100.00f;
+
+void Power_Limiter::init(float ctrl_freq_Hz, float amps_per_unit) {
+	this->dt_s = 1.00f / ctrl_freq_Hz;
+	this->amps_per_unit = amps_per_unit;
+	this->thermal_divider = (uint32_t)(ctrl_freq_Hz / thermal_update_Hz + 0.5f);
+	if(thermal_divider < 1) thermal_divider = 1;
+	thermal_tick = 0;
+	set_thermal_model(continuous_A, peak_A, time_constant_s, soft_start_sq / continuous_sq);
+}
+
+void Power_Limiter::set_thermal_model(float continuous_A, float peak_A, float time_constant_s, float soft_start) {
+	this->continuous_A = continuous_A;
+	this->peak_A = peak_A;
+	this->time_constant_s = time_constant_s;
+	this->continuous_sq = continuous_A * continuous_A;
+	this->soft_start_sq = soft_start * continuous_sq;
+	this->thermal_alpha = (thermal_divider * dt_s) / time_constant_s;
+	update_thermal();
+}
+
+void Power_Limiter::set_motor_constants(float resistance_ohm, float torque_constant_Nm_A) {
+	this->resistance_ohm = resistance_ohm;
+	this->torque_constant = torque_constant_Nm_A;
+}
+
+void Power_Limiter::set_power_budget(float budget_W, float recovery_per_s) {
+	this->budget_W = budget_W;
+	this->recovery_per_s = recovery_per_s;
+}
+
+// limits from the heat, full peak current up to soft_start, continuous rating at the limit
+void Power_Limiter::update_thermal(void) {
+	float band = continuous_sq - soft_start_sq;
+	for(int i = 0; i < 4; i++) {
+		float over = heat[i] - soft_start_sq;
+		if(over <= 0) thermal_limit[i] = peak_A;
+		else if(band <= 0 || over >= band) thermal_limit[i] = continuous_A;
+		else thermal_limit[i] = peak_A - (peak_A - continuous_A) * over / band;
+	}
+}
+
+uint8_t Power_Limiter::apply(float commands[4], const float measured_A[4], const float rotor_speed_rad_s[4]) {
+	uint8_t changed = 0;
+
+	// thermal model, on the current that actually flowed
+	for(int i = 0; i < 4; i++) sum_sq[i] += measured_A[i] * measured_A[i];
+	if(++thermal_tick >= thermal_divider) {
+		float inv_n = 1.00f / thermal_tick;
+		for(int i = 0; i < 4; i++) {
+			heat[i] += (sum_sq[i] * inv_n - heat[i]) * thermal_alpha;
+			sum_sq[i] = 0;
+		}
+		thermal_tick = 0;
+		update_thermal();
+	}
+
+	float amps[4];
+	for(int i = 0; i < 4; i++) {
+		amps[i] = commands[i] * amps_per_unit;
+		if(amps[i] > thermal_limit[i]) amps[i] = thermal_limit[i];
+		else if(amps[i] < -thermal_limit[i]) amps[i] = -thermal_limit[i];
+		else continue;
+		changed |= (1 << i);
+		published.thermal_limited_steps[i]++;
+	}
+
+	// power of the commands, k^2 * a + k * b
+	float a = 0, b = 0;
+	for(int i = 0; i < 4; i++) {
+		a += amps[i] * amps[i];
+		b += rotor_speed_rad_s[i] * amps[i];
+	}
+	a *= resistance_ohm;
+	b *= torque_constant;
+	float power = a + b;
+
+	float k = 1.00f;
+	// (a > 0 whenever power > 0)
+	if(budget_W > 0 && power > budget_W) k = (-b + sqrtf(b * b + 4.00f * a * budget_W)) / (2.00f * a);
+	// down at once, back up smoothly
+	float recovered = scale + recovery_per_s * dt_s;
+	scale = (k < recovered) ? k : recovered;
+	if(scale > 1.00f) scale = 1.00f;
+	if(scale < 1.00f) {
+		for(int i = 0; i < 4; i++) amps[i] *= scale;
+		power = a * scale * scale + b * scale;
+		changed = 0x0F;
+		published.power_limited_steps++;
+	}
+
+	if(changed) {
+		float units_per_amp = 1.00f / amps_per_unit;
+		for(int i = 0; i < 4; i++) {
+			if(changed & (1 << i)) commands[i] = amps[i] * units_per_amp;
+		}
+	}
+
+	power_status& s = status.write_begin();
+	s = published;
+	for(int i = 0; i < 4; i++) {
+		s.heat[i] = heat[i] / continuous_sq * 100.00f;
+		s.thermal_limit_A[i] = thermal_limit[i];
+	}
+	s.power_W = power;
+	s.power_scale = scale;
+	status.write_end();
+	return changed;
+}
@@ -0,0 +1,95 @@
+/*
+ * power_limiter.hpp
+ *
+ * Thermal and power envelope on the current commands of a group of 4
+ * motors, applied by the control step between the velocity loop and the ESCs.
+ *
+ * Thermal (per motor): I2t model on the ESC current feedback, the winding
+ * heats with I^2 and cools with time_constant_s, i.e.
+ *  heat += (I^2 - heat) * dt / time_constant   (heat: mean square current)
+ * which settles at continuous_A^2 for a motor run at its rating. Up to
+ * soft_start of that the motor gets its full peak_A, then the limit slides
+ * down to continuous_A as the heat reaches it, so a motor pushed for long
+ * ends up at its continuous rating instead of tripping off, and short
+ * bursts keep the full peak current.
+ *
+ * Power (chassis wide): electrical power of the commands is predicted from
+ * the rotor speeds, per motor R * I^2 + Kt * omega * I (copper loss plus
+ * mechanical power, regen counts negative). Above the budget, all 4
+ * commands get the same scale k, solved in closed form from
+ *  k^2 * R * sum(I^2) + k * Kt * sum(omega * I) = budget
+ * so the sum of the forces keeps its direction and the chassis gets as much
+ * acceleration as the budget allows along the commanded one. k drops at
+ * once and comes back at recovery_per_s, so the commands are scaled
+ * smoothly instead of being chopped.
+ *
+ * The defaults are a rough M2006 (3A continuous, 10A peak on the C610,
+ * Kt 0.18Nm/A at the 36:1 output), the budget is off until set.
+ * apply() belongs to the control task, get_status() to any task (Seqlock).
+ */
+
+#ifndef POWER_LIMITER_HPP_
+#define POWER_LIMITER_HPP_
+
+#include "stf.h"
+#include "seqlock.hpp"
+
+class Power_Limiter {
+public:
+	struct power_status {
+		float heat[4];              // % of the continuous rating's steady state, 100 at the limit
+		float thermal_limit_A[4];
+		float power_W;              // predicted, of the commands sent
+		float power_scale;          // on all 4 commands, 1 below the budget
+		uint32_t thermal_limited_steps[4];
+		uint32_t power_limited_steps;
+	};
+
+	Power_Limiter(void) {}
+
+	// control rate, and amperes per unit of the commands given to apply()
+	void init(float ctrl_freq_Hz, float amps_per_unit);
+
+	void set_thermal_model(float continuous_A, float peak_A, float time_constant_s, float soft_start = 0.80f);
+	// winding resistance, rotor side torque constant (= back-EMF constant, V per rad/s)
+	void set_motor_constants(float resistance_ohm, float torque_constant_Nm_A);
+	// W, 0 turns the power budget off (default)
+	void set_power_budget(float budget_W, float recovery_per_s = 20.00f);
+
+	/* control task, every step: commands in, limited commands out, in the unit of init().
+	 * measured_A: ESC current feedback, rotor_speed_rad_s: rotor velocity.
+	 * Returns bit i set if command i was changed */
+	uint8_t apply(float commands[4], const float measured_A[4], const float rotor_speed_rad_s[4]);
+
+	power_status get_status(void) {return status.read();}
+
+private:
+	Seqlock<power_status> status;
+
+	/* configuration */
+	float amps_per_unit = 0.10f;
+	float dt_s = 0.0002f;
+	float continuous_sq = 9.00f;        // A^2
+	float soft_start_sq = 7.20f;        // A^2
+	float continuous_A = 3.00f;
+	float peak_A = 10.00f;
+	float time_constant_s = 60.00f;
+	float thermal_alpha = 0.0001667f;   // per thermal update
+	float resistance_ohm = 0.50f;
+	float torque_constant = 0.18f / 36.00f;
+	float budget_W = 0;
+	float recovery_per_s = 20.00f;
+
+	/* apply() only */
+	float sum_sq[4] = {0, 0, 0, 0};     // I^2 summed over the thermal_divider steps
+	float heat[4] = {0, 0, 0, 0};       // A^2
+	float thermal_limit[4] = {10.00f, 10.00f, 10.00f, 10.00f}; // A
+	float scale = 1.00f;
+	uint32_t thermal_divider = 50;      // thermal model at 100Hz, fine for a time constant of seconds
+	uint32_t thermal_tick = 0;
+	power_status published = {};
+
+	void update_thermal(void);
+};
+
+#endif /* POWER_LIMITER_HPP_ */
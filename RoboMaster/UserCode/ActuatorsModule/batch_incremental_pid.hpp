@@ -0,0 +1,213 @@
+#ifndef __BATCH_INCREMENTAL_PID_H_
+#define __BATCH_INCREMENTAL_PID_H_
+
+#include <stdint.h>
+
+template <int N> // number of channels, e.g. 4 motors of an ESC group
+class Batch_INC_PID_Controller {
+
+    /*
+     * Same control law as INC_PID_Controller<float> in fixed time interval mode,
+     * but for N channels at once, laid out as a struct of arrays: channel i of
+     * every array below belongs to motor i.
+     *
+     *  integral(t) += e(t) * period_ms / 1000
+     *  u(t) =   Kp * (e(t) - e(t-1))
+     *         + Ki * integral(t)
+     *         + Kd * (e(t) - 2*e(t-1) + e(t-2)) / period_ms
+     *  then clamped to [out_min[i], out_max[i]]
+     *
+     * The first step of a channel outputs Kp * e(t) only, the second one runs
+     * with e(t-2) = 0, as in INC_PID_Controller.
+     *
+     * Also as in INC_PID_Controller: a step whose output gets clamped doesn't
+     * integrate (anti-windup), the derivative term can go through a first order
+     * low pass (set_derivative_filter), and calculate() optionally adds
+     * Kff_vel * reference velocity + Kff_acc * reference acceleration.
+     *
+     * calculate() runs all channels in one loop with single precision only
+     * (the FPv4-SP unit has no double, every double literal in the per-object
+     * controller costs a software call), the period divisions are replaced by
+     * constants computed in init(), and the output clamp is part of the loop.
+     */
+
+public:
+    // what each term added to the latest output of a channel, before the clamp
+    struct terms {
+        float p, i, d, ff;
+    };
+
+    // proportional, integral and derivative constants per channel
+    float Kp[N], Ki[N], Kd[N];
+    // feed-forward constants per channel, 0 by default
+    float Kff_vel[N], Kff_acc[N];
+
+    Batch_INC_PID_Controller(float Kp, float Ki, float Kd) {
+        update_pid_consts(Kp, Ki, Kd);
+        update_feed_forward_consts(0, 0);
+        set_output_limits(-3.4e38f, 3.4e38f);
+        init(1000.00f);
+    }
+
+    // same constants on all channels
+    void update_pid_consts(float Kp, float Ki, float Kd) {
+        for(int i = 0; i < N; i++) update_pid_consts(i, Kp, Ki, Kd);
+    }
+
+    void update_pid_consts(int channel, float Kp, float Ki, float Kd) {
+        this->Kp[channel] = Kp;
+        this->Ki[channel] = Ki;
+        this->Kd[channel] = Kd;
+    }
+
+    // same constants on all channels
+    void update_feed_forward_consts(float Kff_vel, float Kff_acc) {
+        for(int i = 0; i < N; i++) update_feed_forward_consts(i, Kff_vel, Kff_acc);
+    }
+
+    void update_feed_forward_consts(int channel, float Kff_vel, float Kff_acc) {
+        this->Kff_vel[channel] = Kff_vel;
+        this->Kff_acc[channel] = Kff_acc;
+    }
+
+    // Fixed time interval mode only, restarts all channels
+    void init(float frequency_Hz) {
+        this->period_ms = 1000.00f / frequency_Hz;
+        this->integral_scale = period_ms / 1000.00f;
+        this->derivative_scale = 1.00f / period_ms;
+        set_derivative_filter(derivative_cutoff_Hz);
+        for(int i = 0; i < N; i++) reset(i);
+    }
+
+    // cutoff frequency of the low pass on the derivative terms, 0 turns it off
+    void set_derivative_filter(float cutoff_Hz) {
+        this->derivative_cutoff_Hz = cutoff_Hz;
+        if(cutoff_Hz <= 0) {
+            this->derivative_alpha = 1.00f;
+            return;
+        }
+        float rc_ms = 1000.00f / (2.00f * 3.14159265f * cutoff_Hz);
+        this->derivative_alpha = period_ms / (rc_ms + period_ms);
+    }
+
+    // restarts one channel, its next step is a first step again
+    void reset(int channel) {
+        integral[channel] = 0;
+        prev_error[channel] = 0;
+        prev_error2[channel] = 0;
+        filtered_derivative[channel] = 0;
+        feed_forward[channel] = 0;
+        last_output[channel] = 0;
+        last_terms[channel].p = 0;
+        last_terms[channel].i = 0;
+        last_terms[channel].d = 0;
+        last_terms[channel].ff = 0;
+        is_first_time[channel] = 1;
+    }
+
+    /* bumpless transfer: sets the channel's state so that, for an error and a
+     * feed-forward that stay as they are, the next output is the given one (taken up
+     * by the integral term). Without an integral term (Ki == 0) the output can't be preset */
+    void preload(int channel, float output, float curr_error) {
+        integral[channel] = (Ki[channel] != 0) ? (output - feed_forward[channel]) / Ki[channel] : 0;
+        prev_error[channel] = curr_error;
+        prev_error2[channel] = curr_error;
+        filtered_derivative[channel] = 0;
+        last_output[channel] = output;
+        is_first_time[channel] = 0;
+    }
+
+    /* back-calculation: the output actually applied, when something after calculate()
+     * limited it further (e.g. a power limiter). The integral is moved by the difference
+     * so the channel continues from what was applied instead of winding up */
+    void track_output(int channel, float output) {
+        if(Ki[channel] != 0) integral[channel] += (output - last_output[channel]) / Ki[channel];
+        last_output[channel] = output;
+    }
+
+    // same limits on all channels
+    void set_output_limits(float out_min, float out_max) {
+        for(int i = 0; i < N; i++) set_output_limits(i, out_min, out_max);
+    }
+
+    void set_output_limits(int channel, float out_min, float out_max) {
+        this->out_min[channel] = out_min;
+        this->out_max[channel] = out_max;
+    }
+
+    /** calculate the PID outputs of all channels **/
+    //  errors[i] = (Desired value of channel i) - (Actual value of channel i)
+    void calculate(const float errors[N], float outputs[N]) {
+        for(int i = 0; i < N; i++) {
+            feed_forward[i] = 0;
+            outputs[i] = step(i, errors[i]);
+        }
+    }
+
+    /* with feed-forward of the reference (setpoint) motion of each channel,
+       ref_velocity[i] and ref_acceleration[i] of the desired value */
+    void calculate(const float errors[N], float outputs[N],
+                   const float ref_velocity[N], const float ref_acceleration[N]) {
+        for(int i = 0; i < N; i++) {
+            feed_forward[i] = Kff_vel[i] * ref_velocity[i] + Kff_acc[i] * ref_acceleration[i];
+            outputs[i] = step(i, errors[i]);
+        }
+    }
+
+    inline float get_period_ms(void) {return period_ms;}
+
+    /* terms of the latest step of a channel as they went into its output, e.g. for
+     * telemetry: the integral term includes that step's integration even when the
+     * clamp then dropped it, a first step shows up as a P term of Kp * e(t) */
+    inline terms get_terms(int channel) const {return last_terms[channel];}
+
+private:
+    float integral[N];
+    float prev_error[N], prev_error2[N];
+    float filtered_derivative[N];
+    float feed_forward[N];   // of the latest step
+    float last_output[N];    // of the latest step
+    terms last_terms[N];     // of the latest step
+    uint8_t is_first_time[N];
+    float period_ms;         // unit: millisec
+    float integral_scale;    // period in seconds
+    float derivative_scale;  // 1 / period_ms
+    float derivative_cutoff_Hz = 0;
+    float derivative_alpha = 1.00f; // low pass coefficient, 1 is no filtering
+    float out_min[N], out_max[N];
+
+    // one channel, feed_forward[i] already set
+    inline float step(int i, float e) {
+        float e1 = prev_error[i];
+        float output;
+        terms& t = last_terms[i];
+        t.ff = feed_forward[i];
+        if(is_first_time[i]) {
+            t.p = Kp[i] * e;
+            t.i = 0;
+            t.d = 0;
+            output = t.p + t.ff;
+            is_first_time[i] = 0;
+        }
+        else {
+            float integral_step = e * integral_scale;
+            float derivative = (e - 2.00f * e1 + prev_error2[i]) * derivative_scale;
+            filtered_derivative[i] += (derivative - filtered_derivative[i]) * derivative_alpha;
+            t.p = Kp[i] * (e - e1);
+            t.i = Ki[i] * (integral[i] + integral_step);
+            t.d = Kd[i] * filtered_derivative[i];
+            output = t.p + t.i + t.d + t.ff;
+            // anti-windup by clamping: a step that ends up clamped doesn't integrate
+            if(output <= out_max[i] && output >= out_min[i]) integral[i] += integral_step;
+        }
+        prev_error2[i] = e1;
+        prev_error[i] = e;
+
+        if(output > out_max[i]) output = out_max[i];
+        if(output < out_min[i]) output = out_min[i];
+        last_output[i] = output;
+        return output;
+    }
+};
+
+#endif
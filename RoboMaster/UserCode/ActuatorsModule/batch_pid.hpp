@@ -0,0 +1,114 @@
+#ifndef __BATCH_PID_H_
+#define __BATCH_PID_H_
+
+#include <stdint.h>
+
+template <int N> // number of channels
+class Batch_PID_Controller {
+
+    /*
+     * Same control law as PID_Controller<float> in fixed time interval mode,
+     * for N channels at once in struct of arrays layout, see
+     * Batch_INC_PID_Controller for the incremental form.
+     *
+     *  integral(t) += e(t) * period_ms / 1000
+     *  u(t) = Kp * e(t) + Ki * integral(t) + Kd * (e(t) - e(t-1)) / period_ms
+     *  then clamped to [out_min, out_max]
+     *
+     * The first step of a channel outputs Kp * e(t) only. As in
+     * Batch_INC_PID_Controller, a step whose output gets clamped doesn't
+     * integrate (anti-windup).
+     */
+
+public:
+    // proportional, integral and derivative constants per channel
+    float Kp[N], Ki[N], Kd[N];
+
+    Batch_PID_Controller(float Kp, float Ki, float Kd) {
+        update_pid_consts(Kp, Ki, Kd);
+        init(1000.00f);
+    }
+
+    // same constants on all channels
+    void update_pid_consts(float Kp, float Ki, float Kd) {
+        for(int i = 0; i < N; i++) update_pid_consts(i, Kp, Ki, Kd);
+    }
+
+    void update_pid_consts(int channel, float Kp, float Ki, float Kd) {
+        this->Kp[channel] = Kp;
+        this->Ki[channel] = Ki;
+        this->Kd[channel] = Kd;
+    }
+
+    // Fixed time interval mode only, restarts all channels
+    void init(float frequency_Hz) {
+        this->period_ms = 1000.00f / frequency_Hz;
+        this->integral_scale = period_ms / 1000.00f;
+        this->derivative_scale = 1.00f / period_ms;
+        for(int i = 0; i < N; i++) reset(i);
+    }
+
+    // restarts one channel, its next step is a first step again
+    void reset(int channel) {
+        integral[channel] = 0;
+        prev_error[channel] = 0;
+        is_first_time[channel] = 1;
+    }
+
+    /* bumpless transfer: sets the channel's state so that, for an error that stays
+     * at curr_error, the next output is the given one (taken up by the integral term).
+     * Without an integral term (Ki == 0) the output can't be preset */
+    void preload(int channel, float output, float curr_error) {
+        integral[channel] = (Ki[channel] != 0) ? (output - Kp[channel] * curr_error) / Ki[channel] : 0;
+        prev_error[channel] = curr_error;
+        is_first_time[channel] = 0;
+    }
+
+    void set_output_limits(float out_min, float out_max) {
+        this->out_min = out_min;
+        this->out_max = out_max;
+    }
+
+    /** calculate the PID outputs of all channels **/
+    //  errors[i] = (Desired value of channel i) - (Actual value of channel i)
+    //  active_mask: bit i clear skips channel i, its state stays as it is and outputs[i] is 0
+    void calculate(const float errors[N], float outputs[N], uint32_t active_mask = 0xFFFFFFFF) {
+        for(int i = 0; i < N; i++) {
+            if(!(active_mask & (1UL << i))) {
+                outputs[i] = 0;
+                continue;
+            }
+            float e = errors[i];
+            float output;
+            if(is_first_time[i]) {
+                output = Kp[i] * e;
+                is_first_time[i] = 0;
+            }
+            else {
+                float integral_step = e * integral_scale;
+                float derivative = (e - prev_error[i]) * derivative_scale;
+                output = Kp[i] * e + Ki[i] * (integral[i] + integral_step) + Kd[i] * derivative;
+                // anti-windup by clamping: a step that ends up clamped doesn't integrate
+                if(output <= out_max && output >= out_min) integral[i] += integral_step;
+            }
+            prev_error[i] = e;
+
+            if(output > out_max) output = out_max;
+            if(output < out_min) output = out_min;
+            outputs[i] = output;
+        }
+    }
+
+    inline float get_period_ms(void) {return period_ms;}
+
+private:
+    float integral[N];
+    float prev_error[N];
+    uint8_t is_first_time[N];
+    float period_ms;         // unit: millisec
+    float integral_scale;    // period in seconds
+    float derivative_scale;  // 1 / period_ms
+    float out_min = -3.4e38f, out_max = 3.4e38f;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef __FIXED_POINT_PID_H_
+#define __FIXED_POINT_PID_H_
+
+#include "pid.hpp"
+#include "incremental_pid.hpp"
+#include "arm_math.h" // q15_t, q31_t, __SSAT, __QADD
+
+/*
+ * Fixed point specializations of PID_Controller<T> and INC_PID_Controller<T>
+ * for T = q15_t (int16_t) and T = q31_t (int32_t).
+ *
+ * Errors and outputs are plain integers in whatever unit the application uses,
+ * e.g. the ESC rpm field in and the int16_t ESC current command out, so the
+ * step runs on the integer pipeline only, no float conversion per step.
+ *
+ * Gains are still given as floats and converted once to Q16.16. The period
+ * goes into the gains in init(), that is
+ *  Ki * period_s   for the integral term
+ *  Kd / period_ms  for the derivative term
+ * so there is no division per step. Same units and formula as the float
+ * controllers, fixed time interval mode only.
+ *
+ * Arithmetic saturates instead of wrapping: every term is saturated to 32bit,
+ * terms are summed with __QADD, a q15_t output is saturated with __SSAT.
+ * The integral term is clamped to +-integral limit (default: the range of T),
+ * which also keeps it from winding up while the output saturates.
+ *
+ * Q16.16 gains range from -32768 to 32767.99998, resolution 1.5e-5, so a
+ * Ki * period_s below that (e.g. Ki < 0.076 at 5kHz) rounds to 0.
+ */
+
+namespace fixed_point {
+    static const int gain_frac_bits = 16;
+
+    inline int32_t saturate_32(int64_t x) {
+        if(x > INT32_MAX) return INT32_MAX;
+        if(x < INT32_MIN) return INT32_MIN;
+        return (int32_t)x;
+    }
+
+    inline int32_t gain_from_float(float gain) {
+        float scaled = gain * (float)(1 << gain_frac_bits);
+        if(scaled >= 2147483520.00f) return INT32_MAX; // largest float below 2^31
+        if(scaled <= -2147483648.00f) return INT32_MIN;
+        return (int32_t)(scaled >= 0 ? scaled + 0.5f : scaled - 0.5f);
+    }
+
+    // Q16.16 gain * integer, rounded, in the integer's unit
+    inline int32_t mul_gain(int32_t gain, int32_t x) {
+        int64_t product = (int64_t)gain * x + (1 << (gain_frac_bits - 1));
+        return saturate_32(product >> gain_frac_bits);
+    }
+
+    template <typename T> T narrow(int32_t x);
+    template <> inline q15_t narrow<q15_t>(int32_t x) {return (q15_t)__SSAT(x, 16);}
+    template <> inline q31_t narrow<q31_t>(int32_t x) {return x;}
+
+    template <typename T> struct range;
+    template <> struct range<q15_t> {static const int32_t max = 32767;};
+    template <> struct range<q31_t> {static const int32_t max = INT32_MAX;};
+}
+
+
+template <typename T, bool Incremental> // T: q15_t or q31_t
+class Fixed_PID_Controller {
+public:
+    Fixed_PID_Controller(float Kp, float Ki, float Kd) {
+        this->period_s = 0.001f;
+        update_pid_consts(Kp, Ki, Kd);
+        set_integral_limit(fixed_point::range<T>::max);
+        reset();
+    }
+
+    // the gains are converted here, changing them takes this call
+    void update_pid_consts(float Kp, float Ki, float Kd) {
+        this->Kp = Kp;
+        this->Ki = Ki;
+        this->Kd = Kd;
+        update_gains();
+    }
+
+    // Fixed time interval mode
+    void init(float frequency_Hz) {
+        this->period_s = 1.00f / frequency_Hz;
+        update_gains();
+        reset();
+    }
+
+    // clamp of the integral term Ki * integral(e), in output units
+    void set_integral_limit(T limit) {
+        int64_t l = (int64_t)limit;
+        if(l < 0) l = -l;
+        this->integral_limit = l << fixed_point::gain_frac_bits;
+    }
+
+    // restart, the next step is a first step again
+    void reset(void) {
+        this->integral = 0;
+        this->prev_error = 0;
+        this->prev_error2 = 0;
+        this->step = 0;
+    }
+
+    inline float get_Kp(void) {return Kp;}
+    inline float get_Ki(void) {return Ki;}
+    inline float get_Kd(void) {return Kd;}
+
+
+    /** calculate the PID output **/
+    //  error(t) = (Desired value at time t) - (Actual value at time t)
+    /* used when there is only one data source for measuring the error  */
+    T calculate(T curr_error) {
+        if(step == 0) {
+            step = 1;
+            prev_error = curr_error;
+            return fixed_point::narrow<T>(fixed_point::mul_gain(kp, curr_error));
+        }
+        int32_t i_term = accumulate_integral(curr_error);
+        int32_t p_term, d_term;
+        if(Incremental) {
+            // e(t-2) is still 0 on the second step
+            int64_t delta = (int64_t)curr_error - prev_error;
+            int64_t delta2 = (int64_t)curr_error - 2 * (int64_t)prev_error + prev_error2;
+            p_term = fixed_point::mul_gain(kp, fixed_point::saturate_32(delta));
+            d_term = fixed_point::mul_gain(kd_per_period, fixed_point::saturate_32(delta2));
+        }
+        else {
+            int64_t delta = (int64_t)curr_error - prev_error;
+            p_term = fixed_point::mul_gain(kp, curr_error);
+            d_term = fixed_point::mul_gain(kd_per_period, fixed_point::saturate_32(delta));
+        }
+        step = 2;
+        prev_error2 = prev_error;
+        prev_error = curr_error;
+        return fixed_point::narrow<T>(__QADD(__QADD(p_term, i_term), d_term));
+    }
+
+    /* used when [error measurement] and [error derivative measurement] come
+       from different data sources, error_rate in error units per millisec  */
+    T calculate(T curr_error, T error_rate) {
+        if(step == 0) {
+            step = 1;
+            prev_error = curr_error;
+            return fixed_point::narrow<T>(fixed_point::mul_gain(kp, curr_error));
+        }
+        int32_t i_term = accumulate_integral(curr_error);
+        int32_t p_term = fixed_point::mul_gain(kp, curr_error);
+        int32_t d_term = fixed_point::mul_gain(kd, error_rate);
+        return fixed_point::narrow<T>(__QADD(__QADD(p_term, i_term), d_term));
+    }
+
+    /* used when [error], [error derivative] and [error integral]
+       all have their respective way of measuring directly */
+    T calculate(T curr_error, T error_rate, T error_sum) {
+        int32_t p_term = fixed_point::mul_gain(kp, curr_error);
+        int32_t i_term = fixed_point::mul_gain(ki, error_sum);
+        int32_t d_term = fixed_point::mul_gain(kd, error_rate);
+        return fixed_point::narrow<T>(__QADD(__QADD(p_term, i_term), d_term));
+    }
+
+private:
+    float Kp, Ki, Kd;
+    float period_s;
+
+    /* Q16.16 */
+    int32_t kp, ki, kd;
+    int32_t ki_period;     // Ki * period_s
+    int32_t kd_per_period; // Kd / period_ms
+
+    int64_t integral;       // Ki * integral(e), output units in Q.16
+    int64_t integral_limit; // same unit
+    T prev_error, prev_error2;
+    uint8_t step;           // 0: first step, 1: second step, 2: any later step
+
+    void update_gains(void) {
+        kp = fixed_point::gain_from_float(Kp);
+        ki = fixed_point::gain_from_float(Ki);
+        kd = fixed_point::gain_from_float(Kd);
+        ki_period = fixed_point::gain_from_float(Ki * period_s);
+        kd_per_period = fixed_point::gain_from_float(Kd / (period_s * 1000.00f));
+    }
+
+    // returns the clamped integral term in output units
+    int32_t accumulate_integral(T curr_error) {
+        integral += (int64_t)ki_period * curr_error;
+        if(integral > integral_limit) integral = integral_limit;
+        if(integral < -integral_limit) integral = -integral_limit;
+        return fixed_point::saturate_32(integral >> fixed_point::gain_frac_bits);
+    }
+};
+
+
+/* fixed point instantiations of the generic controllers */
+
+template <>
+class PID_Controller<q15_t> : public Fixed_PID_Controller<q15_t, false> {
+public:
+    PID_Controller(float Kp, float Ki, float Kd) : Fixed_PID_Controller<q15_t, false>(Kp, Ki, Kd) {}
+};
+
+template <>
+class PID_Controller<q31_t> : public Fixed_PID_Controller<q31_t, false> {
+public:
+    PID_Controller(float Kp, float Ki, float Kd) : Fixed_PID_Controller<q31_t, false>(Kp, Ki, Kd) {}
+};
+
+template <>
+class INC_PID_Controller<q15_t> : public Fixed_PID_Controller<q15_t, true> {
+public:
+    INC_PID_Controller(float Kp, float Ki, float Kd) : Fixed_PID_Controller<q15_t, true>(Kp, Ki, Kd) {}
+};
+
+template <>
+class INC_PID_Controller<q31_t> : public Fixed_PID_Controller<q31_t, true> {
+public:
+    INC_PID_Controller(float Kp, float Ki, float Kd) : Fixed_PID_Controller<q31_t, true>(Kp, Ki, Kd) {}
+};
+
+#endif
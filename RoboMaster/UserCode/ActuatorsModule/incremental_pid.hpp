@@ -1,10 +1,19 @@
 /* Author: Hector Montenegro */
 
-#ifndef __PID_H_
-#define __PID_H_
+#ifndef __INC_PID_H_
+#define __INC_PID_H_
 
 #include <iostream>
 
+/* clamps x to [lo, hi], true if it had to. Output limits of INC_PID_Controller<T>
+ * go through this, a vector type needs its own overload (e.g. per component) */
+template <class T>
+inline bool pid_clamp(T& x, T lo, T hi) {
+    if(x > hi) {x = hi; return true;}
+    if(x < lo) {x = lo; return true;}
+    return false;
+}
+
 template <class T> // This PID code can handle (math)vector value
 class INC_PID_Controller {
 
@@ -72,6 +81,17 @@ class INC_PID_Controller {
      *  The scaling is generally arbitrary because it's linear formular and the constant is determined
      *  by hand based on experimenting results.
      *
+     *  Optional extras, all off by default:
+     *   output limits (set_output_limits): the output is clamped, and the integral
+     *     stops accumulating while it is (anti-windup by clamping), so a long
+     *     saturation, e.g. a wheel pushing against a wall, doesn't leave behind an
+     *     integral that overshoots for as long as it takes to unwind.
+     *   derivative filter (set_derivative_filter): first order low pass on the
+     *     derivative term, keeps measurement noise from going straight to the output.
+     *   feed-forward (calculate_ff): Kff_vel * reference velocity + Kff_acc * reference
+     *     acceleration added to the output, the part of the response that is known in
+     *     advance so the loop only has to correct the rest.
+     *
      *  When we say "tuning the pid", it means to determine the pid constants Kp, Ki, Kd by experiments.
      *  A general rule-of-thumb procedure for tuning pid constants:
      *   1. first, try different Kp values of variouse scale, and nailed it at a specific
@@ -93,6 +113,8 @@ class INC_PID_Controller {
 public:
     // proportional, integral and derivative constants
     float Kp, Ki, Kd;
+    // feed-forward constants, see calculate_ff()
+    float Kff_vel = 0, Kff_acc = 0;
 
     INC_PID_Controller(float Kp, float Ki, float Kd) {
         this->Kp = Kp;
@@ -100,6 +122,19 @@ public:
         this->Kd = Kd;
     }
 
+    /* clamps the output of calculate(curr_error), calculate(curr_error, error_rate)
+     * and calculate_ff(), and holds the integral while clamped */
+    void set_output_limits(T out_min, T out_max) {
+        this->out_min = out_min;
+        this->out_max = out_max;
+        this->has_output_limits = true;
+    }
+
+    // cutoff frequency of the low pass on the derivative term, 0 turns it off
+    void set_derivative_filter(float cutoff_Hz) {
+        this->derivative_cutoff_Hz = cutoff_Hz;
+    }
+
     void update_pid_consts(float Kp, float Ki, float Kd) {
         this->Kp = Kp;
         this->Ki = Ki;
@@ -108,8 +143,9 @@ public:
 
     // Fixed time interval mode, often coupled with a timer callback
     void init(float frequency_Hz) {
-        this->period_ms = (1.00 / frequency_Hz) * 1000.00;
+        this->period_ms = 1000.00f / frequency_Hz;
         this->is_first_time = true;
+        this->is_second_time = true;
         this->is_fixed_time_interval = true;
     }
 
@@ -117,6 +153,7 @@ public:
     void init(float (*millis)(void)) {
         this->millis_func = millis;
         this->is_first_time = true;
+        this->is_second_time = true;
         this->is_fixed_time_interval = false;
     }
 
@@ -125,16 +162,15 @@ public:
     //  error(t) = (Desired value at time t) - (Actual value at time t)
     /* used when there is only one data source for measuring the error  */
     T calculate(T curr_error) {
-        if(is_first_time) return first_time_handle(curr_error);
-        if (is_second_time) return second_time_handle(curr_error);
-//        if (is_third_time) return third_time_handle(curr_error);
-        float period = get_period();
-        T derivative = (curr_error - 2*prev_error + prev_error2) / period;
-        this->integral += curr_error * period / 1000.000; // scale Ki to be in similar range constants
-        T output = (Kp * (curr_error - prev_error)) + (Ki * integral) + (Kd * derivative);
-        prev_error2 = prev_error;
-        prev_error = curr_error;
-        return output;
+        T output = pid_step(curr_error);
+        return limit_output(output);
+    }
+
+    /* with feed-forward of the reference (setpoint) motion: velocity and acceleration
+       of the desired value, e.g. from a motion profile */
+    T calculate_ff(T curr_error, T ref_velocity, T ref_acceleration) {
+        T output = pid_step(curr_error) + (Kff_vel * ref_velocity) + (Kff_acc * ref_acceleration);
+        return limit_output(output);
     }
 
     /* methods below are normally used when there exists
@@ -145,12 +181,13 @@ public:
     /* used when [error measurement] and [error derivative measurement] come
        from different data sources  */
     T calculate(T curr_error, T error_rate) {
-        if(is_first_time) return first_time_handle(curr_error);
+        if(is_first_time) return limit_output(first_time_handle(curr_error));
         float period = get_period();
         T derivative = (curr_error - prev_error) / period;
-        this->integral += curr_error * period / 1000.000;
+        this->integral_step = curr_error * (period / 1000.00f);
+        this->integral += integral_step;
         T output = (Kp * curr_error) + (Kd * error_rate) + (Ki * integral);
-        return output;
+        return limit_output(output);
     }
 
     /* used when [error] and [error integral] both
@@ -177,13 +214,35 @@ private:
     bool is_first_time, is_second_time, is_third_time;
     bool is_fixed_time_interval;
     T integral;
+    T integral_step; // added to the integral by the latest step
+    T filtered_derivative;
+    float derivative_cutoff_Hz = 0;
+    bool has_output_limits = false;
+    T out_min, out_max;
     T prev_error, prev_error2;
     float period_ms; //unit: millisec
     float prev_time_ms; // unit: millisec
     float (*millis_func)(void);
 
+    // the step of calculate(curr_error), before limits and feed-forward
+    T pid_step(T curr_error) {
+        if(is_first_time) return first_time_handle(curr_error);
+        if (is_second_time) return second_time_handle(curr_error);
+//        if (is_third_time) return third_time_handle(curr_error);
+        float period = get_period();
+        T derivative = filter_derivative((curr_error - 2*prev_error + prev_error2) / period, period);
+        this->integral_step = curr_error * (period / 1000.00f); // scale Ki to be in similar range constants
+        this->integral += integral_step;
+        T output = (Kp * (curr_error - prev_error)) + (Ki * integral) + (Kd * derivative);
+        prev_error2 = prev_error;
+        prev_error = curr_error;
+        return output;
+    }
+
     T first_time_handle(T curr_error) {
         this->integral = curr_error - curr_error; // a workaround to get zero/zero_vector of a generic type
+        this->integral_step = integral;
+        this->filtered_derivative = integral;
         this->prev_error = curr_error;
         this->is_first_time = false;
         return Kp * curr_error;
@@ -191,8 +250,9 @@ private:
 
     T second_time_handle(T curr_error) {
 		float period = get_period();
-		this->integral += curr_error * period / 1000.000;
-		T derivative = (curr_error - 2*prev_error) / period;
+		this->integral_step = curr_error * (period / 1000.00f);
+		this->integral += integral_step;
+		T derivative = filter_derivative((curr_error - 2*prev_error) / period, period);
 		T output = (Kp * (curr_error - prev_error)) + (Ki * integral) + (Kd * derivative);
 		this->prev_error2 = prev_error;
 		this->prev_error = curr_error;
@@ -200,6 +260,24 @@ private:
 		return output;
 	}
 
+    // anti-windup by clamping: a step that ends up clamped doesn't integrate
+    T limit_output(T output) {
+        if(has_output_limits && pid_clamp(output, out_min, out_max)) {
+            this->integral -= integral_step;
+            this->integral_step = integral_step - integral_step;
+        }
+        return output;
+    }
+
+    // first order low pass, time constant 1 / (2*pi*cutoff), period in millisec
+    T filter_derivative(T derivative, float period) {
+        if(derivative_cutoff_Hz <= 0) return derivative;
+        float rc_ms = 1000.00f / (2.00f * 3.14159265f * derivative_cutoff_Hz);
+        float alpha = period / (rc_ms + period);
+        this->filtered_derivative = filtered_derivative + (derivative - filtered_derivative) * alpha;
+        return filtered_derivative;
+    }
+
     float get_period() {
         if(this->is_fixed_time_interval) {
             return this->period_ms;
@@ -111,7 +111,7 @@ public:
 
     // Fixed time interval mode, often coupled with a timer callback
     void init(float frequency_Hz) {
-        this->period_ms = (1.00 / frequency_Hz) * 1000.00;
+        this->period_ms = 1000.00f / frequency_Hz;
         this->is_first_time = true;
         this->is_fixed_time_interval = true;
     }
@@ -131,7 +131,7 @@ public:
         if(is_first_time) return first_time_handle(curr_error);
         float period = get_period();
         T derivative = (curr_error - prev_error) / period;
-        this->integral += curr_error * period / 1000.000; // scale Ki to be in similar range constants
+        this->integral += curr_error * (period / 1000.00f); // scale Ki to be in similar range constants
         T output = (Kp * curr_error) + (Kd * derivative) + (Ki * integral);
         prev_error = curr_error;
         return output;
@@ -147,7 +147,7 @@ public:
     T calculate(T curr_error, T error_rate) {
         if(is_first_time) return first_time_handle(curr_error);
         float period = get_period();
-        this->integral += curr_error * period / 1000.000;
+        this->integral += curr_error * (period / 1000.00f);
         T output = (Kp * curr_error) + (Kd * error_rate) + (Ki * integral);
         return output;
     }
@@ -0,0 +1,173 @@
+/*
+ * can_filter.cpp
+ */
+
+#include "can_filter.hpp"
+
+static uint32_t num_filters = 0;
+static CAN_Filter filters[Max_Num_CAN_Filters];
+
+static const uint32_t std_id_mask = 0x7FF;
+static const uint32_t slave_start_filter_bank = 14;
+
+/* 16-bit filter register layout: STID[10:0] RTR IDE EXID[17:15],
+ * masking RTR and IDE in as well keeps remote and extended frames out */
+static inline uint16_t filter_id_16bit(uint32_t std_id) {return (uint16_t)((std_id & std_id_mask) << 5);}
+static inline uint16_t filter_mask_16bit(uint32_t mask) {return (uint16_t)(((mask & std_id_mask) << 5) | 0x18);}
+
+CAN_Filter* CAN_Filter::of(CAN_HandleTypeDef *hcanx) {
+	for(uint32_t i = 0; i < num_filters; i++) {
+		if(filters[i].get_hcanx() == hcanx) return &filters[i];
+	}
+	if(num_filters >= Max_Num_CAN_Filters) {
+		stf::exception("CAN_Filter: too many CAN buses");
+		return NULL;
+	}
+	CAN_Filter *filter = &filters[num_filters];
+	filter->hcanx = hcanx;
+	filter->first_bank = (hcanx->Instance == CAN1) ? 0 : slave_start_filter_bank;
+	num_filters++;
+	return filter;
+}
+
+bool CAN_Filter::add_mask(uint32_t std_id, uint32_t mask, rx_fifo fifo) {
+	mask &= std_id_mask;
+	for(uint32_t i = 0; i < num_entries; i++) {
+		// registered already, e.g. by another driver on the same bus
+		if(entries[i].mask == mask && entries[i].std_id == (std_id & mask) && entries[i].fifo == fifo) return true;
+	}
+	if(num_entries >= CAN_Filter_Max_Entries) {
+		stf::exception("CAN_Filter: too many filter entries");
+		return false;
+	}
+	entries[num_entries].std_id = (uint16_t)(std_id & mask);
+	entries[num_entries].mask = (uint16_t)mask;
+	entries[num_entries].fifo = fifo;
+	num_entries++;
+	return true;
+}
+
+bool CAN_Filter::add_id(uint32_t std_id, rx_fifo fifo) {
+	return add_mask(std_id, std_id_mask, fifo);
+}
+
+bool CAN_Filter::add_range(uint32_t first_std_id, uint32_t last_std_id, rx_fifo fifo) {
+	if(last_std_id > std_id_mask) last_std_id = std_id_mask;
+	uint32_t id = first_std_id;
+	while(id <= last_std_id) {
+		// largest aligned block starting at id that doesn't go past the range
+		uint32_t size = 1;
+		while((id & (size * 2 - 1)) == 0 && id + size * 2 - 1 <= last_std_id) size *= 2;
+		if(size <= 2) {
+			// 2 exact IDs take as much room as 1 id/mask pair and fill list banks up better
+			for(uint32_t k = 0; k < size; k++) {
+				if(!add_id(id + k, fifo)) return false;
+			}
+		}
+		else if(!add_mask(id, ~(size - 1), fifo)) return false;
+		id += size;
+	}
+	return true;
+}
+
+uint32_t CAN_Filter::count_banks(rx_fifo fifo) {
+	uint32_t num_ids = 0, num_masks = 0;
+	for(uint32_t i = 0; i < num_entries; i++) {
+		if(entries[i].fifo != fifo) continue;
+		if(entries[i].mask == std_id_mask) num_ids++;
+		else num_masks++;
+	}
+	return (num_ids + 3) / 4 + (num_masks + 1) / 2;
+}
+
+bool CAN_Filter::apply(void) {
+	uint32_t num_banks = count_banks(FIFO0) + count_banks(FIFO1);
+	if(num_banks > CAN_Filter_Num_Banks) {
+		stf::exception("CAN_Filter: out of filter banks, accepting all frames");
+		config_accept_all();
+		return false;
+	}
+
+	uint32_t bank = first_bank;
+	const rx_fifo fifos[2] = {FIFO0, FIFO1};
+	for(int f = 0; f < 2; f++) {
+		uint16_t regs[4];
+		uint32_t n;
+
+		// exact IDs, 4 per list bank, a partly used bank repeats its first ID
+		n = 0;
+		for(uint32_t i = 0; i < num_entries; i++) {
+			if(entries[i].fifo != fifos[f] || entries[i].mask != std_id_mask) continue;
+			regs[n++] = filter_id_16bit(entries[i].std_id);
+			if(n == 4) {
+				config_bank(bank++, CAN_FILTERMODE_IDLIST, fifos[f], regs);
+				n = 0;
+			}
+		}
+		if(n > 0) {
+			for(uint32_t k = n; k < 4; k++) regs[k] = regs[0];
+			config_bank(bank++, CAN_FILTERMODE_IDLIST, fifos[f], regs);
+		}
+
+		// id/mask pairs, 2 per mask bank: regs = {id, mask, id, mask}
+		n = 0;
+		for(uint32_t i = 0; i < num_entries; i++) {
+			if(entries[i].fifo != fifos[f] || entries[i].mask == std_id_mask) continue;
+			regs[n++] = filter_id_16bit(entries[i].std_id);
+			regs[n++] = filter_mask_16bit(entries[i].mask);
+			if(n == 4) {
+				config_bank(bank++, CAN_FILTERMODE_IDMASK, fifos[f], regs);
+				n = 0;
+			}
+		}
+		if(n > 0) {
+			regs[2] = regs[0];
+			regs[3] = regs[1];
+			config_bank(bank++, CAN_FILTERMODE_IDMASK, fifos[f], regs);
+		}
+	}
+
+	// banks left over from a previous apply() or the accept-all fallback
+	uint32_t used = bank - first_bank;
+	CAN_FilterTypeDef filter_config = {};
+	filter_config.FilterActivation = DISABLE;
+	filter_config.SlaveStartFilterBank = slave_start_filter_bank;
+	for(uint32_t b = used; b < num_banks_used; b++) {
+		filter_config.FilterBank = first_bank + b;
+		HAL_CAN_ConfigFilter(hcanx, &filter_config);
+	}
+	num_banks_used = used;
+	return true;
+}
+
+/* regs in list mode: 4 IDs, in mask mode: id, mask, id, mask */
+void CAN_Filter::config_bank(uint32_t bank, uint32_t mode, rx_fifo fifo, const uint16_t regs[4]) {
+	CAN_FilterTypeDef filter_config;
+	filter_config.FilterBank = bank;
+	filter_config.FilterMode = mode;
+	filter_config.FilterScale = CAN_FILTERSCALE_16BIT;
+	// FR1 = FilterMaskIdLow:FilterIdLow, FR2 = FilterMaskIdHigh:FilterIdHigh
+	filter_config.FilterIdLow = regs[0];
+	filter_config.FilterMaskIdLow = regs[1];
+	filter_config.FilterIdHigh = regs[2];
+	filter_config.FilterMaskIdHigh = regs[3];
+	filter_config.FilterFIFOAssignment = fifo;
+	filter_config.FilterActivation = ENABLE;
+	filter_config.SlaveStartFilterBank = slave_start_filter_bank;
+	HAL_CAN_ConfigFilter(hcanx, &filter_config);
+}
+
+// the old all-zero mask, better than losing the frames of a driver
+void CAN_Filter::config_accept_all(void) {
+	const uint16_t regs[4] = {0, 0, 0, 0};
+	config_bank(first_bank, CAN_FILTERMODE_IDMASK, FIFO0, regs);
+
+	CAN_FilterTypeDef filter_config = {};
+	filter_config.FilterActivation = DISABLE;
+	filter_config.SlaveStartFilterBank = slave_start_filter_bank;
+	for(uint32_t b = 1; b < num_banks_used; b++) {
+		filter_config.FilterBank = first_bank + b;
+		HAL_CAN_ConfigFilter(hcanx, &filter_config);
+	}
+	num_banks_used = 1;
+}
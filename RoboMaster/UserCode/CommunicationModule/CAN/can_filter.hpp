@@ -0,0 +1,77 @@
+/*
+ * can_filter.hpp
+ *
+ * Hardware acceptance filter allocator of a bxCAN bus.
+ *
+ * Drivers register the standard IDs they want (single IDs, ranges or raw
+ * id/mask pairs) and the Rx FIFO they read them from, apply() packs them into
+ * the bus' filter banks so that nothing else raises an Rx interrupt.
+ *
+ * All banks are 16-bit scale, which is the densest for standard IDs:
+ * a list bank holds 4 exact IDs, a mask bank holds 2 id/mask pairs.
+ * A range is split into aligned power of 2 blocks (e.g. 0x201~0x20A ->
+ * 0x201, 0x202~0x203, 0x204~0x207, 0x208~0x209, 0x20A), blocks of 4 or more go
+ * to mask banks and the rest to list banks as exact IDs, so a range never lets
+ * through an ID outside of it.
+ * Only data frames with standard IDs pass.
+ *
+ * CAN1 owns banks 0~13, CAN2 banks 14~27 (SlaveStartFilterBank = 14).
+ * A driver reading from FIFO1 must activate CAN_IT_RX_FIFO1_MSG_PENDING and
+ * implement HAL_CAN_RxFifo1MsgPendingCallback itself.
+ */
+
+#ifndef CAN_FILTER_HPP_
+#define CAN_FILTER_HPP_
+
+#include "stf.h"
+
+#define Max_Num_CAN_Filters 2
+#define CAN_Filter_Num_Banks 14                        // per bus
+#define CAN_Filter_Max_Entries (CAN_Filter_Num_Banks * 4)
+
+class CAN_Filter {
+public:
+	enum rx_fifo : int {
+		FIFO0 = CAN_FILTER_FIFO0,
+		FIFO1 = CAN_FILTER_FIFO1
+	};
+
+	CAN_Filter(void) {}
+
+	/* registration, takes effect at the next apply(), false if the table is full */
+	bool add_id(uint32_t std_id, rx_fifo fifo = FIFO0);
+	// first ~ last inclusive
+	bool add_range(uint32_t first_std_id, uint32_t last_std_id, rx_fifo fifo = FIFO0);
+	// accepts ID where (ID & mask) == (std_id & mask)
+	bool add_mask(uint32_t std_id, uint32_t mask, rx_fifo fifo = FIFO0);
+
+	/* (re)writes the filter banks, can be called while the bus is running.
+	 * If the entries don't fit, falls back to accepting everything into FIFO0 */
+	bool apply(void);
+
+	inline uint32_t get_num_banks_used(void) {return num_banks_used;}
+	inline uint32_t get_num_entries(void) {return num_entries;}
+	inline CAN_HandleTypeDef *get_hcanx(void) {return hcanx;}
+
+	/* filter of a bus, created on first use */
+	static CAN_Filter* of(CAN_HandleTypeDef *hcanx);
+
+private:
+	struct filter_entry {
+		uint16_t std_id;
+		uint16_t mask; // 0x7FF is an exact ID
+		rx_fifo fifo;
+	};
+
+	CAN_HandleTypeDef *hcanx = NULL;
+	uint32_t first_bank = 0;
+	filter_entry entries[CAN_Filter_Max_Entries];
+	uint32_t num_entries = 0;
+	uint32_t num_banks_used = 0;
+
+	uint32_t count_banks(rx_fifo fifo);
+	void config_bank(uint32_t bank, uint32_t mode, rx_fifo fifo, const uint16_t regs[4]);
+	void config_accept_all(void);
+};
+
+#endif /* CAN_FILTER_HPP_ */
@@ -0,0 +1,202 @@
+/*
+ * can_health.cpp
+ */
+
+#include "can_health.hpp"
+
+static uint32_t num_health_monitors = 0;
+static CAN_Health health_monitors[Max_Num_CAN_Health_Monitors];
+
+static const uint32_t protocol_error_mask = HAL_CAN_ERROR_STF | HAL_CAN_ERROR_FOR | HAL_CAN_ERROR_ACK |
+                                            HAL_CAN_ERROR_BR | HAL_CAN_ERROR_BD | HAL_CAN_ERROR_CRC;
+static const uint32_t tx_error_flags[6] = {HAL_CAN_ERROR_TX_ALST0, HAL_CAN_ERROR_TX_TERR0,
+                                           HAL_CAN_ERROR_TX_ALST1, HAL_CAN_ERROR_TX_TERR1,
+                                           HAL_CAN_ERROR_TX_ALST2, HAL_CAN_ERROR_TX_TERR2};
+
+CAN_Health* CAN_Health::of(CAN_HandleTypeDef *hcanx) {
+	for(uint32_t i = 0; i < num_health_monitors; i++) {
+		if(health_monitors[i].get_hcanx() == hcanx) return &health_monitors[i];
+	}
+	if(num_health_monitors >= Max_Num_CAN_Health_Monitors) {
+		stf::exception("CAN_Health: too many CAN buses");
+		return NULL;
+	}
+	CAN_Health *health = &health_monitors[num_health_monitors];
+	health->hcanx = hcanx;
+	num_health_monitors++;
+	return health;
+}
+
+void CAN_Health::init(void) {
+	stf::enable_cycle_counter(); // for last seen ages and recovery time
+	if(!(READ_REG(hcanx->Instance->MCR) & CAN_MCR_ABOM)) {
+		stf::exception("CAN_Health: automatic bus-off management is disabled, bus-off won't recover");
+	}
+	state = read_state();
+	HAL_CAN_ActivateNotification(hcanx, CAN_IT_ERROR_WARNING | CAN_IT_ERROR_PASSIVE | CAN_IT_BUSOFF |
+	                                    CAN_IT_LAST_ERROR_CODE | CAN_IT_ERROR | CAN_IT_RX_FIFO0_OVERRUN);
+}
+
+CAN_Health::bus_state CAN_Health::read_state(void) {
+	uint32_t esr = READ_REG(hcanx->Instance->ESR);
+	if(esr & CAN_ESR_BOFF) return Bus_Off;
+	if(esr & CAN_ESR_EPVF) return Error_Passive;
+	if(esr & CAN_ESR_EWGF) return Error_Warning;
+	return Error_Active;
+}
+
+void CAN_Health::sample(void) {
+	uint32_t now = stf::cycles();
+	uint32_t errors = protocol_errors;
+	uint32_t frames = rx_frames;
+
+	if(sample_cycles != 0) {
+		float dt_s = stf::cycles_to_us(now - sample_cycles) / 1000000.00f;
+		if(dt_s <= 0) return;
+		protocol_error_rate = (errors - protocol_errors_prev) / dt_s;
+		rx_frame_rate = (frames - rx_frames_prev) / dt_s;
+		for(uint32_t i = 0; i < num_ids; i++) {
+			uint32_t id_frames = ids[i].frames;
+			ids[i].frame_rate = (id_frames - ids[i].frames_prev) / dt_s;
+			ids[i].frames_prev = id_frames;
+		}
+	}
+	else {
+		for(uint32_t i = 0; i < num_ids; i++) ids[i].frames_prev = ids[i].frames;
+	}
+	protocol_errors_prev = errors;
+	rx_frames_prev = frames;
+	sample_cycles = now;
+}
+
+CAN_Health::bus_stats CAN_Health::get_stats(void) {
+	bus_stats stats;
+	uint32_t esr = READ_REG(hcanx->Instance->ESR);
+	stats.state = read_state();
+	stats.tec = (uint8_t)((esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos);
+	stats.rec = (uint8_t)((esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos);
+	stats.last_error_code = last_error_code;
+	stats.error_warning_cnt = error_warning_cnt;
+	stats.error_passive_cnt = error_passive_cnt;
+	stats.bus_off_cnt = bus_off_cnt;
+	stats.protocol_errors = protocol_errors;
+	stats.ack_errors = ack_errors;
+	stats.tx_errors = tx_errors;
+	stats.rx_overruns = rx_overruns;
+	stats.rx_frames = rx_frames;
+	stats.protocol_error_rate = protocol_error_rate;
+	stats.rx_frame_rate = rx_frame_rate;
+	stats.bus_off_recovery_us = bus_off_recovery_us;
+	stats.bus_off_recovery_max_us = bus_off_recovery_max_us;
+	return stats;
+}
+
+bool CAN_Health::get_id_stats(uint32_t std_id, id_stats& stats) {
+	for(uint32_t i = 0; i < num_ids; i++) {
+		if(ids[i].std_id != std_id) continue;
+		stats.std_id = std_id;
+		stats.frames = ids[i].frames;
+		stats.frame_rate = ids[i].frame_rate;
+		stats.last_seen_age_us = stf::cycles_to_us(stf::cycles() - ids[i].last_cycles);
+		return true;
+	}
+	return false;
+}
+
+// counters touched by the interrupts may miss an increment while being reset
+void CAN_Health::reset_stats(void) {
+	error_warning_cnt = 0;
+	error_passive_cnt = 0;
+	bus_off_cnt = 0;
+	protocol_errors = 0;
+	ack_errors = 0;
+	tx_errors = 0;
+	rx_overruns = 0;
+	rx_frames = 0;
+	bus_off_recovery_us = 0;
+	bus_off_recovery_max_us = 0;
+	for(uint32_t i = 0; i < num_ids; i++) ids[i].frames = 0;
+	sample_cycles = 0;
+}
+
+
+/*** interrupt side ***/
+
+/* ESR only has level flags and nothing fires when the counters go back down,
+ * so the state is re-read on every error and every received frame */
+void CAN_Health::update_state(void) {
+	bus_state new_state = read_state();
+	if(new_state == state) return;
+
+	if(new_state >= Error_Warning && state < Error_Warning) error_warning_cnt++;
+	if(new_state >= Error_Passive && state < Error_Passive) error_passive_cnt++;
+	if(new_state == Bus_Off) {
+		bus_off_cnt++;
+		bus_off_cycles = stf::cycles();
+		/* whatever waits in a mailbox would go out ~1.4ms late once the bus is back,
+		 * drop it so the Tx queue refills with the newest commands instead.
+		 * Same priority as the Tx interrupt, so the Tx queue refill can't be interrupted by this */
+		HAL_CAN_AbortTxRequest(hcanx, CAN_TX_MAILBOX0 | CAN_TX_MAILBOX1 | CAN_TX_MAILBOX2);
+	}
+	if(state == Bus_Off) {
+		float recovery_us = stf::cycles_to_us(stf::cycles() - bus_off_cycles);
+		bus_off_recovery_us = recovery_us;
+		if(recovery_us > bus_off_recovery_max_us) bus_off_recovery_max_us = recovery_us;
+	}
+	state = new_state;
+}
+
+void CAN_Health::interrupt_task_error(uint32_t hal_error_code) {
+	if(hal_error_code & protocol_error_mask) {
+		protocol_errors++;
+		if(hal_error_code & HAL_CAN_ERROR_STF) last_error_code = 1;
+		else if(hal_error_code & HAL_CAN_ERROR_FOR) last_error_code = 2;
+		else if(hal_error_code & HAL_CAN_ERROR_ACK) last_error_code = 3;
+		else if(hal_error_code & HAL_CAN_ERROR_BR) last_error_code = 4;
+		else if(hal_error_code & HAL_CAN_ERROR_BD) last_error_code = 5;
+		else last_error_code = 6;
+		if(hal_error_code & HAL_CAN_ERROR_ACK) ack_errors++;
+	}
+	for(int i = 0; i < 6; i++) {
+		if(hal_error_code & tx_error_flags[i]) tx_errors++;
+	}
+	if(hal_error_code & (HAL_CAN_ERROR_RX_FOV0 | HAL_CAN_ERROR_RX_FOV1)) rx_overruns++;
+
+	update_state();
+}
+
+void CAN_Health::interrupt_task_rx(uint32_t std_id) {
+	uint32_t now = stf::cycles();
+	rx_frames++;
+	if(state != Error_Active) update_state(); // a frame coming in is the first sign of recovery
+
+	uint32_t i;
+	for(i = 0; i < num_ids; i++) {
+		if(ids[i].std_id == std_id) break;
+	}
+	if(i == num_ids) {
+		if(num_ids >= CAN_Health_Max_IDs) return; // still counted in rx_frames
+		ids[i].std_id = std_id;
+		ids[i].frames = 0;
+		ids[i].frames_prev = 0;
+		ids[i].frame_rate = 0;
+		num_ids = num_ids + 1;
+	}
+	ids[i].frames++;
+	ids[i].last_cycles = now;
+}
+
+
+/*** interrupt handler callbacks ***/
+
+// error interrupts (SCE), FIFO overrun (Rx) and Tx mailbox failures (Tx) all end up here
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan) {
+	for(uint32_t i = 0; i < num_health_monitors; i++) {
+		if(health_monitors[i].get_hcanx() == hcan) {
+			health_monitors[i].interrupt_task_error(hcan->ErrorCode);
+			break;
+		}
+	}
+	// HAL only ever ORs into ErrorCode
+	HAL_CAN_ResetError(hcan);
+}
@@ -0,0 +1,119 @@
+/*
+ * can_health.hpp
+ *
+ * Error state monitor of a bxCAN bus.
+ *
+ * The CAN error/status change (SCE) interrupt reports error frames (ESR.LEC),
+ * the transitions to error warning / error passive / bus-off, and the Rx
+ * interrupt reports FIFO overruns, all through HAL_CAN_ErrorCallback().
+ * Every received frame is counted per StdId, so a flaky ESC connector shows
+ * up as a low frame rate or a growing last seen age of that ID.
+ *
+ * Bus-off recovery relies on automatic bus-off management (ABOM): bxCAN
+ * rejoins by itself after 128 x 11 recessive bits (~1.4ms at 1Mbps). When
+ * entering bus-off the pending Tx mailboxes are aborted, so the first frames
+ * out after recovery are the newest commands from the Tx queue, not stale ones.
+ *
+ * sample() computes the rates, call it periodically from a task.
+ *
+ * CubeMx generated CANx_SCE_IRQHandler must call HAL_CAN_IRQHandler(&hcanx),
+ * at the same priority as CANx_TX_IRQHandler
+ */
+
+#ifndef CAN_HEALTH_HPP_
+#define CAN_HEALTH_HPP_
+
+#include "stf.h"
+
+#define Max_Num_CAN_Health_Monitors 2
+#define CAN_Health_Max_IDs 16 // distinct StdIds tracked per bus
+
+class CAN_Health {
+public:
+	enum bus_state : int {
+		Error_Active = 0,
+		Error_Warning = 1, // TEC or REC >= 96
+		Error_Passive = 2, // TEC or REC >= 128
+		Bus_Off = 3        // TEC > 255, not transmitting or receiving
+	};
+
+	struct bus_stats {
+		bus_state state;
+		uint8_t tec;             // transmit error counter
+		uint8_t rec;             // receive error counter
+		uint8_t last_error_code; // ESR.LEC of the latest error frame: 1 stuff, 2 form, 3 ack, 4 bit recessive, 5 bit dominant, 6 crc
+		uint32_t error_warning_cnt; // number of times the state went up to ...
+		uint32_t error_passive_cnt;
+		uint32_t bus_off_cnt;
+		uint32_t protocol_errors;   // error frames detected
+		uint32_t ack_errors;        // of which nobody acknowledged, e.g. ESCs unpowered or unplugged
+		uint32_t tx_errors;         // Tx mailbox arbitration lost / transmit error
+		uint32_t rx_overruns;       // FIFO0 full, frames lost
+		uint32_t rx_frames;
+		float protocol_error_rate;  // per second, over the last sample() window
+		float rx_frame_rate;
+		float bus_off_recovery_us;  // bus-off -> first frame received again, latest
+		float bus_off_recovery_max_us;
+	};
+
+	struct id_stats {
+		uint32_t std_id;
+		uint32_t frames;
+		float frame_rate;       // Hz, over the last sample() window
+		float last_seen_age_us; // time since the latest frame with this StdId
+	};
+
+	CAN_Health(void) {}
+
+	// error interrupts, call once the bus is started
+	void init(void);
+
+	// ESR counters and rates, call periodically from a task
+	void sample(void);
+
+	bus_stats get_stats(void);
+	// false if no frame with this StdId was received yet
+	bool get_id_stats(uint32_t std_id, id_stats& stats);
+	void reset_stats(void);
+
+	inline CAN_HandleTypeDef *get_hcanx(void) {return hcanx;}
+
+	/* monitor of a bus, created on first use */
+	static CAN_Health* of(CAN_HandleTypeDef *hcanx);
+
+	/* interrupt side, do not call elsewhere */
+	void interrupt_task_error(uint32_t hal_error_code);
+	void interrupt_task_rx(uint32_t std_id);
+
+private:
+	struct id_counter {
+		uint32_t std_id;
+		volatile uint32_t frames;
+		volatile uint32_t last_cycles;
+		uint32_t frames_prev; // at the previous sample()
+		float frame_rate;
+	};
+
+	CAN_HandleTypeDef *hcanx = NULL;
+
+	id_counter ids[CAN_Health_Max_IDs];
+	volatile uint32_t num_ids = 0; // only grows, written by the interrupt
+
+	/* written by the interrupts */
+	volatile bus_state state = Error_Active;
+	volatile uint8_t last_error_code = 0;
+	volatile uint32_t error_warning_cnt = 0, error_passive_cnt = 0, bus_off_cnt = 0;
+	volatile uint32_t protocol_errors = 0, ack_errors = 0, tx_errors = 0, rx_overruns = 0, rx_frames = 0;
+	volatile uint32_t bus_off_cycles = 0;
+	volatile float bus_off_recovery_us = 0, bus_off_recovery_max_us = 0;
+
+	/* written by sample() */
+	uint32_t sample_cycles = 0;
+	uint32_t protocol_errors_prev = 0, rx_frames_prev = 0;
+	float protocol_error_rate = 0, rx_frame_rate = 0;
+
+	bus_state read_state(void);
+	void update_state(void);
+};
+
+#endif /* CAN_HEALTH_HPP_ */
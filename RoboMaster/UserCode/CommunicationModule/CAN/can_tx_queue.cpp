@@ -0,0 +1,222 @@
+/*
+ * can_tx_queue.cpp
+ */
+
+#include "can_tx_queue.hpp"
+
+static uint32_t num_tx_queues = 0;
+static CAN_TxQueue tx_queues[Max_Num_CAN_Tx_Queues];
+
+CAN_TxQueue* CAN_TxQueue::of(CAN_HandleTypeDef *hcanx) {
+	for(uint32_t i = 0; i < num_tx_queues; i++) {
+		if(tx_queues[i].get_hcanx() == hcanx) return &tx_queues[i];
+	}
+	if(num_tx_queues >= Max_Num_CAN_Tx_Queues) {
+		stf::exception("CAN_TxQueue: too many CAN buses");
+		return NULL;
+	}
+	CAN_TxQueue *queue = &tx_queues[num_tx_queues];
+	queue->attach(hcanx);
+	num_tx_queues++;
+	return queue;
+}
+
+void CAN_TxQueue::attach(CAN_HandleTypeDef *hcanx) {
+	this->hcanx = hcanx;
+#ifdef CAN2
+	this->tx_irqn = (hcanx->Instance == CAN2) ? CAN2_TX_IRQn : CAN1_TX_IRQn;
+#else
+	this->tx_irqn = CAN1_TX_IRQn;
+#endif
+	for(int i = 0; i < CAN_Tx_Queue_Num_Slots; i++) {
+		slots[i].active = 0;
+		slots[i].origin_cycles[0] = 0;
+		slots[i].origin_cycles[1] = 0;
+		slots[i].pending.store(false);
+	}
+}
+
+void CAN_TxQueue::init(void) {
+	stf::enable_cycle_counter(); // for latency
+	HAL_CAN_ActivateNotification(hcanx, CAN_IT_TX_MAILBOX_EMPTY);
+}
+
+bool CAN_TxQueue::send(uint32_t std_id, const uint8_t data[8], uint8_t dlc, uint32_t origin_cycles) {
+	uint32_t idx;
+	enqueued++;
+
+	for(idx = 0; idx < num_slots; idx++) {
+		if(slots[idx].std_id == std_id) break;
+	}
+	if(idx == num_slots) {
+		// first frame with this StdId, the consumer only ever looks at slots in the ring
+		if(num_slots >= CAN_Tx_Queue_Num_Slots) {
+			dropped_no_slot++;
+			return false;
+		}
+		slots[idx].std_id = std_id;
+		num_slots = num_slots + 1;
+	}
+
+	/* fill the inactive buffer then flip, the interrupt only reads the active one
+	 * and can't be interrupted by this task halfway */
+	tx_slot &slot = slots[idx];
+	uint32_t buf = slot.active ^ 1;
+	if(dlc > 8) dlc = 8;
+	slot.dlc[buf] = dlc;
+	for(int i = 0; i < dlc; i++) slot.data[buf][i] = data[i];
+	slot.enqueue_cycles[buf] = stf::cycles();
+	// a frame about to be superseded hands its origin on (recorded once even if both go out)
+	if(origin_cycles == 0 && slot.pending.load()) origin_cycles = slot.origin_cycles[slot.active];
+	slot.origin_cycles[buf] = origin_cycles;
+	__DMB();
+	slot.active = buf;
+
+	if(slot.pending.exchange(true)) {
+		// the previous frame never made it to a mailbox, it's superseded now
+		coalesced++;
+	}
+	else {
+		uint32_t head = ring_head.load();
+		ring[head] = (uint8_t)idx;
+		ring_head.store((head + 1) % (CAN_Tx_Queue_Num_Slots + 1));
+	}
+
+	uint32_t depth = ring_depth();
+	if(depth > depth_max) depth_max = depth;
+
+	// let the Tx interrupt do the refill, so mailboxes are only touched from one context
+	HAL_NVIC_SetPendingIRQ(tx_irqn);
+	return true;
+}
+
+CAN_TxQueue::tx_stats CAN_TxQueue::get_stats(void) {
+	tx_stats stats;
+	stats.enqueued = enqueued;
+	stats.sent = sent;
+	stats.completed = completed;
+	stats.coalesced = coalesced;
+	stats.dropped = dropped_no_slot + dropped_hal;
+	stats.failed = failed;
+	stats.depth = ring_depth();
+	stats.depth_max = depth_max;
+	stats.latency_us = latency_us;
+	stats.latency_max_us = latency_max_us;
+	return stats;
+}
+
+/* the producer's counters are reset here, the interrupt's (and its histogram, which
+ * has to keep a single writer) in the Tx interrupt, pended right away */
+void CAN_TxQueue::reset_stats(void) {
+	enqueued = 0;
+	coalesced = 0;
+	dropped_no_slot = 0;
+	depth_max = 0;
+	reset_requested = true;
+	HAL_NVIC_SetPendingIRQ(tx_irqn);
+}
+
+
+/*** interrupt side ***/
+
+void CAN_TxQueue::interrupt_task_tx_complete(uint32_t mailbox_idx) {
+	mailbox_completed[mailbox_idx] = true;
+	completed++;
+	float latency = stf::cycles_to_us(stf::cycles() - mailbox_enqueue_cycles[mailbox_idx]);
+	latency_us = latency;
+	if(latency > latency_max_us) latency_max_us = latency;
+
+	uint32_t origin = mailbox_origin_cycles[mailbox_idx];
+	if(origin != 0 && origin != last_origin_cycles) {
+		last_origin_cycles = origin;
+		origin_latency.record_cycles(stf::cycles() - origin);
+	}
+}
+
+void CAN_TxQueue::interrupt_task_refill(void) {
+	if(reset_requested) {
+		sent = 0;
+		completed = 0;
+		dropped_hal = 0;
+		failed = 0;
+		latency_us = 0;
+		latency_max_us = 0;
+		origin_latency.reset();
+		reset_requested = false;
+	}
+
+	uint32_t tsr = READ_REG(hcanx->Instance->TSR);
+	const uint32_t tme[CAN_Num_Tx_Mailboxes] = {CAN_TSR_TME0, CAN_TSR_TME1, CAN_TSR_TME2};
+
+	/* a mailbox we filled that is empty again without a complete callback
+	 * lost arbitration or hit an error (no automatic retransmission) */
+	for(int m = 0; m < CAN_Num_Tx_Mailboxes; m++) {
+		if(mailbox_busy[m] && (tsr & tme[m])) {
+			if(!mailbox_completed[m]) failed++;
+			mailbox_busy[m] = false;
+		}
+	}
+
+	while(ring_tail.load() != ring_head.load()
+			&& HAL_CAN_GetTxMailboxesFreeLevel(hcanx) > 0) {
+		uint32_t tail = ring_tail.load();
+		tx_slot &slot = slots[ring[tail]];
+		ring_tail.store((tail + 1) % (CAN_Tx_Queue_Num_Slots + 1));
+
+		// clear first, a send() after this point queues the slot again
+		slot.pending.store(false);
+		uint32_t buf = slot.active;
+
+		CAN_TxHeaderTypeDef tx_header;
+		uint32_t tx_mailbox;
+		tx_header.StdId = slot.std_id;
+		tx_header.RTR = CAN_RTR_DATA;
+		tx_header.IDE = CAN_ID_STD;
+		tx_header.DLC = slot.dlc[buf];
+		tx_header.TransmitGlobalTime = DISABLE;
+		if(HAL_CAN_AddTxMessage(hcanx, &tx_header, slot.data[buf], &tx_mailbox) != HAL_OK) {
+			dropped_hal++;
+			continue;
+		}
+
+		// CAN_TX_MAILBOX0/1/2 are bit flags 0x1/0x2/0x4
+		uint32_t m = (tx_mailbox == CAN_TX_MAILBOX0) ? 0 : (tx_mailbox == CAN_TX_MAILBOX1) ? 1 : 2;
+		mailbox_busy[m] = true;
+		mailbox_completed[m] = false;
+		mailbox_enqueue_cycles[m] = slot.enqueue_cycles[buf];
+		mailbox_origin_cycles[m] = slot.origin_cycles[buf];
+		sent++;
+	}
+}
+
+
+/*** interrupt handler callbacks ***/
+
+static CAN_TxQueue* find_tx_queue(CAN_HandleTypeDef *hcanx) {
+	for(uint32_t i = 0; i < num_tx_queues; i++) {
+		if(tx_queues[i].get_hcanx() == hcanx) return &tx_queues[i];
+	}
+	return NULL;
+}
+
+void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan) {
+	CAN_TxQueue *queue = find_tx_queue(hcan);
+	if(queue != NULL) queue->interrupt_task_tx_complete(0);
+}
+
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan) {
+	CAN_TxQueue *queue = find_tx_queue(hcan);
+	if(queue != NULL) queue->interrupt_task_tx_complete(1);
+}
+
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan) {
+	CAN_TxQueue *queue = find_tx_queue(hcan);
+	if(queue != NULL) queue->interrupt_task_tx_complete(2);
+}
+
+/* runs after HAL_CAN_IRQHandler() in the Tx interrupt, which is either a mailbox
+ * becoming empty or a send() pending the interrupt */
+void call_this_inside_CAN_TX_IRQHandler(CAN_HandleTypeDef *hcanx) {
+	CAN_TxQueue *queue = find_tx_queue(hcanx);
+	if(queue != NULL) queue->interrupt_task_refill();
+}
@@ -0,0 +1,122 @@
+/*
+ * can_tx_queue.hpp
+ *
+ * Non-blocking transmit queue in front of the 3 bxCAN Tx mailboxes.
+ *
+ * HAL_CAN_AddTxMessage() simply fails when all 3 mailboxes are busy, and with
+ * AutoRetransmission disabled that's common at kHz control rates. Here frames
+ * are kept per StdId: sending a new frame for an StdId whose previous frame
+ * hasn't reached a mailbox yet overwrites it (coalescing), since only the
+ * newest current command matters. The mailboxes are refilled from the
+ * Tx interrupt as soon as one is empty.
+ *
+ * Lock-free, single producer (one task per bus, e.g. the control task) and
+ * the CAN Tx interrupt as the only consumer: send() never touches a mailbox,
+ * it pends the Tx interrupt which then does the refill.
+ *
+ * A frame can carry the stf::cycles() of what caused it (origin, e.g. a host
+ * command arriving), the time from there to the frame being acknowledged
+ * goes into a latency histogram. A frame superseded before reaching a
+ * mailbox hands its origin on to the one replacing it.
+ *
+ * CubeMx generated CANx_TX_IRQHandler must call
+ * call_this_inside_CAN_TX_IRQHandler(&hcanx) after HAL_CAN_IRQHandler()
+ */
+
+#ifndef CAN_TX_QUEUE_HPP_
+#define CAN_TX_QUEUE_HPP_
+
+#include "stf.h"
+#include "latency_histogram.hpp"
+
+#include <atomic>
+
+#define Max_Num_CAN_Tx_Queues 2
+#define CAN_Tx_Queue_Num_Slots 8 // distinct StdIds per bus
+#define CAN_Num_Tx_Mailboxes 3
+
+class CAN_TxQueue {
+public:
+	struct tx_stats {
+		uint32_t enqueued;   // frames passed to send()
+		uint32_t sent;       // frames handed to a mailbox
+		uint32_t completed;  // frames acknowledged on the bus
+		uint32_t coalesced;  // frames overwritten by a newer one with the same StdId before being sent
+		uint32_t dropped;    // frames rejected: no free StdId slot, or refused by HAL
+		uint32_t failed;     // frames that left a mailbox without success (arbitration lost, bus error, abort)
+		uint32_t depth;      // StdIds currently waiting for a mailbox
+		uint32_t depth_max;
+		float latency_us;    // send() -> transmission complete, latest frame
+		float latency_max_us;
+	};
+
+	CAN_TxQueue(void) {}
+
+	// Tx mailbox empty interrupt, call once the bus is started
+	void init(void);
+
+	/* queue a standard data frame, returns false if it had to be dropped,
+	 * producer side: call from one task only. origin_cycles: see above, 0 for none */
+	bool send(uint32_t std_id, const uint8_t data[8], uint8_t dlc = 8, uint32_t origin_cycles = 0);
+
+	tx_stats get_stats(void);
+	void reset_stats(void);
+	// origin -> acknowledged on the bus, frames sent with an origin only
+	inline Latency_Histogram::histogram get_origin_latency(void) {return origin_latency.get();}
+
+	inline CAN_HandleTypeDef *get_hcanx(void) {return hcanx;}
+
+	/* queue of a bus, created on first use */
+	static CAN_TxQueue* of(CAN_HandleTypeDef *hcanx);
+
+	/* interrupt side, do not call elsewhere */
+	void interrupt_task_tx_complete(uint32_t mailbox_idx);
+	void interrupt_task_refill(void);
+
+private:
+	struct tx_slot {
+		uint32_t std_id;
+		uint8_t dlc[2];
+		uint8_t data[2][8];         // double buffer: the producer fills the one not active
+		uint32_t enqueue_cycles[2];
+		uint32_t origin_cycles[2];
+		volatile uint32_t active;   // buffer the consumer will send
+		std::atomic<bool> pending;  // slot index is in the ring and not yet sent
+	};
+
+	CAN_HandleTypeDef *hcanx = NULL;
+	IRQn_Type tx_irqn;
+
+	tx_slot slots[CAN_Tx_Queue_Num_Slots];
+	volatile uint32_t num_slots = 0; // only grows, written by the producer
+
+	/* ring of slot indices waiting for a mailbox, each slot is in at most once,
+	 * so it can never overflow */
+	uint8_t ring[CAN_Tx_Queue_Num_Slots + 1];
+	std::atomic<uint32_t> ring_head{0}; // producer
+	std::atomic<uint32_t> ring_tail{0}; // consumer
+
+	// mailbox bookkeeping, interrupt side only
+	bool mailbox_busy[CAN_Num_Tx_Mailboxes] = {false, false, false};
+	bool mailbox_completed[CAN_Num_Tx_Mailboxes] = {false, false, false};
+	uint32_t mailbox_enqueue_cycles[CAN_Num_Tx_Mailboxes];
+	uint32_t mailbox_origin_cycles[CAN_Num_Tx_Mailboxes];
+	uint32_t last_origin_cycles = 0; // each origin is recorded once
+	Latency_Histogram origin_latency;
+
+	/* counters written by the producer */
+	volatile uint32_t enqueued = 0, coalesced = 0, dropped_no_slot = 0, depth_max = 0;
+	volatile bool reset_requested = false; // reset_stats(), taken by the interrupt
+	/* counters written by the interrupt */
+	volatile uint32_t sent = 0, completed = 0, dropped_hal = 0, failed = 0;
+	volatile float latency_us = 0, latency_max_us = 0;
+
+	void attach(CAN_HandleTypeDef *hcanx);
+	inline uint32_t ring_depth(void) {
+		return (ring_head.load() + CAN_Tx_Queue_Num_Slots + 1 - ring_tail.load()) % (CAN_Tx_Queue_Num_Slots + 1);
+	}
+};
+
+extern "C" void call_this_inside_CAN_TX_IRQHandler(CAN_HandleTypeDef *hcanx);
+
+#endif /* CAN_TX_QUEUE_HPP_ */
@@ -0,0 +1,359 @@
+/*
+ * robot_protocol.cpp
+ */
+
+#include "robot_protocol.hpp"
+
+#include <string.h>
+#include <math.h>
+
+using namespace Protocol;
+
+/*** little endian fields, byte by byte so it doesn't matter what the CPU is ***/
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+static inline void put_u32(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+static inline void put_f32(uint8_t *p, float v) {
+	uint32_t u;
+	memcpy(&u, &v, 4);
+	put_u32(p, u);
+}
+static inline uint16_t get_u16(const uint8_t *p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+static inline uint32_t get_u32(const uint8_t *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline float get_f32(const uint8_t *p) {
+	uint32_t u = get_u32(p);
+	float v;
+	memcpy(&v, &u, 4);
+	return v;
+}
+
+
+size_t Protocol::payload_size(uint8_t type) {
+	switch(type) {
+	case Velocity: return 12;
+	case Kick:     return 6;
+	case Dribble:  return 4;
+	case Config:   return 5;
+	case Telemetry: return telemetry_size(Telemetry_All);
+	default:       return 0;
+	}
+}
+
+size_t Protocol::telemetry_size(uint8_t groups) {
+	if(groups & ~Telemetry_All) return 0;
+	size_t size = 2;
+	if(groups & Telemetry_Motors) size += 4 * 12;
+	if(groups & Telemetry_Setpoints) size += 4 * 8;
+	if(groups & Telemetry_PID) size += 4 * 16;
+	if(groups & Telemetry_IMU) size += 24;
+	if(groups & Telemetry_Timing) size += 16;
+	if(groups & Telemetry_Latency) size += 2 * 16;
+	return size;
+}
+
+// the groups of t in the order of telemetry_group, p must hold telemetry_size(t.groups)
+static void put_telemetry(uint8_t *p, const telemetry_payload& t) {
+	*p++ = t.groups;
+	*p++ = t.decimation;
+	if(t.groups & Telemetry_Motors) {
+		for(int i = 0; i < 4; i++, p += 12) {
+			put_u16(&p[0], t.motor[i].angle);
+			put_u16(&p[2], (uint16_t)t.motor[i].speed);
+			put_f32(&p[4], t.motor[i].current);
+			put_f32(&p[8], t.motor[i].velocity);
+		}
+	}
+	if(t.groups & Telemetry_Setpoints) {
+		for(int i = 0; i < 4; i++, p += 8) {
+			put_f32(&p[0], t.setpoint[i].velocity);
+			put_f32(&p[4], t.setpoint[i].current);
+		}
+	}
+	if(t.groups & Telemetry_PID) {
+		for(int i = 0; i < 4; i++, p += 16) {
+			put_f32(&p[0], t.pid[i].p);
+			put_f32(&p[4], t.pid[i].i);
+			put_f32(&p[8], t.pid[i].d);
+			put_f32(&p[12], t.pid[i].ff);
+		}
+	}
+	if(t.groups & Telemetry_IMU) {
+		for(int i = 0; i < 3; i++, p += 4) put_f32(p, t.imu.accel[i]);
+		for(int i = 0; i < 3; i++, p += 4) put_f32(p, t.imu.gyro[i]);
+	}
+	if(t.groups & Telemetry_Timing) {
+		put_f32(&p[0], t.timing.period_us);
+		put_f32(&p[4], t.timing.exec_us);
+		put_f32(&p[8], t.timing.jitter_max_us);
+		put_u32(&p[12], t.timing.overruns);
+		p += 16;
+	}
+	if(t.groups & Telemetry_Latency) {
+		const latency_summary *summaries[2] = {&t.latency.command_age, &t.latency.can_origin};
+		for(int i = 0; i < 2; i++, p += 16) {
+			put_u32(&p[0], summaries[i]->p50_us);
+			put_u32(&p[4], summaries[i]->p99_us);
+			put_u32(&p[8], summaries[i]->max_us);
+			put_u32(&p[12], summaries[i]->count);
+		}
+	}
+}
+
+static void get_telemetry(const uint8_t *p, telemetry_payload& t) {
+	memset(&t, 0, sizeof(t));
+	t.groups = *p++;
+	t.decimation = *p++;
+	if(t.groups & Telemetry_Motors) {
+		for(int i = 0; i < 4; i++, p += 12) {
+			t.motor[i].angle = get_u16(&p[0]);
+			t.motor[i].speed = (int16_t)get_u16(&p[2]);
+			t.motor[i].current = get_f32(&p[4]);
+			t.motor[i].velocity = get_f32(&p[8]);
+		}
+	}
+	if(t.groups & Telemetry_Setpoints) {
+		for(int i = 0; i < 4; i++, p += 8) {
+			t.setpoint[i].velocity = get_f32(&p[0]);
+			t.setpoint[i].current = get_f32(&p[4]);
+		}
+	}
+	if(t.groups & Telemetry_PID) {
+		for(int i = 0; i < 4; i++, p += 16) {
+			t.pid[i].p = get_f32(&p[0]);
+			t.pid[i].i = get_f32(&p[4]);
+			t.pid[i].d = get_f32(&p[8]);
+			t.pid[i].ff = get_f32(&p[12]);
+		}
+	}
+	if(t.groups & Telemetry_IMU) {
+		for(int i = 0; i < 3; i++, p += 4) t.imu.accel[i] = get_f32(p);
+		for(int i = 0; i < 3; i++, p += 4) t.imu.gyro[i] = get_f32(p);
+	}
+	if(t.groups & Telemetry_Timing) {
+		t.timing.period_us = get_f32(&p[0]);
+		t.timing.exec_us = get_f32(&p[4]);
+		t.timing.jitter_max_us = get_f32(&p[8]);
+		t.timing.overruns = get_u32(&p[12]);
+		p += 16;
+	}
+	if(t.groups & Telemetry_Latency) {
+		latency_summary *summaries[2] = {&t.latency.command_age, &t.latency.can_origin};
+		for(int i = 0; i < 2; i++, p += 16) {
+			summaries[i]->p50_us = get_u32(&p[0]);
+			summaries[i]->p99_us = get_u32(&p[4]);
+			summaries[i]->max_us = get_u32(&p[8]);
+			summaries[i]->count = get_u32(&p[12]);
+		}
+	}
+}
+
+// CRC-16/CCITT-FALSE (poly 0x1021), a nibble at a time: 32 bytes of table instead of 512
+static const uint16_t crc_nibble_table[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+uint16_t Protocol::crc16(const uint8_t *data, size_t len, uint16_t crc) {
+	for(size_t i = 0; i < len; i++) {
+		crc = (uint16_t)((crc << 4) ^ crc_nibble_table[(crc >> 12) ^ (data[i] >> 4)]);
+		crc = (uint16_t)((crc << 4) ^ crc_nibble_table[(crc >> 12) ^ (data[i] & 0x0F)]);
+	}
+	return crc;
+}
+
+size_t Protocol::encode(const frame& f, uint8_t *out, size_t out_size) {
+	size_t size = (f.type == Telemetry) ? telemetry_size(f.telemetry.groups) : payload_size(f.type);
+	// what this frame can take once COBS encoded, a command still fits a 64 byte buffer
+	size_t max_len = Protocol_Header_Size + size + Protocol_CRC_Size;
+	if(size == 0 || out_size < max_len + max_len / 254 + 2) return 0;
+
+	uint8_t raw[Protocol_Max_Frame_Size];
+	raw[0] = f.type;
+	raw[1] = Protocol_Version;
+	put_u16(&raw[2], f.seq);
+	put_u32(&raw[4], f.timestamp_us);
+	uint8_t *p = &raw[Protocol_Header_Size];
+	switch(f.type) {
+	case Velocity:
+		put_f32(&p[0], f.velocity.x);
+		put_f32(&p[4], f.velocity.y);
+		put_f32(&p[8], f.velocity.omega);
+		break;
+	case Kick:
+		put_f32(&p[0], f.kick.power);
+		put_u16(&p[4], f.kick.duration_ms);
+		break;
+	case Dribble:
+		put_f32(&p[0], f.dribble.speed);
+		break;
+	case Config:
+		p[0] = f.config.key;
+		put_f32(&p[1], f.config.value);
+		break;
+	case Telemetry:
+		put_telemetry(p, f.telemetry);
+		break;
+	}
+	size_t len = Protocol_Header_Size + size;
+	put_u16(&raw[len], crc16(raw, len));
+	len += Protocol_CRC_Size;
+
+	// COBS: each block starts with its length + 1, and stands for its bytes followed by a 0
+	size_t code_idx = 0, o = 1;
+	uint8_t code = 1;
+	for(size_t i = 0; i < len; i++) {
+		if(raw[i] == 0) {
+			out[code_idx] = code;
+			code_idx = o++;
+			code = 1;
+			continue;
+		}
+		out[o++] = raw[i];
+		// a full block (254 bytes) has no 0 after it
+		if(++code == 0xFF) {
+			out[code_idx] = code;
+			code_idx = o++;
+			code = 1;
+		}
+	}
+	out[code_idx] = code;
+	out[o++] = 0;
+	return o;
+}
+
+
+/*** Decoder ***/
+
+void Decoder::reset(void) {
+	len = 0;
+	code = 0;
+	remaining = 0;
+	overflow = false;
+	has_seq = false;
+	expected_seq = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+Decoder::result Decoder::feed(uint8_t byte, frame& out) {
+	if(byte == 0) {
+		// a 0 between frames (or 2 in a row) is just a delimiter
+		result r = (len == 0 && code == 0 && !overflow) ? Incomplete : finish(out);
+		len = 0;
+		code = 0;
+		remaining = 0;
+		overflow = false;
+		return r;
+	}
+	if(overflow) return Incomplete; // dropping until the next delimiter
+
+	uint8_t value = byte;
+	if(remaining == 0) {
+		// start of a block: the previous one (unless full) stood for a 0 at its end
+		bool implied_zero = (code != 0 && code != 0xFF);
+		code = byte;
+		remaining = byte - 1;
+		if(!implied_zero) return Incomplete;
+		value = 0;
+	}
+	else remaining--;
+
+	if(len >= Protocol_Max_Frame_Size) {
+		overflow = true;
+		return Incomplete;
+	}
+	buf[len++] = value;
+	return Incomplete;
+}
+
+Decoder::result Decoder::feed(const uint8_t *bytes, size_t num_bytes, frame& out, size_t& consumed) {
+	for(size_t i = 0; i < num_bytes; i++) {
+		result r = feed(bytes[i], out);
+		if(r != Incomplete) {
+			consumed = i + 1;
+			return r;
+		}
+	}
+	consumed = num_bytes;
+	return Incomplete;
+}
+
+Decoder::result Decoder::finish(frame& out) {
+	if(overflow || remaining != 0 || len < Protocol_Header_Size + Protocol_CRC_Size) {
+		stats.framing_errors++;
+		return Error;
+	}
+	size_t body = len - Protocol_CRC_Size;
+	if(crc16(buf, body) != get_u16(&buf[body])) {
+		stats.crc_errors++;
+		return Error;
+	}
+	size_t size = payload_size(buf[0]);
+	// telemetry: sized by its groups byte, without one it fails the size check below
+	if(buf[0] == Telemetry && body > Protocol_Header_Size) size = telemetry_size(buf[Protocol_Header_Size]);
+	if(size == 0 || buf[1] != Protocol_Version) {
+		stats.unknown++;
+		return Error;
+	}
+	if(body != Protocol_Header_Size + size) {
+		stats.framing_errors++;
+		return Error;
+	}
+
+	out.type = (frame_type)buf[0];
+	out.seq = get_u16(&buf[2]);
+	out.timestamp_us = get_u32(&buf[4]);
+	const uint8_t *p = &buf[Protocol_Header_Size];
+	// a NaN or inf passes the CRC but would stick in whatever integrates the command
+	bool finite = true;
+	switch(out.type) {
+	case Velocity:
+		out.velocity.x = get_f32(&p[0]);
+		out.velocity.y = get_f32(&p[4]);
+		out.velocity.omega = get_f32(&p[8]);
+		finite = isfinite(out.velocity.x) && isfinite(out.velocity.y) && isfinite(out.velocity.omega);
+		break;
+	case Kick:
+		out.kick.power = get_f32(&p[0]);
+		out.kick.duration_ms = get_u16(&p[4]);
+		finite = isfinite(out.kick.power);
+		break;
+	case Dribble:
+		out.dribble.speed = get_f32(&p[0]);
+		finite = isfinite(out.dribble.speed);
+		break;
+	case Config:
+		out.config.key = (config_key)p[0];
+		out.config.value = get_f32(&p[1]);
+		finite = isfinite(out.config.value);
+		break;
+	case Telemetry:
+		get_telemetry(p, out.telemetry);
+		break;
+	}
+
+	// gaps in the sequence are lost frames, going backwards is a restart or a duplicate
+	if(has_seq) {
+		uint16_t gap = (uint16_t)(out.seq - expected_seq);
+		if(gap < 0x8000) stats.lost += gap;
+	}
+	expected_seq = (uint16_t)(out.seq + 1);
+	has_seq = true;
+	if(!finite) {
+		stats.invalid++;
+		return Error;
+	}
+	stats.frames++;
+	return Frame_Ready;
+}
@@ -0,0 +1,201 @@
+/*
+ * robot_protocol.hpp
+ *
+ * Binary host <-> robot frames, replacing the "x,y,omega" text commands.
+ * Plain C++ without stf / HAL, the host library (HostLink/) builds the same
+ * files, so both ends always agree on the format.
+ *
+ * Frame before framing, little endian:
+ *  [0]      type
+ *  [1]      version (Protocol_Version)
+ *  [2..3]   sequence number, +1 per frame sent, wraps
+ *  [4..7]   sender timestamp, us, wraps
+ *  [8..]    payload, fixed size per type (telemetry: per the groups it carries)
+ *  [-2..-1] CRC-16/CCITT-FALSE of everything before it
+ * then COBS encoded and terminated by a 0 byte, so a receiver that lost
+ * bytes picks up again at the next 0.
+ *
+ * encode() and Decoder never allocate and take a fixed number of steps per
+ * byte, the decoder undoes COBS on the fly as bytes come in, i.e. the cost of
+ * a command is the same whatever the values in it.
+ */
+
+#ifndef ROBOT_PROTOCOL_HPP_
+#define ROBOT_PROTOCOL_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define Protocol_Version 1
+#define Protocol_Header_Size 8
+#define Protocol_CRC_Size 2
+#define Protocol_Max_Payload_Size 218 // a telemetry frame with every group
+#define Protocol_Max_Frame_Size (Protocol_Header_Size + Protocol_Max_Payload_Size + Protocol_CRC_Size)
+/* COBS adds 1 byte per 254 and the 0 delimiter. A command fits a 64 byte USB FS packet,
+ * a full telemetry frame takes 4 */
+#define Protocol_Max_Encoded_Size (Protocol_Max_Frame_Size + Protocol_Max_Frame_Size / 254 + 2)
+
+namespace Protocol {
+	enum frame_type : uint8_t {
+		Velocity = 0x01, // host -> robot
+		Kick     = 0x02, // host -> robot
+		Dribble  = 0x03, // host -> robot
+		Config   = 0x04, // host -> robot
+		Telemetry = 0x81 // robot -> host
+	};
+
+	enum config_key : uint8_t {
+		Command_Deadline_ms = 0x01,
+		Power_Budget_W      = 0x02,
+		Max_Acc_XY          = 0x03, // m/s^2
+		Max_Acc_Omega       = 0x04, // rad/s^2
+		Telemetry_Groups    = 0x05, // telemetry_group bits
+		Telemetry_Decimation = 0x06, // control steps per telemetry frame, 0 stops it
+		Heading_Hold        = 0x07, // rad: turn to and hold this absolute heading, velocity commands' omega is ignored
+		Heading_Release     = 0x08, // any value: omega from the velocity commands again
+		Heading_Reset       = 0x09  // rad: the robot's heading is this now (e.g. from vision)
+	};
+
+	// what a telemetry frame carries, in this order after its groups and decimation bytes
+	enum telemetry_group : uint8_t {
+		Telemetry_Motors    = 0x01, // 4 x 12 bytes
+		Telemetry_Setpoints = 0x02, // 4 x 8 bytes
+		Telemetry_PID       = 0x04, // 4 x 16 bytes
+		Telemetry_IMU       = 0x08, // 24 bytes
+		Telemetry_Timing    = 0x10, // 16 bytes
+		Telemetry_Latency   = 0x20, // 2 x 16 bytes
+		Telemetry_All       = 0x3F
+	};
+
+	// body frame, m/s, m/s, rad/s
+	struct velocity_payload {
+		float x;
+		float y;
+		float omega;
+	};
+	struct kick_payload {
+		float power;          // 0 ~ 1
+		uint16_t duration_ms;
+	};
+	struct dribble_payload {
+		float speed;          // -1 ~ 1
+	};
+	struct config_payload {
+		config_key key;
+		float value;
+	};
+
+	/* one control step of the robot, sampled every `decimation` steps.
+	 * Motor1~4 drive RF, RB, LB, LF; groups left out of a frame read as 0 */
+	struct motor_telemetry {
+		uint16_t angle;       // rotor angle, 0 ~ 8191 per rotor turn
+		int16_t speed;        // rotor rpm, as sent by the ESC
+		float current;        // ampere
+		float velocity;       // % of max, as the velocity loop sees it
+	};
+	struct setpoint_telemetry {
+		float velocity;       // velocity loop setpoint, % of max
+		float current;        // current command, % of max
+	};
+	// velocity loop terms, % of max current, before the output clamp
+	struct pid_telemetry {
+		float p, i, d, ff;
+	};
+	// body frame, m/s^2 and rad/s
+	struct imu_telemetry {
+		float accel[3];
+		float gyro[3];
+	};
+	struct timing_telemetry {
+		float period_us;      // last period of the control task
+		float exec_us;        // last control step execution time
+		float jitter_max_us;
+		uint32_t overruns;
+	};
+	// of a Latency_Histogram since its last reset, percentiles are bucket bounds (powers of 2)
+	struct latency_summary {
+		uint32_t p50_us;
+		uint32_t p99_us;
+		uint32_t max_us;
+		uint32_t count;
+	};
+	struct latency_telemetry {
+		latency_summary command_age;  // arrival -> taken by the control task (Command_Watchdog)
+		latency_summary can_origin;   // arrival -> its CAN frame sent (CAN_Tx_Queue)
+	};
+	struct telemetry_payload {
+		uint8_t groups;       // telemetry_group bits
+		uint8_t decimation;   // control steps per frame, saturates at 255
+		motor_telemetry motor[4];
+		setpoint_telemetry setpoint[4];
+		pid_telemetry pid[4];
+		imu_telemetry imu;
+		timing_telemetry timing;
+		latency_telemetry latency;
+	};
+
+	struct frame {
+		frame_type type;
+		uint16_t seq;
+		uint32_t timestamp_us;
+		union {
+			velocity_payload velocity;
+			kick_payload kick;
+			dribble_payload dribble;
+			config_payload config;
+			telemetry_payload telemetry;
+		};
+	};
+
+	// payload size of a type, 0 if unknown. Telemetry: the largest one, see telemetry_size()
+	size_t payload_size(uint8_t type);
+	// payload size of a telemetry frame carrying these groups, 0 if any is unknown
+	size_t telemetry_size(uint8_t groups);
+
+	uint16_t crc16(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF);
+
+	/* f -> COBS encoded frame with the trailing 0 into out,
+	 * returns the number of bytes, 0 if the type is unknown or out is too small */
+	size_t encode(const frame& f, uint8_t *out, size_t out_size);
+
+	// byte stream -> frames
+	class Decoder {
+	public:
+		enum result : int {
+			Incomplete,      // byte taken, no frame yet
+			Frame_Ready,     // out holds a new frame
+			Error            // a frame was dropped (bad length, CRC, type, version, telemetry group or value), see get_stats()
+		};
+		struct decoder_stats {
+			uint32_t frames;
+			uint32_t crc_errors;
+			uint32_t framing_errors; // COBS error, too long or wrong size for its type
+			uint32_t unknown;        // unknown type, version or telemetry group
+			uint32_t invalid;        // a command with a NaN or inf value
+			uint32_t lost;           // frames missing according to the sequence numbers
+		};
+
+		Decoder(void) {reset();}
+
+		result feed(uint8_t byte, frame& out);
+		// frame in out when Frame_Ready, the bytes after it are left for the next call
+		result feed(const uint8_t *bytes, size_t num_bytes, frame& out, size_t& consumed);
+
+		void reset(void);
+		inline decoder_stats get_stats(void) const {return stats;}
+
+	private:
+		uint8_t buf[Protocol_Max_Frame_Size];
+		size_t len;
+		uint8_t code;       // COBS: length of the current block
+		uint8_t remaining;  // COBS: bytes left in the current block
+		bool overflow;
+		bool has_seq;
+		uint16_t expected_seq;
+		decoder_stats stats;
+
+		result finish(frame& out);
+	};
+}
+
+#endif /* ROBOT_PROTOCOL_HPP_ */
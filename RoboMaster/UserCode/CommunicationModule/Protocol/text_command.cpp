@@ -0,0 +1,503 @@
+/*
+ * text_command.cpp
+ */
+
+#include "text_command.hpp"
+
+#include <string.h>
+
+using namespace Protocol;
+
+#define Float_Sign_Bit 0x80000000
+#define Float_Inf_Bits 0x7F800000
+#define Float_NaN_Bits 0x7FC00000
+#define Float_Mant_Bits 23
+#define Float_Exp_Bias 127
+#define Decimal_Max_Shift 27     // x or / 2^27 at a time keeps the digit carries in 32 bits
+#define Number_Exp_Limit 100000  // exponents past this are inf / 0 anyway, stops counting before int overflows
+
+static inline bool is_space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+static inline bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+static inline int hex_value(char c) {
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+static inline char to_lower(char c) {
+	return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+// str[i..] starts with word, any case
+static bool match_word(const char *str, size_t len, size_t i, const char *word) {
+	for(; *word != '\0'; word++, i++) {
+		if(i >= len || to_lower(str[i]) != *word) return false;
+	}
+	return true;
+}
+static inline float from_bits(uint32_t bits) {
+	float v;
+	memcpy(&v, &bits, 4);
+	return v;
+}
+
+// exponent digits after 'e' / 'p' at str[i], taken only if there is at least one digit
+static size_t parse_exponent(const char *str, size_t len, size_t i, int32_t& exp) {
+	bool neg = false;
+	if(i < len && (str[i] == '+' || str[i] == '-')) neg = (str[i++] == '-');
+	if(i >= len || !is_digit(str[i])) return 0;
+	int32_t e = 0;
+	for(; i < len && is_digit(str[i]); i++) {
+		if(e < Number_Exp_Limit) e = e * 10 + (str[i] - '0');
+	}
+	exp = neg ? -e : e;
+	return i;
+}
+
+
+/*** exact decimal, for the numbers a single float operation can't get right ***/
+
+// 0.d[0]d[1]...d[nd-1] x 10^dp, digits 0 ~ 9, no trailing zeros
+struct big_decimal {
+	uint8_t d[Text_Number_Max_Digits];
+	int nd;
+	int dp;
+	bool trunc; // nonzero digits didn't fit in d
+};
+
+static void trim(big_decimal& a) {
+	while(a.nd > 0 && a.d[a.nd - 1] == 0) a.nd--;
+	if(a.nd == 0) a.dp = 0;
+}
+
+// a / 2^k, k <= Decimal_Max_Shift
+static void right_shift(big_decimal& a, unsigned k) {
+	int r = 0, w = 0;
+	uint32_t n = 0;
+	for(; (n >> k) == 0; r++) {
+		if(r >= a.nd) {
+			if(n == 0) {
+				a.nd = 0;
+				return;
+			}
+			while((n >> k) == 0) {
+				n *= 10;
+				r++;
+			}
+			break;
+		}
+		n = n * 10 + a.d[r];
+	}
+	a.dp -= r - 1;
+
+	uint32_t mask = ((uint32_t)1 << k) - 1;
+	for(; r < a.nd; r++) {
+		uint32_t digit = n >> k;
+		n &= mask;
+		a.d[w++] = (uint8_t)digit;
+		n = n * 10 + a.d[r];
+	}
+	while(n > 0) {
+		uint32_t digit = n >> k;
+		n &= mask;
+		if(w < Text_Number_Max_Digits) a.d[w++] = (uint8_t)digit;
+		else if(digit > 0) a.trunc = true;
+		n *= 10;
+	}
+	a.nd = w;
+	trim(a);
+}
+
+// a x 2^k, k <= Decimal_Max_Shift
+static void left_shift(big_decimal& a, unsigned k) {
+	// as many new digits as 2^k has, one less if a's digits start below those of 5^k (= 10^k / 2^k)
+	int delta = 0;
+	for(uint32_t p2 = (uint32_t)1 << k; p2 > 0; p2 /= 10) delta++;
+	uint64_t p5 = 1;
+	for(unsigned i = 0; i < k; i++) p5 *= 5;
+	uint8_t five[20]; // digits of 5^k, least significant first
+	int num_five = 0;
+	for(; p5 > 0; p5 /= 10) five[num_five++] = (uint8_t)(p5 % 10);
+	for(int i = 0; i < num_five; i++) {
+		uint8_t digit = five[num_five - 1 - i];
+		if(i >= a.nd || a.d[i] != digit) {
+			if(i >= a.nd || a.d[i] < digit) delta--;
+			break;
+		}
+	}
+
+	int r = a.nd, w = a.nd + delta;
+	uint32_t n = 0;
+	for(r--; r >= 0; r--) {
+		n += (uint32_t)a.d[r] << k;
+		uint32_t quo = n / 10, rem = n - 10 * quo;
+		w--;
+		if(w < Text_Number_Max_Digits) a.d[w] = (uint8_t)rem;
+		else if(rem != 0) a.trunc = true;
+		n = quo;
+	}
+	while(n > 0) {
+		uint32_t quo = n / 10, rem = n - 10 * quo;
+		w--;
+		if(w < Text_Number_Max_Digits) a.d[w] = (uint8_t)rem;
+		else if(rem != 0) a.trunc = true;
+		n = quo;
+	}
+	a.nd += delta;
+	if(a.nd > Text_Number_Max_Digits) a.nd = Text_Number_Max_Digits;
+	a.dp += delta;
+	trim(a);
+}
+
+static void shift(big_decimal& a, int k) {
+	if(a.nd == 0) return;
+	for(; k > Decimal_Max_Shift; k -= Decimal_Max_Shift) left_shift(a, Decimal_Max_Shift);
+	for(; k < -Decimal_Max_Shift; k += Decimal_Max_Shift) right_shift(a, Decimal_Max_Shift);
+	if(k > 0) left_shift(a, k);
+	else if(k < 0) right_shift(a, -k);
+}
+
+// integer part, rounded half to even, a < 2^32
+static uint32_t rounded_integer(const big_decimal& a, bool& inexact) {
+	uint32_t n = 0;
+	int i;
+	for(i = 0; i < a.dp && i < a.nd; i++) n = n * 10 + a.d[i];
+	for(; i < a.dp; i++) n *= 10;
+
+	inexact = a.trunc || a.nd > a.dp;
+	if(a.dp < 0 || a.dp >= a.nd) return n;
+	bool round_up;
+	if(a.d[a.dp] == 5 && a.dp + 1 == a.nd) round_up = a.trunc || (n & 1); // halfway
+	else round_up = a.d[a.dp] >= 5;
+	return round_up ? n + 1 : n;
+}
+
+static bool fraction_from_3_quarters(const big_decimal& a) {
+	if(a.dp < 0 || a.dp >= a.nd) return false;
+	int first = a.d[a.dp];
+	int second = (a.dp + 1 < a.nd) ? a.d[a.dp + 1] : 0;
+	return first > 7 || (first == 7 && second >= 5);
+}
+
+/* a (not 0) -> float bits: scaled by powers of 2 into [0.5, 1), then 24 bits of it taken
+ * (fewer for subnormals), see Go's strconv/decimal.go */
+static number_status decimal_to_float(big_decimal& a, uint32_t& bits) {
+	static const int powtab[] = {1, 3, 6, 9, 13, 16, 19, 23, 26}; // 2^powtab[n] < 10^n
+	const int num_powtab = sizeof(powtab) / sizeof(powtab[0]);
+
+	if(a.dp > 40) {
+		bits = Float_Inf_Bits;
+		return Out_Of_Range;
+	}
+	if(a.dp < -50) {
+		bits = 0;
+		return Out_Of_Range;
+	}
+	int exp = 0;
+	while(a.dp > 0) {
+		int n = (a.dp >= num_powtab) ? Decimal_Max_Shift : powtab[a.dp];
+		shift(a, -n);
+		exp += n;
+	}
+	while(a.dp < 0 || (a.dp == 0 && a.d[0] < 5)) {
+		int n = (-a.dp >= num_powtab) ? Decimal_Max_Shift : powtab[-a.dp];
+		shift(a, n);
+		exp -= n;
+	}
+	exp--; // [0.5, 1) -> [1, 2)
+
+	// below the smallest normal: fewer bits left for the mantissa
+	int subnormal_shift = (exp < 1 - Float_Exp_Bias) ? 1 - Float_Exp_Bias - exp : 0;
+	if(subnormal_shift > 0) {
+		shift(a, -subnormal_shift);
+		exp = 1 - Float_Exp_Bias;
+	}
+	if(exp + Float_Exp_Bias >= 0xFF) {
+		bits = Float_Inf_Bits;
+		return Out_Of_Range;
+	}
+
+	shift(a, 1 + Float_Mant_Bits);
+	bool inexact;
+	uint32_t mant = rounded_integer(a, inexact);
+	if(mant == (uint32_t)2 << Float_Mant_Bits) {
+		mant >>= 1;
+		exp++;
+		if(exp + Float_Exp_Bias >= 0xFF) {
+			bits = Float_Inf_Bits;
+			return Out_Of_Range;
+		}
+	}
+	if((mant & ((uint32_t)1 << Float_Mant_Bits)) == 0) exp = -Float_Exp_Bias;
+	bits = (mant & (((uint32_t)1 << Float_Mant_Bits) - 1)) | ((uint32_t)(exp + Float_Exp_Bias) << Float_Mant_Bits);
+
+	/* strtof() reports an underflow for an inexact number that is below the smallest normal
+	 * even when rounded to 24 bits: just under it, a is 2^23 - 1 and a bit, 24 bits round up from .75 */
+	bool tiny = subnormal_shift > 1
+		|| (subnormal_shift == 1 && !(mant == (uint32_t)1 << Float_Mant_Bits && fraction_from_3_quarters(a)));
+	return (tiny && inexact) ? Out_Of_Range : Number_Ok;
+}
+
+/* hex digits after "0x": at most 64 bits of mantissa kept, the rest only
+ * matters as "not exactly halfway" */
+static number_status parse_hex(const char *str, size_t len, size_t& i, uint32_t& bits) {
+	uint64_t m = 0;
+	int num_sig = 0;
+	int32_t exp = 0;
+	bool sticky = false, dot = false;
+	for(; i < len; i++) {
+		if(str[i] == '.' && !dot) {
+			dot = true;
+			continue;
+		}
+		int h = hex_value(str[i]);
+		if(h < 0) break;
+		if(m == 0 && h == 0) {
+			if(dot && exp > -Number_Exp_Limit) exp -= 4;
+		}
+		else if(num_sig < 16) {
+			m = (m << 4) | (uint64_t)h;
+			num_sig++;
+			if(dot) exp -= 4;
+		}
+		else {
+			sticky |= (h != 0);
+			if(!dot && exp < Number_Exp_Limit) exp += 4;
+		}
+	}
+	if(i < len && (str[i] == 'p' || str[i] == 'P')) {
+		int32_t p_exp;
+		size_t end = parse_exponent(str, len, i + 1, p_exp);
+		if(end > 0) {
+			exp += p_exp;
+			i = end;
+		}
+	}
+	if(m == 0) {
+		bits = 0;
+		return Number_Ok;
+	}
+
+	// m x 2^exp in [2^e, 2^(e+1)), rounded to num_bits bits
+	int msb = 63 - __builtin_clzll(m);
+	int32_t e = msb + exp;
+	bool subnormal = e < 1 - Float_Exp_Bias;
+	int32_t num_bits = !subnormal ? 1 + Float_Mant_Bits : e + Float_Exp_Bias + Float_Mant_Bits;
+	int32_t drop = msb + 1 - num_bits;
+	uint64_t mant;
+	bool inexact = sticky;
+	if(drop > 64) {
+		mant = 0;
+		inexact = true;
+	}
+	else if(drop > 0) {
+		uint64_t rest = (drop == 64) ? m : m & (((uint64_t)1 << drop) - 1);
+		uint64_t half = (uint64_t)1 << (drop - 1);
+		mant = (drop == 64) ? 0 : m >> drop;
+		inexact |= (rest != 0);
+		if(rest > half || (rest == half && (sticky || (mant & 1)))) mant++;
+	}
+	else mant = m << -drop;
+
+	if(!subnormal) {
+		if(mant == (uint64_t)2 << Float_Mant_Bits) {
+			mant >>= 1;
+			e++;
+		}
+		if(e + Float_Exp_Bias >= 0xFF) {
+			bits = Float_Inf_Bits;
+			return Out_Of_Range;
+		}
+		bits = ((uint32_t)mant & (((uint32_t)1 << Float_Mant_Bits) - 1)) | ((uint32_t)(e + Float_Exp_Bias) << Float_Mant_Bits);
+	}
+	else bits = (uint32_t)mant; // subnormal, rounding up to the smallest normal comes out right too
+
+	// underflow as in decimal_to_float(): still below the smallest normal when rounded to 24 bits
+	bool tiny = subnormal;
+	if(e == -Float_Exp_Bias && drop > 1 && drop <= 64) {
+		// one bit more than the subnormal has
+		uint64_t top = m >> (drop - 1);
+		uint64_t rest = m & (((uint64_t)1 << (drop - 1)) - 1);
+		tiny = !(top == ((uint64_t)1 << (1 + Float_Mant_Bits)) - 1 && rest >= ((uint64_t)1 << (drop - 2)));
+	}
+	return (tiny && inexact) ? Out_Of_Range : Number_Ok;
+}
+
+
+number_status Protocol::parse_float(const char *str, size_t len, float& value, size_t& used) {
+	static const float pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f}; // all exact
+
+	used = 0;
+	size_t i = 0;
+	while(i < len && is_space(str[i])) i++;
+	uint32_t sign = 0;
+	if(i < len && (str[i] == '+' || str[i] == '-')) {
+		if(str[i] == '-') sign = Float_Sign_Bit;
+		i++;
+	}
+
+	if(match_word(str, len, i, "inf")) {
+		i += 3;
+		if(match_word(str, len, i, "inity")) i += 5;
+		value = from_bits(sign | Float_Inf_Bits);
+		used = i;
+		return Number_Ok;
+	}
+	if(match_word(str, len, i, "nan")) {
+		i += 3;
+		// "nan(chars)", taken only when the ')' is there
+		if(i < len && str[i] == '(') {
+			size_t j = i + 1;
+			while(j < len && (is_digit(str[j]) || (to_lower(str[j]) >= 'a' && to_lower(str[j]) <= 'z') || str[j] == '_')) j++;
+			if(j < len && str[j] == ')') i = j + 1;
+		}
+		value = from_bits(sign | Float_NaN_Bits);
+		used = i;
+		return Number_Ok;
+	}
+
+	uint32_t bits;
+	number_status status;
+	// "0x" with no hex digit after it is just a 0
+	if(i + 2 < len && str[i] == '0' && to_lower(str[i + 1]) == 'x'
+			&& (hex_value(str[i + 2]) >= 0 || (str[i + 2] == '.' && i + 3 < len && hex_value(str[i + 3]) >= 0))) {
+		i += 2;
+		status = parse_hex(str, len, i, bits);
+	}
+	else {
+		big_decimal a;
+		a.nd = 0;
+		a.dp = 0;
+		a.trunc = false;
+		bool digits = false, dot = false;
+		for(; i < len; i++) {
+			char c = str[i];
+			if(c == '.' && !dot) {
+				dot = true;
+				continue;
+			}
+			if(!is_digit(c)) break;
+			digits = true;
+			if(a.nd == 0 && c == '0') {
+				// leading zeros: only the ones after the point move it
+				if(dot && a.dp > -Number_Exp_Limit) a.dp--;
+				continue;
+			}
+			if(a.nd < Text_Number_Max_Digits) a.d[a.nd++] = (uint8_t)(c - '0');
+			else if(c != '0') a.trunc = true;
+			if(!dot && a.dp < Number_Exp_Limit) a.dp++;
+		}
+		if(!digits) return No_Number;
+
+		if(i < len && (str[i] == 'e' || str[i] == 'E')) {
+			int32_t exp;
+			size_t end = parse_exponent(str, len, i + 1, exp);
+			if(end > 0) {
+				a.dp += exp;
+				i = end;
+			}
+		}
+		trim(a);
+
+		if(a.nd == 0) {
+			bits = 0;
+			status = Number_Ok;
+		}
+		else {
+			// few enough digits to be an exact float, one multiply / divide by an exact 10^n rounds correctly
+			uint32_t m = 0;
+			int exp10 = 0;
+			bool fast = !a.trunc && a.nd <= 8;
+			if(fast) {
+				for(int k = 0; k < a.nd; k++) m = m * 10 + a.d[k];
+				exp10 = a.dp - a.nd;
+				while(exp10 > 10 && m * 10 < ((uint32_t)1 << 24)) {
+					m *= 10;
+					exp10--;
+				}
+				fast = m < ((uint32_t)1 << 24) && exp10 >= -10 && exp10 <= 10;
+			}
+			if(fast) {
+				float v = (exp10 >= 0) ? (float)m * pow10[exp10] : (float)m / pow10[-exp10];
+				memcpy(&bits, &v, 4);
+				status = Number_Ok;
+			}
+			else status = decimal_to_float(a, bits);
+		}
+	}
+	value = from_bits(sign | bits);
+	used = i;
+	return status;
+}
+
+bool Protocol::parse_text_command(const char *str, size_t len, velocity_payload& cmd) {
+	// like parse_cmd(): without a ',' the find() is npos and npos + 1 == 0, each field is the whole rest
+	const char *first = (const char*)memchr(str, ',', len);
+	size_t x_len = (first != NULL) ? (size_t)(first - str) : len;
+	const char *rest = (first != NULL) ? first + 1 : str;
+	size_t rest_len = len - (size_t)(rest - str);
+
+	const char *second = (const char*)memchr(rest, ',', rest_len);
+	size_t y_len = (second != NULL) ? (size_t)(second - rest) : rest_len;
+	const char *omega = (second != NULL) ? second + 1 : rest;
+	size_t omega_len = rest_len - (size_t)(omega - rest);
+
+	size_t used;
+	return parse_float(str, x_len, cmd.x, used) == Number_Ok
+		&& parse_float(rest, y_len, cmd.y, used) == Number_Ok
+		&& parse_float(omega, omega_len, cmd.omega, used) == Number_Ok;
+}
+
+
+/*** Text_Command_Reader ***/
+
+void Text_Command_Reader::reset(void) {
+	len = 0;
+	overflow = false;
+	memset(&stats, 0, sizeof(stats));
+}
+
+Text_Command_Reader::result Text_Command_Reader::feed(const uint8_t *bytes, size_t num_bytes,
+		velocity_payload& cmd, size_t& consumed) {
+	const char *chars = (const char*)bytes;
+	const char *end = (const char*)memchr(chars, delim, num_bytes);
+	if(end == NULL) {
+		if(!overflow) {
+			if(len + num_bytes > Text_Command_Max_Line_Size) overflow = true;
+			else {
+				memcpy(&line[len], chars, num_bytes);
+				len += num_bytes;
+			}
+		}
+		consumed = num_bytes;
+		return Incomplete;
+	}
+
+	size_t line_len = (size_t)(end - chars);
+	consumed = line_len + 1;
+	result r;
+	if(overflow || len + line_len > Text_Command_Max_Line_Size) {
+		stats.overflows++;
+		r = Error;
+	}
+	else if(len == 0) r = finish(chars, line_len, cmd);
+	else {
+		memcpy(&line[len], chars, line_len);
+		r = finish(line, len + line_len, cmd);
+	}
+	len = 0;
+	overflow = false;
+	return r;
+}
+
+Text_Command_Reader::result Text_Command_Reader::finish(const char *str, size_t str_len, velocity_payload& cmd) {
+	if(!parse_text_command(str, str_len, cmd)) {
+		stats.parse_errors++;
+		return Error;
+	}
+	stats.commands++;
+	return Command_Ready;
+}
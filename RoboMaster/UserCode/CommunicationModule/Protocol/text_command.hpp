@@ -0,0 +1,85 @@
+/*
+ * text_command.hpp
+ *
+ * The "x,y,omega" text commands of DjiRM::M2006::parse_cmd(), without the
+ * std::string copies: parse_text_command() reads the caller's bytes in place
+ * and parse_float() stands in for std::stof(), nothing is allocated and
+ * nothing has to be NUL terminated.
+ *
+ * Results are the same as parse_cmd()'s, quirks included: a missing ',' makes
+ * the fields repeat ("1.5" is 1.5,1.5,1.5), whatever follows a number in its
+ * field is ignored, and where std::stof() would throw (no number, or out of
+ * float range) the command is rejected. Numbers are rounded correctly like
+ * strtof(): the common ones ("0.35", "-1.2") with one float multiply or
+ * divide, the rest by exact decimal arithmetic on a fixed buffer.
+ * Not kept: the payload of "nan(...)", any NaN comes out as the default one.
+ * Where C libraries don't agree, this goes with glibc: an inexact number under
+ * FLT_MIN is out of range, and digits a hair off halfway between 2 floats
+ * still round the right way (newlib goes through a double and a cast there).
+ *
+ * HostTests/text_command_test.cpp checks both against each other on a corpus
+ * and on random mutations of it, benchmark_text_command() (Main/benchmarks.hpp)
+ * this one on the target against parse_cmd()'s results for the corpus.
+ */
+
+#ifndef TEXT_COMMAND_HPP_
+#define TEXT_COMMAND_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "robot_protocol.hpp"
+
+#define Text_Command_Max_Line_Size 64   // one USB FS packet, longer lines are dropped
+#define Text_Number_Max_Digits 200      // significant digits kept, enough for any float halfway point
+
+namespace Protocol {
+	enum number_status : int {
+		Number_Ok,
+		No_Number,       // std::stof() throws std::invalid_argument
+		Out_Of_Range     // std::stof() throws std::out_of_range (overflow, or underflow losing precision)
+	};
+
+	/* strtof() on str[0, len): leading white space, sign, decimal or hex (0x) digits,
+	 * inf / infinity / nan. used: the number of chars taken, 0 when No_Number */
+	number_status parse_float(const char *str, size_t len, float& value, size_t& used);
+
+	// one command line without its delimiter, false where parse_cmd() would throw
+	bool parse_text_command(const char *str, size_t len, velocity_payload& cmd);
+
+	// byte stream -> text commands, lines may be split across any number of feed() calls
+	class Text_Command_Reader {
+	public:
+		enum result : int {
+			Incomplete,      // bytes taken, no full line yet
+			Command_Ready,   // cmd holds the command of a new line
+			Error            // a line was dropped (too long or not a command), see get_stats()
+		};
+		struct reader_stats {
+			uint32_t commands;
+			uint32_t parse_errors;
+			uint32_t overflows;      // lines longer than Text_Command_Max_Line_Size
+		};
+
+		// same default delimiter as USB_VCP::read_line()
+		Text_Command_Reader(char delim = '\r') : delim(delim) {reset();}
+
+		/* cmd valid when Command_Ready, the bytes after its line are left for the next call.
+		 * A line that comes in whole is parsed where it is, only partial lines get copied */
+		result feed(const uint8_t *bytes, size_t num_bytes, velocity_payload& cmd, size_t& consumed);
+
+		void reset(void);
+		inline reader_stats get_stats(void) const {return stats;}
+
+	private:
+		char delim;
+		char line[Text_Command_Max_Line_Size];
+		size_t len;
+		bool overflow;
+		reader_stats stats;
+
+		result finish(const char *str, size_t str_len, velocity_payload& cmd);
+	};
+}
+
+#endif /* TEXT_COMMAND_HPP_ */
@@ -0,0 +1,68 @@
+/*
+ * telemetry_stream.cpp
+ */
+
+#include "telemetry_stream.hpp"
+
+#include <string.h>
+
+Telemetry_Stream::Telemetry_Stream(USB_VCP& usb) {
+	this->usb = &usb;
+	memset(&last_imu, 0, sizeof(last_imu));
+	memset(&frame, 0, sizeof(frame));
+	memset(&stats, 0, sizeof(stats));
+	frame.type = Protocol::Telemetry;
+}
+
+Protocol::telemetry_payload* Telemetry_Stream::begin_step(void) {
+	// keeps counting while off, so the timestamps stay right whenever the stream starts
+	uint32_t now = stf::cycles();
+	uint32_t cycles_per_us = SystemCoreClock / 1000000;
+	if(has_time) {
+		residual_cycles += now - last_cycles;
+		time_us += residual_cycles / cycles_per_us;
+		residual_cycles %= cycles_per_us;
+	}
+	last_cycles = now;
+	has_time = true;
+
+	uint8_t new_groups = requested_groups;
+	uint32_t new_decimation = requested_decimation;
+	if(new_groups != groups || new_decimation != decimation) {
+		groups = new_groups;
+		decimation = new_decimation;
+		step_cnt = 0; // first frame of the new setting right away
+	}
+	if(groups == 0 || decimation == 0) return NULL;
+	if(step_cnt > 0) {
+		if(++step_cnt >= decimation) step_cnt = 0;
+		return NULL;
+	}
+	if(decimation > 1) step_cnt = 1;
+
+	Protocol::telemetry_payload& t = frame.telemetry;
+	t.groups = groups;
+	t.decimation = (decimation > 0xFF) ? 0xFF : (uint8_t)decimation;
+	// this task preempts the IMU task, if it was halfway through a write the previous sample stays
+	if(groups & Protocol::Telemetry_IMU) {
+		Protocol::imu_telemetry sample;
+		if(imu.try_read(sample)) last_imu = sample;
+		t.imu = last_imu;
+	}
+	frame.timestamp_us = time_us;
+	return &t;
+}
+
+void Telemetry_Stream::send(void) {
+	uint32_t start = stf::cycles();
+	frame.seq = seq++;
+	size_t num_bytes = Protocol::encode(frame, encoded, sizeof(encoded));
+	if(num_bytes > 0 && usb->write(encoded, num_bytes)) {
+		stats.frames++;
+		stats.bytes += num_bytes;
+	}
+	else stats.dropped++;
+
+	float send_us = stf::cycles_to_us(stf::cycles() - start);
+	if(send_us > stats.send_max_us) stats.send_max_us = send_us;
+}
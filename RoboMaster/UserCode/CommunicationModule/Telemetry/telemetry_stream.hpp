@@ -0,0 +1,81 @@
+/*
+ * telemetry_stream.hpp
+ *
+ * Binary telemetry of the control loop over the USB virtual COM port, as
+ * Protocol::Telemetry frames (robot_protocol.hpp). Every `decimation` control
+ * steps the control task fills in the selected groups and the frame goes out
+ * through USB_VCP::write(), which never blocks: a frame the USB can't take is
+ * dropped and counted, the host sees the gap in the sequence numbers.
+ *
+ * Off until given groups and a decimation, e.g. by the host through config
+ * frames. The frame and its encoded bytes live here rather than on the control
+ * task's stack, encoding a full frame is a few us of control task time
+ * (send_max_us). A full frame (230 bytes encoded) every step at 5kHz is about
+ * 1.1MB/s, more than USB FS carries at best: pick the groups and decimation to
+ * stay well under that, or expect drops.
+ *
+ * On the host, HostLink/telemetry_log.hpp writes the frames to CSV.
+ */
+
+#ifndef TELEMETRY_STREAM_HPP_
+#define TELEMETRY_STREAM_HPP_
+
+#include "stf.h"
+#include "seqlock.hpp"
+#include "Protocol/robot_protocol.hpp"
+#include "USB/usb_device_vcp.h"
+
+#define Telemetry_Max_Decimation 65535 // ~13s between frames at 5kHz
+
+class Telemetry_Stream {
+public:
+	struct stream_stats {
+		uint32_t frames;      // handed to the USB
+		uint32_t dropped;     // no room in the USB Tx buffers (or no host)
+		uint32_t bytes;       // encoded, of the frames handed over
+		float send_max_us;    // encode + write, per frame
+	};
+
+	Telemetry_Stream(USB_VCP& usb);
+
+	/* any task, taken at the next control step */
+	// Protocol::telemetry_group bits, 0 stops the stream
+	inline void set_groups(uint8_t groups) {requested_groups = groups & Protocol::Telemetry_All;}
+	// control steps per frame (up to Telemetry_Max_Decimation), 0 stops the stream
+	inline void set_decimation(uint32_t steps) {requested_decimation = steps;}
+
+	// IMU task, the latest sample goes into the next frame
+	inline void set_imu_sample(const Protocol::imu_telemetry& sample) {imu.write(sample);}
+
+	/* control task, once per step: the payload to fill in when a frame is due, NULL otherwise.
+	 * Only its groups get sent, the IMU group is filled in already */
+	Protocol::telemetry_payload* begin_step(void);
+	// control task, right after filling in the payload of begin_step()
+	void send(void);
+
+	stream_stats get_stats(void) {return stats;}
+	inline uint16_t get_next_seq(void) {return seq;}
+
+private:
+	USB_VCP *usb;
+	volatile uint8_t requested_groups = 0;
+	volatile uint32_t requested_decimation = 0;
+	Seqlock<Protocol::imu_telemetry> imu;
+
+	/* control task only */
+	uint8_t groups = 0;
+	uint32_t decimation = 0;
+	uint32_t step_cnt = 0;
+	uint16_t seq = 0;
+	// us since the first step, from the cycle counter without losing the remainders
+	uint32_t last_cycles = 0;
+	uint32_t residual_cycles = 0;
+	uint32_t time_us = 0;
+	bool has_time = false;
+	Protocol::imu_telemetry last_imu;
+	Protocol::frame frame;
+	uint8_t encoded[Protocol_Max_Encoded_Size];
+	stream_stats stats;
+};
+
+#endif /* TELEMETRY_STREAM_HPP_ */
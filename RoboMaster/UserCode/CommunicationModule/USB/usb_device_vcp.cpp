@@ -8,21 +8,74 @@
 
 #include "usb_device_vcp.h"
 #include "FreeRTOS.h"
+#include "task.h"
+#include "seqlock.hpp"
+#include "spsc_ring.hpp"
 
 
 uint32_t num_usbvcps = 0;
 
-MessageBufferHandle_t msg_buf = NULL;
+/* Rx, written by the USB ISR (CDC_Received_FS_Callback), read by the one reading task */
+struct rx_stamp {
+	uint32_t end;    // rx_end once the packet was in, i.e. 1 past its last byte
+	uint32_t cycles; // stf::cycles() of arrival
+};
+static StreamBufferHandle_t rx_stream = NULL;
+static StaticStreamBuffer_t rx_stream_struct;
+static uint8_t rx_stream_storage[RX_RING_SIZE + 1]; // a stream buffer holds 1 byte less than its storage
+static Spsc_Ring<rx_stamp, RX_MAX_PACKETS> rx_stamps;
+static uint32_t rx_end = 0; // bytes put into the ring so far, wraps
+static Seqlock<USB_VCP::rx_stats> rx_stats_lock;
+static USB_VCP::rx_stats rx_published = {};
+
+/* Tx, written by the writing tasks inside a critical section (which keeps the
+ * USB ISR out) and by the USB ISR (CDC_Transmitted_FS_Callback).
+ * tx_tail is the oldest buffer (the one being sent while tx_in_flight),
+ * tx_head the one being filled, the ones in between are full and waiting */
+static uint8_t tx_buffers[TX_NUM_BUFFERS][TX_BUFFER_SIZE] __attribute__((aligned(4)));
+static uint32_t tx_len[TX_NUM_BUFFERS];
+static uint32_t tx_head = 0;
+static uint32_t tx_tail = 0;
+static bool tx_in_flight = false;
+static USB_VCP::tx_stats tx_published = {};
+
+// next buffer to the USB, inside a critical section or the USB ISR
+static void tx_start_next(void) {
+	while(!tx_in_flight) {
+		if(tx_tail == tx_head) {
+			if(tx_len[tx_head] == 0) return; // nothing to send
+			// idle, the one being filled goes now, the next takes the writes
+			tx_head = (tx_head + 1) % TX_NUM_BUFFERS;
+		}
+		uint8_t result = CDC_Transmit_FS(tx_buffers[tx_tail], (uint16_t)tx_len[tx_tail]);
+		if(result == USBD_OK) {
+			tx_in_flight = true;
+		}
+		else if(result == USBD_BUSY) {
+			// someone else's transfer, try again with the next write
+			tx_published.busy++;
+			return;
+		}
+		else {
+			// no host: dropped rather than piling up
+			tx_published.dropped_writes++;
+			tx_published.dropped_bytes += tx_len[tx_tail];
+			tx_len[tx_tail] = 0;
+			tx_tail = (tx_tail + 1) % TX_NUM_BUFFERS;
+		}
+	}
+}
 
 USB_VCP::USB_VCP(void) {
 	/* for consistent usage styling, real singleton pattern is chosen not to be implemented */
 	if(++num_usbvcps > 1) {
 		stf::exception("Can't instantiate more than one USB_VCP (as device)");
 	}
-	if(msg_buf == NULL) {
-		msg_buf = xMessageBufferCreate(RX_MSG_BUF_SIZE);
-		if(msg_buf == NULL) {
-			stf::exception("No enough heap for USB Rx Msg Buf");
+	if(rx_stream == NULL) {
+		// static storage, nothing taken from the FreeRTOS heap
+		rx_stream = xStreamBufferCreateStatic(sizeof(rx_stream_storage), 1, rx_stream_storage, &rx_stream_struct);
+		if(rx_stream == NULL) {
+			stf::exception("Can't create the USB Rx stream buffer");
 		}
 	}
 }
@@ -32,101 +85,214 @@ void USB_VCP::init(void) {
 }
 
 /* Tx methods*/
+bool USB_VCP::write(const uint8_t* bytes, size_t num_bytes) {
+	if(num_bytes == 0) return true;
+	bool accepted = false;
+	taskENTER_CRITICAL();
+	if(num_bytes <= TX_BUFFER_SIZE) {
+		if(tx_len[tx_head] + num_bytes > TX_BUFFER_SIZE) {
+			// full, on to the next one unless that's the one being sent
+			uint32_t next = (tx_head + 1) % TX_NUM_BUFFERS;
+			if(next != tx_tail) tx_head = next;
+		}
+		if(tx_len[tx_head] + num_bytes <= TX_BUFFER_SIZE) {
+			memcpy(&tx_buffers[tx_head][tx_len[tx_head]], bytes, num_bytes);
+			tx_len[tx_head] += num_bytes;
+			accepted = true;
+		}
+	}
+	if(accepted) {
+		tx_published.writes++;
+		tx_published.bytes_written += num_bytes;
+		if(tx_in_flight) tx_published.coalesced_writes++;
+		tx_start_next();
+
+		uint32_t queued = 0;
+		for(uint32_t b = 0; b < TX_NUM_BUFFERS; b++) queued += tx_len[b];
+		if(queued > tx_published.max_queued) tx_published.max_queued = queued;
+	}
+	else {
+		tx_published.dropped_writes++;
+		tx_published.dropped_bytes += num_bytes;
+	}
+	taskEXIT_CRITICAL();
+	return accepted;
+}
+
 void USB_VCP::send_packet(std::string& str) {
-	char *cstr = (char*)str.c_str();
-	CDC_Transmit_FS((byte_t*)cstr, strlen(cstr));
+	send_packet((byte_t*)str.data(), (uint16_t)str.length());
 }
 void USB_VCP::send_packet(const char* str) {
-	CDC_Transmit_FS((byte_t*)str, strlen(str));
+	send_packet((byte_t*)str, (uint16_t)strlen(str));
 }
 
 void USB_VCP::send_packet(byte_t* bytes_ptr, uint16_t num_bytes) {
-	CDC_Transmit_FS(bytes_ptr, num_bytes);
+	while(num_bytes > 0) {
+		uint16_t n = (num_bytes > TX_BUFFER_SIZE) ? TX_BUFFER_SIZE : num_bytes;
+		write(bytes_ptr, n);
+		bytes_ptr += n;
+		num_bytes -= n;
+	}
+}
+
+USB_VCP::tx_stats USB_VCP::get_tx_stats(void) {
+	taskENTER_CRITICAL();
+	tx_stats stats = tx_published;
+	taskEXIT_CRITICAL();
+	return stats;
 }
 
 /* Rx methods*/
-std::string& USB_VCP::read_some() {
-	size_t num_bytes_received;
-	do {
-		num_bytes_received = xMessageBufferReceive(msg_buf,
-				(void*)rx_msg_buf, 64 , 300);
+size_t USB_VCP::read(uint8_t* bytes, size_t size, uint32_t& rx_cycles) {
+	if(size == 0) return 0;
+
+	// what read_line() left of its last packet goes first
+	if(num_pending > 0) {
+		size_t n = (size < num_pending) ? size : num_pending;
+		memcpy(bytes, &pending[pending_begin], n);
+		pending_begin += n;
+		num_pending -= n;
+		rx_cycles = pending_cycles;
+		return n;
+	}
 
-	} while(num_bytes_received <= 0);
+	// 1 byte to wait on, the stamp of its packet is in by then (same ISR)
+	while(xStreamBufferReceive(rx_stream, bytes, 1, portMAX_DELAY) == 0);
+	rx_read++;
+	rx_stamp stamp;
+	if(!rx_stamps.peek(stamp)) {
+		stamp.end = rx_read;
+		stamp.cycles = stf::cycles();
+	}
 
-	some_str = std::string((const char*)rx_msg_buf, num_bytes_received);
-	return some_str;
+	// then the rest of that packet, as much as fits
+	size_t n = 1;
+	size_t left = stamp.end - rx_read;
+	if(left > size - 1) left = size - 1;
+	if(left > 0) n += xStreamBufferReceive(rx_stream, bytes + 1, left, 0);
+	rx_read += n - 1;
 
+	rx_cycles = stamp.cycles;
+	if(rx_read == stamp.end) rx_stamps.pop();
+	return n;
 }
 
-std::string USB_VCP::read_line(char delim) {
-	std::string str;
-	size_t length;
-	while(1){
-		str = read_some();
-//		str = "Testing\r read_line";
-
-		length = str.find(delim);
-
-		if(length == std::string::npos){
-			continue;
+size_t USB_VCP::read_line(char* line, size_t size, uint32_t& rx_cycles, char delim) {
+	size_t len = 0;
+	bool overflow = false;
+	while(1) {
+		if(num_pending == 0) {
+			num_pending = read(pending, sizeof(pending), pending_cycles);
+			pending_begin = 0;
+		}
+		const uint8_t *begin = &pending[pending_begin];
+		const uint8_t *end = (const uint8_t*)memchr(begin, delim, num_pending);
+		size_t n = (end != NULL) ? (size_t)(end - begin) : num_pending;
+		if(!overflow) {
+			if(len + n < size) {
+				memcpy(&line[len], begin, n);
+				len += n;
+			}
+			else overflow = true;
+		}
+		size_t taken = (end != NULL) ? n + 1 : n;
+		pending_begin += taken;
+		num_pending -= taken;
+
+		if(end != NULL) {
+			if(!overflow) {
+				line[len] = '\0';
+				rx_cycles = pending_cycles;
+				return len;
+			}
+			// too long, dropped up to here, on with the next one
+			line_overflows++;
+			len = 0;
+			overflow = false;
 		}
-
-		line_str = str.substr(0, length);
-		break;
 	}
-
-
-//    std::getline(rx_ss, line_str, '\n');
-	return line_str;
-
 }
 
-//std::string USB_VCP::read_line(char delim) {
-//	std::string str;
-//	do {
-//		str = read_some();
-//		rx_ss << str;
-//	} while(str.find(delim) == std::string::npos); // if delimiter not found, keep read_some()
-//    std::getline(rx_ss, line_str, delim);
-//	return line_str;
-//}
-
-// char* USB_VCP::read_bytes() {
-// 	size_t num_bytes_received;
-// 	do {
-// 		num_bytes_received = xMessageBufferReceive(msg_buf,
-// 				(void*)rx_msg_buf, sizeof(rx_msg_buf), 300);
-// 	} while(num_bytes_received <= 0);
+std::string& USB_VCP::read_some() {
+	uint32_t rx_cycles;
+	return read_some(rx_cycles);
+}
 
-// 	some_str = std::string((const char*)rx_msg_buf, num_bytes_received);
-// 	return some_str;
-// }
+std::string& USB_VCP::read_some(uint32_t& rx_cycles) {
+	uint8_t bytes[PACKET_SIZE];
+	size_t num_bytes = read(bytes, sizeof(bytes), rx_cycles);
+	some_str.assign((const char*)bytes, num_bytes);
+	return some_str;
+}
 
+std::string USB_VCP::read_line(char delim) {
+	char line[RX_LINE_SIZE];
+	uint32_t rx_cycles;
+	size_t length = read_line(line, sizeof(line), rx_cycles, delim);
+	return std::string(line, length);
+}
 
+USB_VCP::rx_stats USB_VCP::get_rx_stats(void) {
+	rx_stats stats = rx_stats_lock.read();
+	stats.line_overflows = line_overflows;
+	return stats;
+}
 
-char tmp[PACKET_SIZE];
 // invoked during the interrupt that a packet is received (ISR Callback)
 void CDC_Received_FS_Callback(char* buf, uint32_t len) {
 	BaseType_t higher_priority_task_woken = pdFALSE; // change to true if a higher priority task is waiting for msg from this ISR callback
-	size_t num_bytes_sent;
 	// Avoid using c++ exclusive things in this part that runs in an ISR
-	if(len <= PACKET_SIZE) {
-		strncpy(tmp, buf, len);
-
-		// send string to msg buf
-		num_bytes_sent = xMessageBufferSendFromISR(msg_buf,
-				(void*)tmp, len, &higher_priority_task_woken);
+	if(rx_stream == NULL || len == 0 || len > PACKET_SIZE) return;
+
+	// arrival time first, commands are aged from here
+	uint32_t rx_cycles = stf::cycles();
+
+	/* the whole packet or nothing: a frame or line cut in the middle would turn
+	 * into garbage once the rest comes in. Binary frames have 0 bytes in them, copied as is */
+	if(xStreamBufferSpacesAvailable(rx_stream) >= len && rx_stamps.free_space() > 0) {
+		xStreamBufferSendFromISR(rx_stream, (const void*)buf, len, &higher_priority_task_woken);
+		rx_end += len;
+		rx_stamp stamp = {rx_end, rx_cycles};
+		rx_stamps.push(stamp);
+
+		rx_published.packets++;
+		rx_published.bytes += len;
+		uint32_t used = RX_RING_SIZE - xStreamBufferSpacesAvailable(rx_stream);
+		if(used > rx_published.max_used) rx_published.max_used = used;
+	}
+	else {
+		rx_published.dropped_packets++;
+		rx_published.dropped_bytes += len;
+	}
+	rx_stats_lock.write(rx_published);
 
-		if(num_bytes_sent != len) {
-			// when buffer have no space left to enqueue
-			/* No good way to handle this situation, simple discard any
-			 * received packet once buffer is full */
-		}
+	// the reading task gets the command right away, not at the next tick
+	portYIELD_FROM_ISR(higher_priority_task_woken);
+}
 
-		// (user defined) taskYIELD_FROM_ISR(higher_priority_task_woken);
+// invoked during the interrupt that a transfer is done (ISR Callback)
+void CDC_Transmitted_FS_Callback(uint8_t* buf, uint32_t len) {
+	(void)buf;
+	if(!tx_in_flight) return; // not one of ours
+	tx_published.transfers++;
+	tx_published.bytes_sent += len;
+	tx_len[tx_tail] = 0;
+	tx_tail = (tx_tail + 1) % TX_NUM_BUFFERS;
+	tx_in_flight = false;
+	tx_start_next();
+}
 
+/* invoked from CDC_Init_FS() / CDC_DeInit_FS(), in the USB ISR on a bus reset or unplug.
+ * A transfer cut off there never completes, tx_in_flight would stay set and no
+ * write would go out again: whatever was queued is dropped, the host is gone or starting over */
+void CDC_Reset_FS_Callback(void) {
+	UBaseType_t saved_mask = taskENTER_CRITICAL_FROM_ISR();
+	for(uint32_t b = 0; b < TX_NUM_BUFFERS; b++) {
+		tx_published.dropped_bytes += tx_len[b];
+		tx_len[b] = 0;
 	}
+	tx_head = 0;
+	tx_tail = 0;
+	tx_in_flight = false;
+	taskEXIT_CRITICAL_FROM_ISR(saved_mask);
 }
-
-
-
@@ -13,11 +13,15 @@
 #include "stf.h"
 #include "usbd_cdc_if.h"
 
-#include "message_buffer.h"
+#include "stream_buffer.h"
 #include <iostream>
 
 #define PACKET_SIZE 64 // 64 bytes is the default packet size for USB2.0 FS
-#define RX_MSG_BUF_SIZE 64 // bytes
+#define RX_RING_SIZE 1024 // bytes, a burst of 16 full packets
+#define RX_MAX_PACKETS 32 // packets waiting in the ring at once (their arrival stamps), a power of 2
+#define RX_LINE_SIZE 128 // longest line of read_line() returning a std::string
+#define TX_NUM_BUFFERS 3 // one being sent, the others filling up / waiting behind it
+#define TX_BUFFER_SIZE 512 // bytes per USB transfer, 8 full packets
 
 /* This is not a complete library class that deals with much more edge cases,
  * but it can be upgraded to be like one of the stm32-thalamus-framework(stf)
@@ -35,27 +39,77 @@ public:
 
 	void init(void);
 
-	/* Tx methods*/
+	/* Tx methods, from any task, they never block.
+	 * Bytes are copied into one of TX_NUM_BUFFERS buffers and sent from there,
+	 * the transmit complete interrupt starts the next one. While a transfer is
+	 * going, writes pile up behind it and leave together as full 64 byte packets;
+	 * with nothing going, a write is sent right away. */
+	struct tx_stats {
+		uint32_t writes;           // accepted
+		uint32_t bytes_written;
+		uint32_t transfers;        // completed
+		uint32_t bytes_sent;
+		uint32_t coalesced_writes; // had to wait behind a transfer (backpressure)
+		uint32_t dropped_writes;   // no room left, or no host
+		uint32_t dropped_bytes;
+		uint32_t busy;             // CDC_Transmit_FS() busy when it shouldn't be, retried
+		uint32_t max_queued;       // most bytes waiting at once
+	};
+
+	// all or nothing (at most TX_BUFFER_SIZE bytes), false and counted when there's no room
+	bool write(const uint8_t* bytes, size_t num_bytes);
+	// longer ones are split into TX_BUFFER_SIZE writes
 	void send_packet(std::string& str);
 	void send_packet(const char* str);
 	void send_packet(byte_t* bytes_ptr, uint16_t num_bytes);
 
-	/* Rx methods*/
+	tx_stats get_tx_stats(void);
+
+	/* Rx methods, from one task only.
+	 * Packets go from the USB ISR into a byte ring (RX_RING_SIZE), whole or not at
+	 * all when it's full, so binary frames and lines can be put back together
+	 * across packets; a Protocol::Decoder takes read() bytes as they come. */
+	struct rx_stats {
+		uint32_t packets;
+		uint32_t bytes;
+		uint32_t dropped_packets;  // ring full (or too many packets in it)
+		uint32_t dropped_bytes;
+		uint32_t max_used;         // most bytes in the ring at once
+		uint32_t line_overflows;   // read_line(): lines too long for the caller's buffer, dropped
+	};
+
+	/* waits for data, then up to size bytes, all of the same packet.
+	 * rx_cycles: stf::cycles() when that packet arrived (USB ISR), for command deadlines / latency */
+	size_t read(uint8_t* bytes, size_t size, uint32_t& rx_cycles);
+	/* next line without the delimiter, NUL terminated in line[size], returns its length.
+	 * rx_cycles: arrival of the packet with the delimiter, i.e. when the line was complete */
+	size_t read_line(char* line, size_t size, uint32_t& rx_cycles, char delim = '\r');
+
 	std::string& read_some(void);
+	std::string& read_some(uint32_t& rx_cycles);
 	std::string read_line(char delim = '\r');
 
+	rx_stats get_rx_stats(void);
+
 
 	inline uint32_t get_tx_buffer_size(void) {return APP_TX_DATA_SIZE;}
 	inline uint32_t get_rx_buffer_size(void) {return APP_RX_DATA_SIZE;}
 private:
-	std::stringstream rx_ss;
 	std::string some_str;
-	std::string line_str;
-	char rx_msg_buf[RX_MSG_BUF_SIZE];
+	uint32_t rx_read = 0; // bytes taken out of the ring so far, wraps
+
+	// rest of a packet after the delimiter read_line() stopped at
+	uint8_t pending[PACKET_SIZE];
+	size_t pending_begin = 0;
+	size_t num_pending = 0;
+	uint32_t pending_cycles = 0;
+	uint32_t line_overflows = 0;
 };
 
 
 extern "C" void CDC_Received_FS_Callback(char* buf, uint32_t len);
+extern "C" void CDC_Transmitted_FS_Callback(uint8_t* buf, uint32_t len);
+extern "C" void CDC_Reset_FS_Callback(void);
 
 
 
@@ -2,8 +2,19 @@
 #include "USB/usb_device_vcp.h"
 #include "usbd_cdc_if.h"
 #include "Motor/dji_m2006_motor.hpp"
+#include "Chassis/omni_kinematics.hpp"
+#include "Chassis/odometry.hpp"
+#include "Chassis/velocity_profile.hpp"
+#include "Chassis/traction_control.hpp"
+#include "Chassis/heading_control.hpp"
+#include "Chassis/command_watchdog.hpp"
+#include "Protocol/robot_protocol.hpp"
+#include "Telemetry/telemetry_stream.hpp"
 #include "IMU/mpu6500_ist8310.hpp"
 #include "IMU/Adafruit_AHRS_Mahony.h"
+#include "control_scheduler.hpp"
+#include "benchmarks.hpp"
+#include "motor_autotune.hpp"
 #include "FreeRTOS.h"
 #include "queue.h"
 
@@ -28,7 +39,14 @@ GPIO motor_power_switch_04(Motor_Power_Switch_04_GPIO_Port, Motor_Power_Switch_0
 extern TIM_HandleTypeDef htim2;
 Timer pwm_signal(&htim2, 2, TIM32Bit);
 
+// TIM7 update interrupt paces the motor control loop (updatePIDLoop)
+extern TIM_HandleTypeDef htim7;
+Timer ctrl_timer(&htim7, 2, TIM16Bit);
+ControlScheduler ctrl_scheduler(ctrl_timer);
+
 USB_VCP usb;
+// control loop signals to the host, sampled in updatePIDLoop, off until configured (setup() or host config frames)
+Telemetry_Stream telemetry(usb);
 extern uint8_t buffer[64];
 
 extern UART_HandleTypeDef huart2;
@@ -38,6 +56,31 @@ extern CAN_HandleTypeDef hcan1;
 // DJI EX: P = 1.5, I = 0.1
 DjiRM::M2006_Motor motors(&hcan1, 1.5, 10, 0); // Manually Enter PID consts here (P.S.: can also use update_pid_const(...) to dynamically updating them later)
 
+// X layout omni chassis, wheel speeds come out in % of max motor velocity (36:1 gearbox, 19100rpm max rotor speed)
+static const float wheel_angles_rad[4] = {-Pi / 4, -3 * Pi / 4, 3 * Pi / 4, Pi / 4}; // RF, RB, LB, LF
+Omni_Kinematics chassis_kinematics(wheel_angles_rad, 0.030f, 0.150f, // wheel radius, center to wheel distance (m)
+                                   36.00f * 60.00f / (2.00f * Pi) / 19100.00f * 100.00f);
+/* host commands are clamped to what a wheel at 100% (19100rpm / 36 on a 30mm radius, 1.67m/s)
+ * gives on its own: along x or y at 45 deg to all 4 wheels, or turning 150mm from the center */
+static const float chassis_max_xy = 2.35f;     // m/s
+static const float chassis_max_omega = 11.10f; // rad/s
+// dead-reckoned pose, integrated in updatePIDLoop
+Odometry odometry(chassis_kinematics);
+// ramps the chassis between host velocity commands, run in updatePIDLoop once given a target
+Velocity_Profile chassis_profile;
+// wheel slip against the IMU, limits the current of slipping wheels in updatePIDLoop
+Traction_Control traction(chassis_kinematics);
+// closes omega on the gyro (updateIMULoop), off until given a rate or a heading
+Heading_Control heading;
+// absolute heading selected by the host (Heading_Hold config), set by actuatorsLoop, followed by updatePIDLoop
+volatile bool heading_hold = false;
+volatile float heading_hold_rad = 0;
+// host commands go through here (actuatorsLoop), past the deadline the chassis ramps down and stops
+Command_Watchdog command_watchdog;
+bool stopping_chassis = false; // control task only
+// binary host frames, actuatorsLoop only
+Protocol::Decoder host_decoder;
+
 extern SPI_HandleTypeDef hspi4;
 SPI ras_spi(&hspi4);
 
@@ -52,6 +95,8 @@ GPIO ist8310_reset(IST8310_Reset_GPIO_Port, IST8310_Reset_Pin);
 bool blinkLED_switch = true;
 
 bool has_setup = false;
+// white button pressed (defaultLoop), host velocity commands are ignored until then
+volatile bool motors_armed = false;
 
 QueueHandle_t io_message_queue;
 
@@ -67,6 +112,9 @@ void setup(void) {
     motor_power_switch_04.write(High);
 
 	motors.init();
+	motors.set_power_budget(100.00f); // W, 4 wheels at full current together sag the battery
+	ctrl_scheduler.init(motors.get_ctrl_freq_Hz());
+	traction.set_timing(10, 250, 20.00f, 1.00f / motors.get_ctrl_freq_Hz()); // 2ms to detect, 50ms to clear
 
 	pwm_signal.init_pwm_generation(1000, 1000);
 	pwm_signal.pwm_generation_begin(Channel2);
@@ -74,6 +122,7 @@ void setup(void) {
 	io_message_queue = xQueueCreate(3, 64);
 
 	usb.init();
+	// telemetry.set_groups(Protocol::Telemetry_All); telemetry.set_decimation(5); // 1kHz of every signal without a host asking
 
     byte_t id = imu.init(ist8310_reset);
     imu.calibrate();
@@ -86,20 +135,24 @@ void setup(void) {
 void defaultLoop(void) {
 	if(!has_setup) return;
 
+	// benchmark_pid(serial); // cycle counts of the control step, run it before the motors get enabled
+	// benchmark_fixed_point_pid(serial);
+	// benchmark_linear_map(serial);
+	// benchmark_text_command(serial); // also checks it against parse_cmd()'s results
+
     // wait until white button is pressed to proceed, for safety reasons
+	// (updatePIDLoop is the only task sending currents, so hold it at zero velocity)
 	while(button.read() == Low){
-		motors.set_current(0, 0, 0, 0);
+		motors.stop();
+		delay(1);
 	}
+	motors_armed = true;
 
+	// autotune_motors(motors, serial); // re-tune the velocity loops, e.g. after a wheel or carpet change
     // motors.motor_test(DjiRM::Motor2);
-	while(true){
-//		motors.set_velocity(10, 10, 10, 10);
-////		delay(2000);
-		motors.set_velocity(25, 25, 25, 25);
-		delay(2000);
-////		motors.set_velocity(50, 50, 50, 50);
-//		delay(2000);
-////		motors.set_velocity(100, 100, 100, 100);
+	// from here on only host commands move the chassis (actuatorsLoop -> command_watchdog -> updatePIDLoop)
+	while(true) {
+		delay(1000);
 	}
 
 // Check if motor runs
@@ -143,16 +196,174 @@ void blinkLEDLoop(void) {
    }
 }
 
+/* new host command into the profile (heading control follows its omega), or past the deadline: ramp to 0
+ * (at the profile's limits), then stop() once there */
+static void update_command_watchdog(void) {
+	Command_Watchdog::chassis_command cmd;
+	switch(command_watchdog.poll(cmd)) {
+	case Command_Watchdog::New_Command:
+		// holding a heading, the profile's omega stays 0 for when it's released
+		chassis_profile.set_target(cmd.x, cmd.y, heading_hold ? 0 : cmd.omega);
+		motors.tag_next_command(cmd.arrival_cycles); // arrival -> CAN frame latency
+		stopping_chassis = false;
+		break;
+	case Command_Watchdog::Deadline_Missed:
+		chassis_profile.set_target(0, 0, 0);
+		stopping_chassis = true;
+		break;
+	default:
+		break;
+	}
+
+	if(stopping_chassis) {
+		Body_velocity v = chassis_profile.get_setpoint();
+		if(v.x == 0 && v.y == 0 && v.omega == 0) {
+			chassis_profile.reset();
+			heading.disable();
+			motors.stop();
+			stopping_chassis = false;
+		}
+	}
+}
+
+// next chassis setpoint (omega from heading control when on), straight into the velocity loops; the only set_velocity() caller once armed
+static void update_chassis_profile(float dt_s) {
+	Body_velocity body;
+	if(!chassis_profile.step(dt_s, body)) return;
+	/* the profiled omega is the rate setpoint, closed on the gyro while heading control is on,
+	 * or the host's absolute heading (ramping down to a stop goes back to the profile's omega) */
+	if(heading_hold && !stopping_chassis) heading.set_heading(heading_hold_rad);
+	else heading.set_rate(body.omega);
+	heading.get_omega_command(body.omega);
+	Wheel_speeds ws = chassis_kinematics.body_to_wheel(body);
+	motors.set_velocity(ws.RF, ws.RB, ws.LB, ws.LF);
+}
+
+// wheel velocities in % of max, Motor1~4 drive RF, RB, LB, LF
+static void update_odometry(float dt_s) {
+	DjiRM::feedback_snapshot snapshot = motors.get_feedback_snapshot();
+	Wheel_speeds wheels;
+	wheels.RF = motors.get_velocity(snapshot, DjiRM::Motor1);
+	wheels.RB = motors.get_velocity(snapshot, DjiRM::Motor2);
+	wheels.LB = motors.get_velocity(snapshot, DjiRM::Motor3);
+	wheels.LF = motors.get_velocity(snapshot, DjiRM::Motor4);
+	odometry.update(wheels, dt_s);
+}
+
+// current limits of the coming step from how the wheels followed the IMU in the last one
+static void update_traction(void) {
+	DjiRM::feedback_snapshot snapshot = motors.get_feedback_snapshot();
+	Wheel_speeds wheels;
+	wheels.RF = motors.get_velocity(snapshot, DjiRM::Motor1);
+	wheels.RB = motors.get_velocity(snapshot, DjiRM::Motor2);
+	wheels.LB = motors.get_velocity(snapshot, DjiRM::Motor3);
+	wheels.LF = motors.get_velocity(snapshot, DjiRM::Motor4);
+	float commands[4];
+	for(int i = 0; i < 4; i++) commands[i] = motors.get_current_command((DjiRM::motor_id)i);
+	traction.update(wheels, commands);
+	for(int i = 0; i < 4; i++) motors.set_current_limit((DjiRM::motor_id)i, traction.get_current_limit(i));
+}
+
+static void fill_latency_summary(Protocol::latency_summary& summary, const Latency_Histogram::histogram& h) {
+	summary.p50_us = h.percentile_us(50);
+	summary.p99_us = h.percentile_us(99);
+	summary.max_us = h.max_us;
+	summary.count = h.total;
+}
+
+// every few control steps (see Telemetry_Stream), what this step read and commanded
+static void update_telemetry(void) {
+	Protocol::telemetry_payload *t = telemetry.begin_step();
+	if(t == NULL) return;
+
+	if(t->groups & Protocol::Telemetry_Motors) {
+		DjiRM::feedback_snapshot snapshot = motors.get_feedback_snapshot();
+		for(int i = 0; i < 4; i++) {
+			t->motor[i].angle = snapshot.motor[i].angle;
+			t->motor[i].speed = snapshot.motor[i].speed;
+			t->motor[i].current = snapshot.motor[i].current;
+			t->motor[i].velocity = motors.get_velocity(snapshot, (DjiRM::motor_id)i);
+		}
+	}
+	if(t->groups & Protocol::Telemetry_Setpoints) {
+		for(int i = 0; i < 4; i++) {
+			t->setpoint[i].velocity = motors.get_velocity_setpoint((DjiRM::motor_id)i);
+			t->setpoint[i].current = motors.get_current_command((DjiRM::motor_id)i);
+		}
+	}
+	if(t->groups & Protocol::Telemetry_PID) {
+		for(int i = 0; i < 4; i++) {
+			Batch_INC_PID_Controller<4>::terms terms = motors.get_velocity_loop_terms((DjiRM::motor_id)i);
+			t->pid[i].p = terms.p;
+			t->pid[i].i = terms.i;
+			t->pid[i].d = terms.d;
+			t->pid[i].ff = terms.ff;
+		}
+	}
+	if(t->groups & Protocol::Telemetry_Timing) {
+		// of the previous step, this one isn't over yet
+		ControlScheduler::timing_stats ts = ctrl_scheduler.get_timing_stats();
+		t->timing.period_us = ts.period_us;
+		t->timing.exec_us = ts.exec_us;
+		t->timing.jitter_max_us = ts.jitter_max_us;
+		t->timing.overruns = ts.overruns;
+	}
+	if(t->groups & Protocol::Telemetry_Latency) {
+		// the age histogram is written by this task (poll()), the CAN one by the CAN Tx ISR, which preempts it
+		fill_latency_summary(t->latency.command_age, command_watchdog.get_age_histogram());
+		fill_latency_summary(t->latency.can_origin, motors.get_command_latency());
+	}
+	telemetry.send();
+}
+
+/* Runs at the pid frequency set in motors (default 5kHz), which is faster
+ * than the RTOS tick, so the task is woken by the TIM7 interrupt rather than osDelay */
 void updatePIDLoop(void) {
 	if (has_setup) {
-		motors.pid_update_motor_currents();
-		delay(motors.get_ctrl_period_ms());
+		float dt_s = 1.00f / motors.get_ctrl_freq_Hz();
+		ctrl_scheduler.begin();
+		while(true) {
+			ctrl_scheduler.wait_for_next_period();
+			update_command_watchdog();
+			update_chassis_profile(dt_s);
+			update_traction();
+			motors.pid_update_motor_currents();
+			update_odometry(dt_s);
+			update_telemetry();
+			ctrl_scheduler.period_completed();
+		}
 	}
 
 	delay(1000);
 }
 
+/* Accel and gyro for traction and heading control at 1kHz, in SI units in the body frame
+ * (+-8g: 4096 LSB/g, +-2000dps: 16.4 LSB/dps) */
 void updateIMULoop(void) {
+	if(has_setup) {
+		while(true) {
+			MPU6500_IST8310::data accel = imu.read_accel_data();
+			MPU6500_IST8310::data gyro = imu.read_gyro_data();
+			Imu_sample sample;
+			sample.ax = accel.x * (9.80665f / 4096.00f);
+			sample.ay = accel.y * (9.80665f / 4096.00f);
+			sample.gz = gyro.z * ((float)Pi / 180.00f / 16.40f);
+			sample.timestamp = stf::cycles();
+			traction.set_imu_sample(sample);
+			heading.update(sample.gz, sample.timestamp);
+
+			Protocol::imu_telemetry imu_telemetry;
+			imu_telemetry.accel[0] = sample.ax;
+			imu_telemetry.accel[1] = sample.ay;
+			imu_telemetry.accel[2] = accel.z * (9.80665f / 4096.00f);
+			imu_telemetry.gyro[0] = gyro.x * ((float)Pi / 180.00f / 16.40f);
+			imu_telemetry.gyro[1] = gyro.y * ((float)Pi / 180.00f / 16.40f);
+			imu_telemetry.gyro[2] = sample.gz;
+			telemetry.set_imu_sample(imu_telemetry);
+			delay(1);
+		}
+	}
+
 //	if(has_setup) {
 //		uint32_t update_period = (uint32_t) (1000.00f / ahrs_update_freq);
 //		MPU6500_IST8310::data accel, gyro, mag;
@@ -181,6 +392,31 @@ void updateIMULoop(void) {
 	delay(1000);
 }
 
+static void print_can_health(DjiRM::M2006_Motor& motor) {
+	CAN_Health *health = motor.get_can_health();
+	health->sample();
+	CAN_Health::bus_stats stats = health->get_stats();
+	serial << "[CAN state: " << (int)stats.state << "][TEC: " << (int)stats.tec << "][REC: " << (int)stats.rec << "]";
+	serial << "[Errors/s: " << (int)stats.protocol_error_rate << "][Bus-off: " << stats.bus_off_cnt
+		   << ", recovered in " << (int)stats.bus_off_recovery_max_us << "us max][Overruns: " << stats.rx_overruns << "]" << stf::endl;
+
+	uint32_t first_feedback_id = 0x201 + motor.get_esc_group() * 4;
+	for(uint32_t id = first_feedback_id; id < first_feedback_id + 4; id++) {
+		CAN_Health::id_stats id_stats;
+		if(!health->get_id_stats(id, id_stats)) {
+			serial << "[ESC " << (int)(id - 0x200) << ": never seen]";
+			continue;
+		}
+		serial << "[ESC " << (int)(id - 0x200) << ": " << (int)id_stats.frame_rate << "Hz, "
+			   << (int)id_stats.last_seen_age_us << "us ago]";
+	}
+	serial << stf::endl;
+}
+
+/* CAN, traction, power, command, USB, telemetry and heading stats, once a second on the debug UART.
+ * Off by default: the dump is ~8 lines at 115200 baud, set to true while debugging on the bench */
+static const bool print_stats = false;
+
 // Allows for continuous output of motor info
 void printInfoLoop(void) {
 	int16_t speed;
@@ -189,14 +425,58 @@ void printInfoLoop(void) {
 
 	if (has_setup) {
 		// serial << "Motor on" << stf::endl;
-		angle = motors.get_raw_angle(DjiRM::Motor1);
-		speed = motors.get_raw_speed(DjiRM::Motor1);
-		current = motors.get_raw_current(DjiRM::Motor1);
+		DjiRM::feedback_snapshot snapshot = motors.get_feedback_snapshot();
+		angle = snapshot.motor[DjiRM::Motor1].angle;
+		speed = snapshot.motor[DjiRM::Motor1].speed;
+		current = snapshot.motor[DjiRM::Motor1].current;
 		serial << "[Angle : " << angle  << "]";
 		serial << "[Speed : " << speed  << "]";
 		serial << "[Current: " << current << "]";
 		serial << "[Time stamp: " << millis() << "]" << stf::endl;
 
+		// CAN bus health and the rest of the stats, once a second
+		static uint32_t health_sample_cnt = 0;
+		if(print_stats && ++health_sample_cnt >= 100) {
+			health_sample_cnt = 0;
+			print_can_health(motors);
+
+			Traction_Control::traction_status ts = traction.get_status();
+			serial << "[Traction IMU: " << (ts.imu_ok ? "ok" : "none") << "][Slipping: " << (int)ts.slipping
+				   << "][Slip events: " << ts.slip_events[0] << ", " << ts.slip_events[1] << ", "
+				   << ts.slip_events[2] << ", " << ts.slip_events[3] << "][Yaw mismatch steps: "
+				   << ts.yaw_mismatch_steps << "]" << stf::endl;
+
+			Power_Limiter::power_status ps = motors.get_power_status();
+			serial << "[Power: " << (int)ps.power_W << "W][Scale x1000: " << (int)(ps.power_scale * 1000) << "][Heat: "
+				   << (int)ps.heat[0] << "%, " << (int)ps.heat[1] << "%, " << (int)ps.heat[2] << "%, " << (int)ps.heat[3] << "%]"
+				   << "[Power limited steps: " << ps.power_limited_steps << "]" << stf::endl;
+
+			Latency_Histogram::histogram age = command_watchdog.get_age_histogram();
+			Latency_Histogram::histogram e2e = motors.get_command_latency();
+			Command_Watchdog::watchdog_stats ws = command_watchdog.get_stats();
+			serial << "[Commands: " << ws.num_commands << "][Deadline missed: " << ws.num_deadline_missed
+				   << "][Stale: " << ws.num_stale << "][Age p50/p99/max: " << age.percentile_us(50) << "/"
+				   << age.percentile_us(99) << "/" << age.max_us << "us][Arrival to CAN p50/p99/max: "
+				   << e2e.percentile_us(50) << "/" << e2e.percentile_us(99) << "/" << e2e.max_us << "us]" << stf::endl;
+
+			USB_VCP::rx_stats us = usb.get_rx_stats();
+			serial << "[USB Rx packets: " << us.packets << "][Dropped: " << us.dropped_packets << " ("
+				   << us.dropped_bytes << " bytes)][Ring max: " << us.max_used << "/" << RX_RING_SIZE
+				   << " bytes][Line overflows: " << us.line_overflows << "]" << stf::endl;
+			USB_VCP::tx_stats ut = usb.get_tx_stats();
+			serial << "[USB Tx transfers: " << ut.transfers << "][Bytes: " << ut.bytes_sent << "][Coalesced: "
+				   << ut.coalesced_writes << "][Dropped: " << ut.dropped_writes << " (" << ut.dropped_bytes
+				   << " bytes)][Queue max: " << ut.max_queued << " bytes]" << stf::endl;
+
+			Telemetry_Stream::stream_stats tel = telemetry.get_stats();
+			serial << "[Telemetry frames: " << tel.frames << "][Dropped: " << tel.dropped << "][Bytes: " << tel.bytes
+				   << "][Send max: " << (int)tel.send_max_us << "us]" << stf::endl;
+
+			Heading_Control::heading_status hs = heading.get_status();
+			serial << "[Heading mode: " << (int)hs.mode << "][Heading x1000: " << (int)(hs.heading * 1000)
+				   << "][Yaw rate x1000: " << (int)(hs.rate * 1000) << "][Omega x1000: " << (int)(hs.omega * 1000) << "]" << stf::endl;
+		}
+
 		// float or double CANNOT be printed
 	//	serial << (int32_t)(motors.get_velocity(DjiRM::Motor3)*100.00 / 100.0) << "."
 	//			<< (int32_t)(motors.get_velocity(DjiRM::Motor3)*100.00) % 100 << stf::endl;
@@ -208,63 +488,104 @@ void printInfoLoop(void) {
 //	delay(1000);
 }
 
+// config frames, applied from the task reading the host
+static void apply_host_config(const Protocol::config_payload& config) {
+	switch(config.key) {
+	/* out of range (or NaN) values are ignored, the setting stays as it was.
+	 * Deadline: 0 would make every command stale, past CYCCNT's ~25s wrap it never fires.
+	 * Accelerations: at 0 the profile never ramps down to the stop after a missed deadline.
+	 * Telemetry: converting out of range to an integer would be undefined */
+	case Protocol::Command_Deadline_ms:
+		if(config.value >= 1.00f && config.value <= 20000.00f) command_watchdog.set_deadline_ms(config.value);
+		break;
+	case Protocol::Power_Budget_W:
+		if(config.value >= 0) motors.set_power_budget(config.value); // 0 turns it off
+		break;
+	case Protocol::Max_Acc_XY:
+		if(config.value > 0) {
+			chassis_profile.set_limits(Velocity_Profile::X_Axis, config.value, 10.00f * config.value);
+			chassis_profile.set_limits(Velocity_Profile::Y_Axis, config.value, 10.00f * config.value);
+		}
+		break;
+	case Protocol::Max_Acc_Omega:
+		if(config.value > 0) {
+			chassis_profile.set_limits(Velocity_Profile::Omega_Axis, config.value, 10.00f * config.value);
+			heading.set_max_acc(config.value); // its slewing stays out of the profile's way
+		}
+		break;
+	case Protocol::Heading_Hold:
+		if(config.value >= -2.00f * (float)Pi && config.value <= 2.00f * (float)Pi) {
+			heading_hold_rad = config.value;
+			heading_hold = true;
+		}
+		break;
+	case Protocol::Heading_Release:
+		heading_hold = false;
+		break;
+	case Protocol::Heading_Reset:
+		if(config.value >= -2.00f * (float)Pi && config.value <= 2.00f * (float)Pi) heading.reset_heading(config.value);
+		break;
+	case Protocol::Telemetry_Groups:
+		if(config.value >= 0 && config.value <= Protocol::Telemetry_All) telemetry.set_groups((uint8_t)config.value);
+		break;
+	case Protocol::Telemetry_Decimation:
+		if(config.value >= 0 && config.value <= Telemetry_Max_Decimation) telemetry.set_decimation((uint32_t)config.value);
+		break;
+	default:
+		break;
+	}
+}
+
+static inline float clamp_abs(float value, float max) {
+	return (value > max) ? max : ((value < -max) ? -max : value);
+}
+
+// one decoded host frame, rx_cycles: arrival of the USB packet it came in
+static void handle_host_frame(const Protocol::frame& frame, uint32_t rx_cycles) {
+	switch(frame.type) {
+	case Protocol::Velocity:
+		if(!motors_armed) break;
+		// finite already (the decoder drops NaN and inf), ramped to at the control rate by
+		// update_chassis_profile(), omega closed on the gyro
+		command_watchdog.submit(clamp_abs(frame.velocity.x, chassis_max_xy), clamp_abs(frame.velocity.y, chassis_max_xy),
+		                        clamp_abs(frame.velocity.omega, chassis_max_omega), rx_cycles);
+		break;
+	case Protocol::Config:
+		apply_host_config(frame.config);
+		break;
+	case Protocol::Kick:
+	case Protocol::Dribble:
+		// no kicker / dribbler driver on this robot yet
+		break;
+	case Protocol::Telemetry:
+		// robot -> host only
+		break;
+	}
+}
+
 void sensorsLoop(void) {
 	delay(1000);
 }
 
+/* binary host frames (robot_protocol.hpp) from the USB virtual COM port,
+ * Protocol::Text_Command_Reader takes the old "x,y,omega" text instead */
 void actuatorsLoop(void) {
-//	if(has_setup){
-//		char cmd[64];
-//		int length;
-//		std::string cmd_str = "0,0,0";
-//		Parsed_cmd parsed_cmd;
-//		Wheel_speeds ws;
-//
-//		memset(cmd, 64, sizeof(char));
-//
-//		parsed_cmd.x = 0;
-//		parsed_cmd.y = 0;
-//		parsed_cmd.omega = 0;
-//
-//		ws.RF = 0;
-//		ws.RB = 0;
-//		ws.LF = 0;
-//		ws.LB = 0;
-//
-//		// wait until white button is pressed to proceed, for safety reasons
-//		while(button.read() == Low){
-//			motors.set_current(0, 0, 0, 0);
-//		}
-//
-//
-//		// motors.motor_test(DjiRM::Motor2);
-//		while(1){
-//			// Mapping: RF, RB, LB, LF
-//			motors.set_velocity(ws.RF, ws.RB, ws.LB, ws.LF);
-//	//		delay(2000);
-//	//		motors.set_velocity(25, 25, 25, 25);
-//	//		delay(2000);
-////			motors.set_velocity(50, 50, 50, 50);
-//	//		motors.set_velocity(100, 100, 100, 100);
-//
-//			xQueuePeek(io_message_queue, cmd, 0);
-//			length = strlen(cmd);
-//
-//			if(length < 4) continue;
-//
-//			cmd_str = std::string((const char*) cmd, length);
-////
-//			parsed_cmd = DjiRM::M2006_Motor::parse_cmd(cmd_str);
-//
-//			ws = DjiRM::M2006_Motor::bw_transformation(parsed_cmd.x, parsed_cmd.y, parsed_cmd.omega);
-//
-//
-//			delay(1000);
-//		}
-//
-//		motors.stop();
-//		motors.set_current(0, 0, 0, 0);
-//	}
+	if(has_setup) {
+		uint8_t packet[PACKET_SIZE];
+		Protocol::frame frame;
+		while(true) {
+			uint32_t rx_cycles; // stamped in the USB ISR, the deadline runs from there
+			size_t num_bytes = usb.read(packet, sizeof(packet), rx_cycles), used;
+			const uint8_t *bytes = packet;
+			while(num_bytes > 0) {
+				if(host_decoder.feed(bytes, num_bytes, frame, used) == Protocol::Decoder::Frame_Ready) {
+					handle_host_frame(frame, rx_cycles);
+				}
+				bytes += used;
+				num_bytes -= used;
+			}
+		}
+	}
 	delay(1000);
 }
 
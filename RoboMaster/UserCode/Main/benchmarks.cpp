@@ -0,0 +1,399 @@
+/*
+ * benchmarks.cpp
+ */
+
+#include "benchmarks.hpp"
+#include "incremental_pid.hpp"
+#include "batch_incremental_pid.hpp"
+#include "fixed_point_pid.hpp"
+#include "Motor/dji_m2006_motor.hpp"
+#include "Protocol/text_command.hpp"
+
+#include <string>
+#include <string.h>
+#include <math.h>
+
+using namespace stf;
+
+static const int num_bench_steps = 1000;
+static const int num_bench_inputs = 64; // input table is cycled through, so nothing gets constant folded
+static const int16_t bench_max_current = 9999;
+static const float bench_ctrl_freq_Hz = 5000.00f;
+
+static float bench_errors[num_bench_inputs][4];
+static int16_t bench_rpm_errors[num_bench_inputs][4];
+static volatile int16_t bench_sink; // keeps the results alive
+
+struct bench_result {
+	uint32_t avg_cycles;
+	uint32_t min_cycles;
+};
+
+// velocity errors in %, -50 ~ 50
+static void fill_bench_inputs(void) {
+	uint32_t seed = 12345;
+	for(int i = 0; i < num_bench_inputs; i++) {
+		for(int m = 0; m < 4; m++) {
+			seed = seed * 1664525 + 1013904223;
+			bench_errors[i][m] = (float)(seed >> 16) / 65536.00f * 100.00f - 50.00f;
+			bench_rpm_errors[i][m] = (int16_t)(bench_errors[i][m] * 191.00f); // % of 19100rpm
+		}
+	}
+}
+
+static void print_bench_result(stf::USART& out, const char *name, bench_result result) {
+	out << "[" << name << "] avg " << (int)result.avg_cycles << " cycles, min "
+		<< (int)result.min_cycles << " cycles per step" << stf::endl;
+}
+
+// what pid_update_motor_currents() did before the batched controller
+static bench_result bench_pid_per_object(void) {
+	INC_PID_Controller<float> m1_ctrl(1.5, 10, 0), m2_ctrl(1.5, 10, 0), m3_ctrl(1.5, 10, 0), m4_ctrl(1.5, 10, 0);
+	m1_ctrl.init(bench_ctrl_freq_Hz);
+	m2_ctrl.init(bench_ctrl_freq_Hz);
+	m3_ctrl.init(bench_ctrl_freq_Hz);
+	m4_ctrl.init(bench_ctrl_freq_Hz);
+
+	uint32_t total = 0, min_cycles = 0xFFFFFFFF;
+	for(int step = 0; step < num_bench_steps; step++) {
+		const float *e = bench_errors[step % num_bench_inputs];
+		uint32_t begin = cycles();
+
+		float new_curr1 = m1_ctrl.calculate(e[0]);
+		float new_curr2 = m2_ctrl.calculate(e[1]);
+		float new_curr3 = m3_ctrl.calculate(e[2]);
+		float new_curr4 = m4_ctrl.calculate(e[3]);
+		if (new_curr1 > 100.00 ) new_curr1 = 100.00;
+		if (new_curr1 < -100.00 ) new_curr1 = -100.00;
+		if (new_curr2 > 100.00 ) new_curr2 = 100.00;
+		if (new_curr2 < -100.00 ) new_curr2 = -100.00;
+		if (new_curr3 > 100.00 ) new_curr3 = 100.00;
+		if (new_curr3 < -100.00 ) new_curr3 = -100.00;
+		if (new_curr4 > 100.00 ) new_curr4 = 100.00;
+		if (new_curr4 < -100.00 ) new_curr4 = -100.00;
+		new_curr1 = stf::map(new_curr1, from_range((float)-100.00, (float)100.00),
+										to_range((float)-bench_max_current, (float)bench_max_current));
+		new_curr2 = stf::map(new_curr2, from_range((float)-100.00, (float)100.00),
+										to_range((float)-bench_max_current, (float)bench_max_current));
+		new_curr3 = stf::map(new_curr3, from_range((float)-100.00, (float)100.00),
+										to_range((float)-bench_max_current, (float)bench_max_current));
+		new_curr4 = stf::map(new_curr4, from_range((float)-100.00, (float)100.00),
+										to_range((float)-bench_max_current, (float)bench_max_current));
+		int16_t sum = (int16_t)new_curr1 + (int16_t)new_curr2 + (int16_t)new_curr3 + (int16_t)new_curr4;
+
+		uint32_t elapsed = cycles() - begin;
+		bench_sink = sum;
+		total += elapsed;
+		if(elapsed < min_cycles) min_cycles = elapsed;
+	}
+	bench_result result = {total / num_bench_steps, min_cycles};
+	return result;
+}
+
+// what pid_update_motor_currents() does now
+static bench_result bench_pid_batched(void) {
+	Batch_INC_PID_Controller<4> vel_ctrl(1.5, 10, 0);
+	vel_ctrl.init(bench_ctrl_freq_Hz);
+	vel_ctrl.set_output_limits(-100.00f, 100.00f);
+	static constexpr stf::LinearMap percent_to_current(from_range(-100.00f, 100.00f),
+	                                                   to_range((float)-bench_max_current, (float)bench_max_current));
+
+	uint32_t total = 0, min_cycles = 0xFFFFFFFF;
+	for(int step = 0; step < num_bench_steps; step++) {
+		const float *e = bench_errors[step % num_bench_inputs];
+		float outputs[4];
+		uint32_t begin = cycles();
+
+		vel_ctrl.calculate(e, outputs);
+		int16_t sum = 0;
+		for(int i = 0; i < 4; i++) sum += (int16_t)percent_to_current(outputs[i]);
+
+		uint32_t elapsed = cycles() - begin;
+		bench_sink = sum;
+		total += elapsed;
+		if(elapsed < min_cycles) min_cycles = elapsed;
+	}
+	bench_result result = {total / num_bench_steps, min_cycles};
+	return result;
+}
+
+void benchmark_pid(stf::USART& out) {
+	enable_cycle_counter();
+	fill_bench_inputs();
+
+	bench_result per_object = bench_pid_per_object();
+	bench_result batched = bench_pid_batched();
+
+	out << "PID step of 4 motors, " << num_bench_steps << " steps:" << stf::endl;
+	print_bench_result(out, "INC_PID_Controller<float> x4 + stf::map", per_object);
+	print_bench_result(out, "Batch_INC_PID_Controller<4>", batched);
+	if(batched.avg_cycles > 0) {
+		out << "speedup x" << (int)(per_object.avg_cycles * 10 / batched.avg_cycles) / 10
+			<< "." << (int)(per_object.avg_cycles * 10 / batched.avg_cycles) % 10 << stf::endl;
+	}
+}
+
+
+/* same gains and units on all three, per step: 4 rpm errors -> 4 current commands */
+static bench_result bench_pid_float_rpm(void) {
+	INC_PID_Controller<float> m1_ctrl(0.5, 2, 0), m2_ctrl(0.5, 2, 0), m3_ctrl(0.5, 2, 0), m4_ctrl(0.5, 2, 0);
+	m1_ctrl.init(bench_ctrl_freq_Hz);
+	m2_ctrl.init(bench_ctrl_freq_Hz);
+	m3_ctrl.init(bench_ctrl_freq_Hz);
+	m4_ctrl.init(bench_ctrl_freq_Hz);
+
+	uint32_t total = 0, min_cycles = 0xFFFFFFFF;
+	for(int step = 0; step < num_bench_steps; step++) {
+		const int16_t *e = bench_rpm_errors[step % num_bench_inputs];
+		uint32_t begin = cycles();
+
+		float out[4];
+		out[0] = m1_ctrl.calculate((float)e[0]);
+		out[1] = m2_ctrl.calculate((float)e[1]);
+		out[2] = m3_ctrl.calculate((float)e[2]);
+		out[3] = m4_ctrl.calculate((float)e[3]);
+		int16_t sum = 0;
+		for(int i = 0; i < 4; i++) {
+			if(out[i] > bench_max_current) out[i] = bench_max_current;
+			if(out[i] < -bench_max_current) out[i] = -bench_max_current;
+			sum += (int16_t)out[i];
+		}
+
+		uint32_t elapsed = cycles() - begin;
+		bench_sink = sum;
+		total += elapsed;
+		if(elapsed < min_cycles) min_cycles = elapsed;
+	}
+	bench_result result = {total / num_bench_steps, min_cycles};
+	return result;
+}
+
+template <typename T>
+static bench_result bench_pid_fixed_rpm(void) {
+	INC_PID_Controller<T> m1_ctrl(0.5, 2, 0), m2_ctrl(0.5, 2, 0), m3_ctrl(0.5, 2, 0), m4_ctrl(0.5, 2, 0);
+	m1_ctrl.init(bench_ctrl_freq_Hz);
+	m2_ctrl.init(bench_ctrl_freq_Hz);
+	m3_ctrl.init(bench_ctrl_freq_Hz);
+	m4_ctrl.init(bench_ctrl_freq_Hz);
+	m1_ctrl.set_integral_limit(bench_max_current);
+	m2_ctrl.set_integral_limit(bench_max_current);
+	m3_ctrl.set_integral_limit(bench_max_current);
+	m4_ctrl.set_integral_limit(bench_max_current);
+
+	uint32_t total = 0, min_cycles = 0xFFFFFFFF;
+	for(int step = 0; step < num_bench_steps; step++) {
+		const int16_t *e = bench_rpm_errors[step % num_bench_inputs];
+		uint32_t begin = cycles();
+
+		T out[4];
+		out[0] = m1_ctrl.calculate(e[0]);
+		out[1] = m2_ctrl.calculate(e[1]);
+		out[2] = m3_ctrl.calculate(e[2]);
+		out[3] = m4_ctrl.calculate(e[3]);
+		int16_t sum = 0;
+		for(int i = 0; i < 4; i++) {
+			if(out[i] > bench_max_current) out[i] = bench_max_current;
+			if(out[i] < -bench_max_current) out[i] = -bench_max_current;
+			sum += (int16_t)out[i];
+		}
+
+		uint32_t elapsed = cycles() - begin;
+		bench_sink = sum;
+		total += elapsed;
+		if(elapsed < min_cycles) min_cycles = elapsed;
+	}
+	bench_result result = {total / num_bench_steps, min_cycles};
+	return result;
+}
+
+void benchmark_fixed_point_pid(stf::USART& out) {
+	enable_cycle_counter();
+	fill_bench_inputs();
+
+	out << "PID step of 4 motors, rpm error -> current command, " << num_bench_steps << " steps:" << stf::endl;
+	print_bench_result(out, "INC_PID_Controller<float>", bench_pid_float_rpm());
+	print_bench_result(out, "INC_PID_Controller<q15_t>", bench_pid_fixed_rpm<q15_t>());
+	print_bench_result(out, "INC_PID_Controller<q31_t>", bench_pid_fixed_rpm<q31_t>());
+}
+
+
+static bench_result bench_map(void) {
+	const float max_rpm = 19100.00f;
+	uint32_t total = 0, min_cycles = 0xFFFFFFFF;
+	for(int step = 0; step < num_bench_steps; step++) {
+		const int16_t *rpm = bench_rpm_errors[step % num_bench_inputs];
+		const float *percent = bench_errors[step % num_bench_inputs];
+		uint32_t begin = cycles();
+
+		int16_t sum = 0;
+		for(int i = 0; i < 4; i++) {
+			float raw_speed = rpm[i];
+			if(raw_speed > max_rpm) raw_speed = max_rpm;
+			if(raw_speed < -max_rpm) raw_speed = -max_rpm;
+			float vel = stf::map(raw_speed, from_range(-max_rpm, max_rpm), to_range((float)-100.00, (float)100.00));
+			float curr = stf::map(percent[i], from_range((float)-100.00, (float)100.00),
+			                                  to_range((float)-bench_max_current, (float)bench_max_current));
+			sum += (int16_t)vel + (int16_t)curr;
+		}
+
+		uint32_t elapsed = cycles() - begin;
+		bench_sink = sum;
+		total += elapsed;
+		if(elapsed < min_cycles) min_cycles = elapsed;
+	}
+	bench_result result = {total / num_bench_steps, min_cycles};
+	return result;
+}
+
+static bench_result bench_linear_map(void) {
+	static constexpr stf::LinearMap rpm_to_percent(from_range(-19100.00f, 19100.00f), to_range(-100.00f, 100.00f));
+	static constexpr stf::LinearMap percent_to_current(from_range(-100.00f, 100.00f),
+	                                                   to_range((float)-bench_max_current, (float)bench_max_current));
+	uint32_t total = 0, min_cycles = 0xFFFFFFFF;
+	for(int step = 0; step < num_bench_steps; step++) {
+		const int16_t *rpm = bench_rpm_errors[step % num_bench_inputs];
+		const float *percent = bench_errors[step % num_bench_inputs];
+		uint32_t begin = cycles();
+
+		int16_t sum = 0;
+		for(int i = 0; i < 4; i++) {
+			float vel = rpm_to_percent.clamped(rpm[i]);
+			float curr = percent_to_current(percent[i]);
+			sum += (int16_t)vel + (int16_t)curr;
+		}
+
+		uint32_t elapsed = cycles() - begin;
+		bench_sink = sum;
+		total += elapsed;
+		if(elapsed < min_cycles) min_cycles = elapsed;
+	}
+	bench_result result = {total / num_bench_steps, min_cycles};
+	return result;
+}
+
+void benchmark_linear_map(stf::USART& out) {
+	enable_cycle_counter();
+	fill_bench_inputs();
+
+	out << "8 scalings of a control step, " << num_bench_steps << " steps:" << stf::endl;
+	print_bench_result(out, "stf::map", bench_map());
+	print_bench_result(out, "stf::LinearMap", bench_linear_map());
+}
+
+
+/* "x,y,omega" lines as the host sends them, then the ones parse_cmd() has to get
+ * through too: separators missing or doubled, junk after numbers, no number,
+ * exponents, hex, inf / nan, out of range, halfway between 2 floats, long digit strings.
+ * With what parse_cmd() makes of them under glibc (ok false where it throws), as printed
+ * by HostTests/text_command_test.cpp --table, which checks both parsers on random edits
+ * of these too. Left out: numbers under FLT_MIN and ones a hair off halfway between 2
+ * floats, where newlib's strtof() (strtod() then a cast) differs from a correctly rounded one */
+struct bench_command {
+	const char *line;
+	bool ok;
+	float x;
+	float y;
+	float omega;
+};
+static const bench_command bench_commands[] = {
+	{"0,0,0", true, 0.0f, 0.0f, 0.0f},
+	{"0.5,-0.25,1.2", true, 0.5f, -0.25f, 1.20000005f},
+	{"-0.35,0.8,-3.14159", true, -0.349999994f, 0.800000012f, -3.14159012f},
+	{"1.25,0,0.5", true, 1.25f, 0.0f, 0.5f},
+	{"-1.5,1.5,-6", true, -1.5f, 1.5f, -6.0f},
+	{"0.123,-0.456,0.789", true, 0.123000003f, -0.456f, 0.788999975f},
+	{"2,-2,0.05", true, 2.0f, -2.0f, 0.0500000007f},
+	{"0.001,0.999,-0.5", true, 0.00100000005f, 0.999000013f, -0.5f},
+	// odd ones
+	{"1.5", true, 1.5f, 1.5f, 1.5f},
+	{"", false, 0.0f, 0.0f, 0.0f},
+	{",", false, 0.0f, 0.0f, 0.0f},
+	{",,", false, 0.0f, 0.0f, 0.0f},
+	{"1,,2", false, 0.0f, 0.0f, 0.0f},
+	{"1,2,3,4", true, 1.0f, 2.0f, 3.0f},
+	{"abc,1,2", false, 0.0f, 0.0f, 0.0f},
+	{"1,2,x", false, 0.0f, 0.0f, 0.0f},
+	{"1x,2y,3z", true, 1.0f, 2.0f, 3.0f},
+	{" \t1 , 2 ,\r\n3 ", true, 1.0f, 2.0f, 3.0f},
+	{"1;2;3", true, 1.0f, 1.0f, 1.0f},
+	{"1 2 3", true, 1.0f, 1.0f, 1.0f},
+	{"--1,++2,+-3", false, 0.0f, 0.0f, 0.0f},
+	{"1.2.3,4..5,.6.", true, 1.20000005f, 4.0f, 0.600000024f},
+	{"+.5,-.5,5.", true, 0.5f, -0.5f, 5.0f},
+	{" 1e-3, 2E+2,\t-0", true, 0.00100000005f, 200.0f, -0.0f},
+	{"1e,1e+,1e-x", true, 1.0f, 1.0f, 1.0f},
+	{".e1,0,0", false, 0.0f, 0.0f, 0.0f},
+	{"0x1.8p1,0x10,-0x.8", true, 3.0f, 16.0f, -0.5f},
+	{"0x,0x.,0xp1", true, 0.0f, 0.0f, 0.0f},
+	{"0x123456789abcdef0123p0,0x.0000001p0,0X1P+3", true, 5.37300377e+21f, 3.7252903e-09f, 8.0f},
+	{"nan,inf,-infinity", true, NAN, INFINITY, -INFINITY},
+	{"NaN(abc),INF,-nan", true, NAN, INFINITY, -NAN},
+	{"nan(,nan(),nan(a_1)", true, NAN, NAN, NAN},
+	{"3.4028235e38,-3.4028235e38,0", true, 3.40282347e+38f, -3.40282347e+38f, 0.0f},
+	{"3.40282357e38,0,0", false, 0.0f, 0.0f, 0.0f},
+	{"3.5e38,0,0", false, 0.0f, 0.0f, 0.0f},
+	{"0e999999,-0,00000.000", true, 0.0f, -0.0f, 0.0f},
+	{"1e999999,1e-999999,0", false, 0.0f, 0.0f, 0.0f},
+	{"16777217,16777219,33554434", true, 16777216.0f, 16777220.0f, 33554432.0f},
+	{"12345678,123456789,0.123456789", true, 12345678.0f, 123456792.0f, 0.123456791f},
+	{"0.1000000000000000055511151231257827021181583404541015625,9999999999999999999999,1e11", true, 0.100000001f, 9.99999978e+21f, 9.9999998e+10f},
+	{"1.00000005960464477539062,0.333333343267440796,2.71828182845904523536", true, 1.0f, 0.333333343f, 2.71828175f}
+};
+static const int num_bench_typical_lines = 8;
+
+static bool same_float(float a, float b) {
+	if(a != a || b != b) return a != a && b != b && signbit(a) == signbit(b); // NaN payloads aren't kept
+	return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+void benchmark_text_command(stf::USART& out) {
+	enable_cycle_counter();
+	const int num_lines = sizeof(bench_commands) / sizeof(bench_commands[0]);
+
+	// what read_line() hands over, a std::string, then parse_cmd() copying it 4 more times
+	uint32_t total = 0, min_cycles = 0xFFFFFFFF;
+	for(int step = 0; step < num_bench_steps; step++) {
+		const char *line = bench_commands[step % num_bench_typical_lines].line;
+		uint32_t begin = cycles();
+
+		Parsed_cmd parsed = DjiRM::M2006_Motor::parse_cmd(std::string(line));
+
+		uint32_t elapsed = cycles() - begin;
+		bench_sink = (int16_t)(parsed.x + parsed.y + parsed.omega);
+		total += elapsed;
+		if(elapsed < min_cycles) min_cycles = elapsed;
+	}
+	bench_result with_strings = {total / num_bench_steps, min_cycles};
+
+	total = 0;
+	min_cycles = 0xFFFFFFFF;
+	for(int step = 0; step < num_bench_steps; step++) {
+		const char *line = bench_commands[step % num_bench_typical_lines].line;
+		uint32_t begin = cycles();
+
+		Protocol::velocity_payload cmd;
+		Protocol::parse_text_command(line, strlen(line), cmd);
+
+		uint32_t elapsed = cycles() - begin;
+		bench_sink = (int16_t)(cmd.x + cmd.y + cmd.omega);
+		total += elapsed;
+		if(elapsed < min_cycles) min_cycles = elapsed;
+	}
+	bench_result in_place = {total / num_bench_steps, min_cycles};
+
+	out << "\"x,y,omega\" command, " << num_bench_steps << " lines:" << stf::endl;
+	print_bench_result(out, "std::string + parse_cmd()", with_strings);
+	print_bench_result(out, "Protocol::parse_text_command()", in_place);
+
+	// the corpus against what parse_cmd() makes of it, here it would throw on the odd ones
+	int num_mismatches = 0;
+	for(int i = 0; i < num_lines; i++) {
+		const bench_command& expected = bench_commands[i];
+		Protocol::velocity_payload cmd;
+		bool ok = Protocol::parse_text_command(expected.line, strlen(expected.line), cmd);
+		if(ok != expected.ok || (ok && !(same_float(cmd.x, expected.x) && same_float(cmd.y, expected.y) && same_float(cmd.omega, expected.omega)))) {
+			if(num_mismatches++ < 5) out << "[mismatch] \"" << expected.line << "\"" << stf::endl;
+		}
+	}
+	out << "checked " << num_lines << " lines against parse_cmd()'s results, " << num_mismatches << " mismatches" << stf::endl;
+}
@@ -0,0 +1,29 @@
+/*
+ * benchmarks.hpp
+ *
+ * On-target micro-benchmarks of the control loop hot paths, timed with the
+ * DWT cycle counter and printed to the given serial port.
+ * Run them before the motors are enabled (e.g. at the top of defaultLoop),
+ * interrupts stay enabled, so the minimum per step is printed next to the average.
+ */
+
+#ifndef BENCHMARKS_HPP_
+#define BENCHMARKS_HPP_
+
+#include "stf.h"
+
+// per-object INC_PID_Controller<float> x4 + clamps + stf::map vs Batch_INC_PID_Controller<4>
+void benchmark_pid(stf::USART& out);
+
+// INC_PID_Controller<float> vs <q15_t> vs <q31_t>, ESC rpm in, int16_t current command out
+void benchmark_fixed_point_pid(stf::USART& out);
+
+// stf::map vs stf::LinearMap on the 8 scalings of a control step (4x rpm -> %, 4x % -> current)
+void benchmark_linear_map(stf::USART& out);
+
+/* "x,y,omega" text commands: std::string + M2006_Motor::parse_cmd() vs Protocol::parse_text_command()
+ * in place, then the latter on a corpus of odd lines against parse_cmd()'s precomputed results
+ * (HostTests/text_command_test.cpp checks both on the host, exceptions included) */
+void benchmark_text_command(stf::USART& out);
+
+#endif /* BENCHMARKS_HPP_ */
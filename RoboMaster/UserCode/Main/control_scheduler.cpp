@@ -0,0 +1,126 @@
+/*
+ * control_scheduler.cpp
+ */
+
+#include "control_scheduler.hpp"
+
+/* the timer ISR only knows the stf::Timer instance,
+ * same old-school pointer array as the stf library */
+static uint32_t num_ctrl_schedulers = 0;
+static ControlScheduler* active_ctrl_schedulers[Max_Num_Control_Schedulers];
+
+
+ControlScheduler::ControlScheduler(stf::Timer& timer) {
+	this->timer = &timer;
+	reset_timing_stats();
+	if(num_ctrl_schedulers >= Max_Num_Control_Schedulers) {
+		stf::exception("Too many ControlScheduler instances");
+		return;
+	}
+	active_ctrl_schedulers[num_ctrl_schedulers++] = this;
+}
+
+void ControlScheduler::init(float ctrl_freq_Hz) {
+	const uint32_t timer_freq_Hz = 1000000; // 1us resolution
+	if(ctrl_freq_Hz < 1.00f || ctrl_freq_Hz > 10000.00f) {
+		stf::exception("ControlScheduler: ctrl_freq_Hz out of range");
+		return;
+	}
+	this->ctrl_freq_Hz = ctrl_freq_Hz;
+
+	// period = (ARR + 1) / timer_freq
+	uint32_t period_cnt = (uint32_t)((float)timer_freq_Hz / ctrl_freq_Hz + 0.5f);
+	timer->init(period_cnt - 1, timer_freq_Hz);
+
+	stf::enable_cycle_counter();
+	nominal_period_cycles = stf::us_to_cycles(get_ctrl_period_us());
+}
+
+void ControlScheduler::begin(void) {
+	TIM_HandleTypeDef *htimx = timer->get_htimx();
+	ctrl_task = xTaskGetCurrentTaskHandle();
+	reset_timing_stats();
+
+	// force an update event so the new prescaler is loaded before the first period
+	__HAL_TIM_SET_COUNTER(htimx, 0);
+	htimx->Instance->EGR = TIM_EGR_UG;
+	__HAL_TIM_CLEAR_FLAG(htimx, TIM_FLAG_UPDATE);
+
+	is_running = true;
+	timer->counting_begin(stf::Interrupt);
+}
+
+void ControlScheduler::end(void) {
+	timer->counting_end(stf::Interrupt);
+	is_running = false;
+}
+
+void ControlScheduler::wait_for_next_period(void) {
+	is_waiting = true;
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	is_waiting = false;
+	wake_cycles = stf::cycles();
+
+	uint32_t wake_latency = wake_cycles - isr_cycles;
+	float wake_latency_us = stf::cycles_to_us(wake_latency);
+	if(wake_latency_us > stats.wake_latency_max_us) stats.wake_latency_max_us = wake_latency_us;
+
+	if(!is_first_period) {
+		uint32_t period = wake_cycles - prev_wake_cycles;
+		int32_t deviation = (int32_t)(period - nominal_period_cycles);
+		if(deviation < 0) deviation = -deviation;
+
+		stats.period_us = stf::cycles_to_us(period);
+		if(stats.period_us < stats.period_min_us) stats.period_min_us = stats.period_us;
+		if(stats.period_us > stats.period_max_us) stats.period_max_us = stats.period_us;
+
+		float jitter_us = stf::cycles_to_us((uint32_t)deviation);
+		if(jitter_us > stats.jitter_max_us) stats.jitter_max_us = jitter_us;
+	}
+	is_first_period = false;
+	prev_wake_cycles = wake_cycles;
+	stats.overruns = isr_overruns;
+}
+
+void ControlScheduler::period_completed(void) {
+	stats.exec_us = stf::cycles_to_us(stf::cycles() - wake_cycles);
+	if(stats.exec_us > stats.exec_max_us) stats.exec_max_us = stats.exec_us;
+	stats.num_periods++;
+}
+
+void ControlScheduler::reset_timing_stats(void) {
+	stats.num_periods = 0;
+	stats.overruns = 0;
+	stats.period_us = 0;
+	stats.period_min_us = 1e9f;
+	stats.period_max_us = 0;
+	stats.jitter_max_us = 0;
+	stats.wake_latency_max_us = 0;
+	stats.exec_us = 0;
+	stats.exec_max_us = 0;
+	isr_overruns = 0;
+	is_first_period = true;
+}
+
+// ISR context : keep it short, C-style only
+void ControlScheduler::interrupt_task(void) {
+	BaseType_t higher_priority_task_woken = pdFALSE;
+	if(!is_running || ctrl_task == NULL) return;
+
+	isr_cycles = stf::cycles();
+	if(!is_waiting) isr_overruns++;
+
+	vTaskNotifyGiveFromISR(ctrl_task, &higher_priority_task_woken);
+	portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
+
+/* overrides the weak def in stf_timer.cpp,
+ * invoked by HAL_TIM_PeriodElapsedCallback (main.c) */
+void timer_period_elasped_interrupt_task(stf::Timer *instance) {
+	for(uint32_t i = 0; i < num_ctrl_schedulers; i++) {
+		if(active_ctrl_schedulers[i]->get_timer() == instance) {
+			active_ctrl_schedulers[i]->interrupt_task();
+		}
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ * control_scheduler.hpp
+ *
+ * Periodic scheduler for the motor control loop, driven by a hardware
+ * timer's update interrupt instead of osDelay(), so that the loop can run
+ * faster than the 1kHz RTOS tick (1~5kHz) with a fixed period.
+ *
+ * The timer ISR does nothing but notify the control task, the task blocks
+ * in wait_for_next_period() and runs one control step per notification.
+ * Period, jitter and overruns are measured with the DWT cycle counter.
+ */
+
+#ifndef CONTROL_SCHEDULER_HPP_
+#define CONTROL_SCHEDULER_HPP_
+
+#include "stf.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define Max_Num_Control_Schedulers 2
+
+class ControlScheduler {
+public:
+	struct timing_stats {
+		uint32_t num_periods;   // control steps executed
+		uint32_t overruns;      // timer fired while the control task wasn't waiting for it (late/missed step)
+		float period_us;        // last measured period (task wake-up to task wake-up)
+		float period_min_us;
+		float period_max_us;
+		float jitter_max_us;    // max |measured period - nominal period|
+		float wake_latency_max_us; // max delay from ISR to task running
+		float exec_us;          // last control step execution time
+		float exec_max_us;
+	};
+
+	/* the stf::Timer must be constructed with the division factor of the clock
+	 * feeding its prescaler, e.g. 2 for TIM2 ~ TIM7 on APB1 (84MHz timer clock).
+	 * Its update interrupt must be enabled in CubeMx */
+	ControlScheduler(stf::Timer& timer);
+	~ControlScheduler(void) {}
+
+	// ctrl_freq_Hz : [1, 10000] Hz, timer resolution is 1us
+	void init(float ctrl_freq_Hz);
+
+	/* must be called from the control task, it is the task that gets woken up */
+	void begin(void);
+	void end(void);
+
+	/* blocks the calling (control) task until the next period begins */
+	void wait_for_next_period(void);
+	/* call right after the control step to close the execution time measurement */
+	void period_completed(void);
+
+	timing_stats get_timing_stats(void) {return stats;}
+	void reset_timing_stats(void);
+
+	inline float get_ctrl_freq_Hz(void) {return ctrl_freq_Hz;}
+	inline float get_ctrl_period_us(void) {return 1000000.00f / ctrl_freq_Hz;}
+	inline stf::Timer* get_timer(void) {return timer;}
+
+	// invoked by the timer's period elapsed interrupt, do not call it elsewhere
+	void interrupt_task(void);
+
+private:
+	stf::Timer *timer;
+	TaskHandle_t ctrl_task = NULL;
+	float ctrl_freq_Hz = 1000.00f;
+	uint32_t nominal_period_cycles;
+
+	volatile bool is_running = false;
+	volatile bool is_waiting = false;    // control task is blocked waiting for the next period
+	volatile uint32_t isr_cycles = 0;    // cycle stamp of the latest timer interrupt
+	volatile uint32_t isr_overruns = 0;
+
+	uint32_t prev_wake_cycles = 0;
+	uint32_t wake_cycles = 0;
+	bool is_first_period = true;
+	timing_stats stats;
+};
+
+#endif /* CONTROL_SCHEDULER_HPP_ */
@@ -0,0 +1,28 @@
+/*
+ * motor_autotune.cpp
+ */
+
+#include "motor_autotune.hpp"
+
+#include <string>
+
+void autotune_motors(DjiRM::M2006_Motor& motor, stf::USART& out) {
+	for(int m = DjiRM::Motor1; m <= DjiRM::Motor4; m++) {
+		if(!motor.start_autotune((DjiRM::motor_id)m)) continue;
+		DjiRM::autotune_state state;
+		do {
+			stf::delay(10);
+			state = motor.get_autotune_state();
+		} while(state == DjiRM::Autotune_Settling || state == DjiRM::Autotune_Recording);
+
+		DjiRM::autotune_result result = motor.get_autotune_result();
+		out << "[Autotune Motor" << m + 1 << "]";
+		if(state == DjiRM::Autotune_Failed) {
+			out << "[failed: " << std::string(result.failure) << "]" << stf::endl;
+			continue;
+		}
+		out << "[gain x1000: " << (int)(result.gain * 1000) << "][time constant: " << (int)(result.time_constant_s * 1000)
+			<< "ms][dead time: " << (int)(result.dead_time_s * 1000) << "ms][Ki x1000: " << (int)(result.Ki * 1000) << "]" << stf::endl;
+		stf::delay(500); // let it coast down before the next one
+	}
+}
@@ -0,0 +1,20 @@
+/*
+ * motor_autotune.hpp
+ *
+ * On-target velocity loop autotune of the M2006 motors, one step test after
+ * the other (see M2006_Motor::start_autotune()), results printed to the given
+ * serial port. Run it from a task other than the control task, with every
+ * wheel free to spin one way (e.g. in defaultLoop once the button is pressed).
+ */
+
+#ifndef MOTOR_AUTOTUNE_HPP_
+#define MOTOR_AUTOTUNE_HPP_
+
+#include "stf.h"
+#include "Motor/dji_m2006_motor.hpp"
+
+/* step test of each motor in turn, prints the identified model and the gains it applied
+ * (x1000, floats can't be printed). Blocks until the 4 tests are over */
+void autotune_motors(DjiRM::M2006_Motor& motor, stf::USART& out);
+
+#endif /* MOTOR_AUTOTUNE_HPP_ */
@@ -0,0 +1,73 @@
+/*
+ * latency_histogram.hpp
+ *
+ * Histogram of latencies with power of 2 buckets in microseconds:
+ * bucket 0 holds < 1us, bucket k holds [2^(k-1), 2^k) us, the last one
+ * everything above. Recording is a count leading zeros and an increment,
+ * cheap enough for an ISR.
+ *
+ * Single writer (an ISR or one task), get() from any task that the writer
+ * can preempt (Seqlock), reset() from the writer's side or while it's idle.
+ */
+
+#ifndef LATENCY_HISTOGRAM_HPP_
+#define LATENCY_HISTOGRAM_HPP_
+
+#include "stf.h"
+#include "seqlock.hpp"
+
+#define Latency_Histogram_Num_Buckets 20 // up to ~0.5s, above goes to the last bucket
+
+class Latency_Histogram {
+public:
+	struct histogram {
+		uint32_t count[Latency_Histogram_Num_Buckets];
+		uint32_t total;
+		uint32_t max_us;
+		uint32_t latest_us;
+
+		// upper bound of the bucket the p-th percentile (0 ~ 100) falls in, us, 0 when empty
+		uint32_t percentile_us(float p) const {
+			if(total == 0) return 0;
+			uint32_t rank = (uint32_t)(total * p / 100.00f);
+			if(rank >= total) rank = total - 1;
+			uint32_t seen = 0;
+			for(int k = 0; k < Latency_Histogram_Num_Buckets - 1; k++) {
+				seen += count[k];
+				if(seen > rank) return (uint32_t)1 << k;
+			}
+			return max_us;
+		}
+	};
+
+	Latency_Histogram(void) {reset();}
+
+	// writer side
+	void record(uint32_t us) {
+		uint32_t k = (us == 0) ? 0 : 32 - __builtin_clz(us);
+		if(k >= Latency_Histogram_Num_Buckets) k = Latency_Histogram_Num_Buckets - 1;
+		histogram& h = data.write_begin();
+		h.count[k]++;
+		h.total++;
+		if(us > h.max_us) h.max_us = us;
+		h.latest_us = us;
+		data.write_end();
+	}
+	inline void record_cycles(uint32_t cycles) {record((uint32_t)stf::cycles_to_us(cycles));}
+
+	void reset(void) {
+		histogram& h = data.write_begin();
+		for(int k = 0; k < Latency_Histogram_Num_Buckets; k++) h.count[k] = 0;
+		h.total = 0;
+		h.max_us = 0;
+		h.latest_us = 0;
+		data.write_end();
+	}
+
+	histogram get(void) {return data.read();}
+
+private:
+	Seqlock<histogram> data;
+};
+
+#endif /* LATENCY_HISTOGRAM_HPP_ */
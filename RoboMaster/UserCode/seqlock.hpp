@@ -0,0 +1,65 @@
+/*
+ * seqlock.hpp
+ *
+ * Sequence lock for sharing a small struct between an ISR (single writer)
+ * and tasks (readers) without disabling interrupts.
+ *
+ * The writer bumps the sequence to odd before modifying the data and back
+ * to even after, a reader retries whenever the sequence was odd or changed
+ * while it was copying. Readers never block the writer, so the ISR always
+ * runs in bounded time.
+ *
+ * read() spins until it gets a clean copy, so it must only be used where
+ * the writer can preempt the reader (ISR writer, task reader), otherwise the
+ * writer would never get to finish. Use try_read() in the opposite case.
+ */
+
+#ifndef SEQLOCK_HPP_
+#define SEQLOCK_HPP_
+
+#include "stf.h"
+
+template <typename T>
+class Seqlock {
+public:
+	Seqlock(void) {}
+
+	/* writer side, a single writer only */
+	T& write_begin(void) {
+		seq = seq + 1;
+		__DMB();
+		return data;
+	}
+	void write_end(void) {
+		__DMB();
+		seq = seq + 1;
+	}
+	void write(const T& value) {
+		write_begin() = value;
+		write_end();
+	}
+
+	/* reader side */
+	bool try_read(T& out) {
+		uint32_t seq_begin = seq;
+		if(seq_begin & 1) return false; // write in progress
+		__DMB();
+		out = data;
+		__DMB();
+		return seq == seq_begin;
+	}
+	T read(void) {
+		T out;
+		while(!try_read(out));
+		return out;
+	}
+
+	// number of completed writes * 2 (+1 while a write is in progress)
+	inline uint32_t get_sequence(void) {return seq;}
+
+private:
+	volatile uint32_t seq = 0;
+	T data;
+};
+
+#endif /* SEQLOCK_HPP_ */
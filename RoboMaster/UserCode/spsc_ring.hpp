@@ -0,0 +1,65 @@
+/*
+ * spsc_ring.hpp
+ *
+ * Lock-free ring of N items (a power of 2) between one producer and one
+ * consumer, e.g. an ISR handing items to a task, without disabling interrupts.
+ *
+ * Each side only ever writes its own index: the producer fills the slot
+ * before publishing it by bumping head, the consumer is done with a slot
+ * before giving it back by bumping tail. Both indices run freely and wrap,
+ * head - tail is the number of items in the ring.
+ */
+
+#ifndef SPSC_RING_HPP_
+#define SPSC_RING_HPP_
+
+#include "stf.h"
+
+template <typename T, uint32_t N>
+class Spsc_Ring {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "Spsc_Ring size must be a power of 2");
+public:
+	Spsc_Ring(void) {}
+
+	/* producer side */
+	bool push(const T& item) {
+		uint32_t h = head;
+		if(h - tail == N) return false; // full
+		data[h & (N - 1)] = item;
+		__DMB();
+		head = h + 1;
+		return true;
+	}
+	inline uint32_t free_space(void) {return N - (head - tail);}
+
+	/* consumer side */
+	bool peek(T& item) {
+		uint32_t t = tail;
+		if(head == t) return false; // empty
+		__DMB();
+		item = data[t & (N - 1)];
+		return true;
+	}
+	bool pop(T& item) {
+		if(!peek(item)) return false;
+		__DMB();
+		tail = tail + 1;
+		return true;
+	}
+	// drops the oldest item
+	inline void pop(void) {
+		if(head == tail) return;
+		__DMB();
+		tail = tail + 1;
+	}
+
+	// either side
+	inline uint32_t size(void) {return head - tail;}
+
+private:
+	volatile uint32_t head = 0; // written by the producer only
+	volatile uint32_t tail = 0; // written by the consumer only
+	T data[N];
+};
+
+#endif /* SPSC_RING_HPP_ */
@@ -9,6 +9,18 @@ namespace stf {
     uint32_t micros(void);
     void delay_us(uint32_t microseconds); 
     void delay(uint32_t milliseconds, delay_mode mode = RTOS);
+
+    /* DWT cycle counter, counts at HCLK (168MHz -> wraps every ~25s),
+     * the difference of two readings stays valid across a wrap as long as
+     * they are less than one wrap apart (unsigned subtraction) */
+    void enable_cycle_counter(void);
+    inline uint32_t cycles(void) {return DWT->CYCCNT;}
+    inline float cycles_to_us(uint32_t num_cycles) {
+        return (float)num_cycles / ((float)SystemCoreClock / 1000000.00f);
+    }
+    inline uint32_t us_to_cycles(float microseconds) {
+        return (uint32_t)(microseconds * ((float)SystemCoreClock / 1000000.00f));
+    }
 }
 
 #endif // !__stf_SYSTICK_H
@@ -40,10 +40,13 @@ enum tim_mode {
 
 /* 
  * Since this framework utilizes FreeRTOS, 
- * basic timer interrupt function is omitted 
- * from the Timer class implementation.
- * To use a timer interrupt, please use 
- * software timer via FreeRTOS
+ * software timers via FreeRTOS are preferred
+ * for anything running at or below the tick rate.
+ * For periodic interrupts faster than the RTOS tick
+ * (e.g. a control loop), call counting_begin(Interrupt)
+ * and override timer_period_elasped_interrupt_task(),
+ * the HAL_TIM_PeriodElapsedCallback in main.c must
+ * forward to call_this_inside_HAL_TIM_PeriodElaspedCallback()
  */
 namespace stf {
 
@@ -251,12 +254,14 @@ namespace stf {
 	};
 }
 
-__weak void timer_input_captured_interrupt_task(stf::Timer *instance, 
+/* the 2 interrupt tasks are not __weak here: the weak attribute would carry over to an override
+ * that includes this header, and link order would pick between it and the empty default in stf_timer.cpp */
+void timer_input_captured_interrupt_task(stf::Timer *instance, 
                                 HAL_TIM_ActiveChannel active_channel);
 extern "C" void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htimx);
 
 
-__weak void timer_period_elasped_interrupt_task(stf::Timer *instance);
+void timer_period_elasped_interrupt_task(stf::Timer *instance);
 // weak def of period elasped callback is already overwritten in main.c by freeRTOS
 extern "C" void call_this_inside_HAL_TIM_PeriodElaspedCallback(TIM_HandleTypeDef *htimx);
 
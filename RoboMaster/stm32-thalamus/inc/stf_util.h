@@ -48,6 +48,36 @@ namespace stf {
         return T1(((double(x) - double(fmin)) / (double(fmax) - double(fmin))) 
                 * (double(tmax) - double(tmin)) + double(tmin));
     }
+
+    /* map() for hot paths: scale and offset are computed once at construction,
+     * each call is then a single float multiply-add (vfma), no double, no range check.
+     * constexpr when the ranges are constants, e.g.
+     *   static constexpr LinearMap percent_to_amp(from_range(-100.0f, 100.0f), to_range(-10.0f, 10.0f)); */
+    class LinearMap {
+    public:
+        constexpr LinearMap(float fmin, float fmax, float tmin, float tmax) :
+            scale((tmax - tmin) / (fmax - fmin)),
+            offset((tmin * fmax - tmax * fmin) / (fmax - fmin)), // exactly 0 for symmetric ranges
+            out_min(tmin < tmax ? tmin : tmax),
+            out_max(tmin < tmax ? tmax : tmin) {}
+
+        // x outside of from_range extrapolates
+        inline float operator()(float x) const {return x * scale + offset;}
+        // saturates to to_range
+        inline float clamped(float x) const {
+            float y = x * scale + offset;
+            if(y > out_max) y = out_max;
+            if(y < out_min) y = out_min;
+            return y;
+        }
+
+        constexpr float get_scale(void) const {return scale;}
+        constexpr float get_offset(void) const {return offset;}
+
+    private:
+        float scale, offset;
+        float out_min, out_max;
+    };
     
 
 
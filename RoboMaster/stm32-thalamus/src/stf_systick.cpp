@@ -34,3 +34,9 @@ void stf::delay(uint32_t Time, delay_mode mode) {
 }
 
 
+void stf::enable_cycle_counter(void) {
+	if(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) return; // already running
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
@@ -14,6 +14,8 @@ Timer::Timer(TIM_HandleTypeDef *htimx, uint32_t APBx_division_factor,
 	this->APBx_division_factor = APBx_division_factor;
 	this->resolution = resolution;
 	this->mode = Uninitialized;
+	// register for the interrupt callbacks to find this instance
+	if(num_tims < Max_Num_TIMs) active_tims[num_tims++] = this;
 }
 
 Timer::~Timer() {}
@@ -333,6 +335,17 @@ static void timer_encoder_overflow_interrupt_task(stf::Timer *instance) {
 
 /*** interrupt handler callbacks ***/
 
+// default (empty) interrupt tasks, to be overridden by user code
+__weak void timer_input_captured_interrupt_task(stf::Timer *instance,
+                                HAL_TIM_ActiveChannel active_channel) {
+	UNUSED(instance);
+	UNUSED(active_channel);
+}
+
+__weak void timer_period_elasped_interrupt_task(stf::Timer *instance) {
+	UNUSED(instance);
+}
+
 void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htimx) {
 	for(uint32_t i = 0; i < num_tims; i++) {
 		if(active_tims[i]->get_htimx() == htimx) {